@@ -0,0 +1,80 @@
+//
+//  arena.cpp
+//  MSIM495
+//
+
+#include "arena.h"
+#include <stdlib.h>
+
+namespace Physics {
+    // FrameArena //
+    ////////////////
+    
+    FrameArena::FrameArena(std::size_t initial, MemoryTag tag) : tag(tag) {
+        add_block(initial);
+    }
+    
+    FrameArena::~FrameArena() {
+        for (Block &b : blocks) {
+            MemoryStats::record_free(tag, b.size);
+            free(b.data);
+        }
+    }
+    
+    void FrameArena::add_block(std::size_t size) {
+        Block b;
+        b.data = static_cast<unsigned char*>(malloc(size));
+        if (!b.data) throw std::bad_alloc();
+        MemoryStats::record_allocate(tag, size);
+        b.size = size;
+        blocks.push_back(b);
+    }
+    
+    void * FrameArena::allocate(std::size_t bytes, std::size_t align) {
+        for (;;) {
+            Block &b = blocks[current];
+            std::size_t address = reinterpret_cast<std::size_t>(b.data) + offset;
+            std::size_t start = (address + align - 1) & ~(align - 1);
+            std::size_t end = start - reinterpret_cast<std::size_t>(b.data) + bytes;
+            
+            if (end <= b.size) {
+                frame_used += end - offset;
+                offset = end;
+                return reinterpret_cast<void*>(start);
+            }
+            
+            // Spill into the next block, growing so long frames settle quickly
+            if (current + 1 == blocks.size()) {
+                std::size_t size = b.size * 2;
+                if (size < bytes + align) size = bytes + align;
+                add_block(size);
+            }
+            ++current;
+            offset = 0;
+        }
+    }
+    
+    void FrameArena::reset() {
+        if (frame_used > high_water) high_water = frame_used;
+        
+        if (blocks.size() > 1) {
+            std::size_t total = capacity();
+            for (Block &b : blocks) {
+                MemoryStats::record_free(tag, b.size);
+                free(b.data);
+            }
+            blocks.clear();
+            add_block(total);
+        }
+        
+        current = 0;
+        offset = 0;
+        frame_used = 0;
+    }
+    
+    std::size_t FrameArena::capacity() const {
+        std::size_t total = 0;
+        for (const Block &b : blocks) total += b.size;
+        return total;
+    }
+}
@@ -0,0 +1,117 @@
+//
+//  arena.h
+//  MSIM495
+//
+
+#ifndef __MSIM495__arena__
+#define __MSIM495__arena__
+
+#include <vector>
+#include <new>
+#include <cstddef>
+#include <utility>
+#include "memstats.h"
+
+namespace Physics {
+    /**
+     * Bump allocator for data that lives until the next reset
+     * Allocating moves a cursor, reset moves it back in O(1). When a
+     * frame spills past the first block, reset swaps the blocks for one
+     * block big enough for the whole frame, so from the second frame of
+     * the same size on there are no heap calls at all
+     * Destructors are never run, only put trivially destructible data
+     * here or data whose destructor doesn't matter
+     */
+    class FrameArena {
+        struct Block {
+            unsigned char * data;
+            std::size_t size;
+        };
+        
+        std::vector<Block> blocks;
+        MemoryTag tag;
+        unsigned current = 0;
+        std::size_t offset = 0;
+        
+        /*
+         * Bytes handed out this frame over every block, and the most any frame used
+         */
+        std::size_t frame_used = 0;
+        std::size_t high_water = 0;
+        
+        void add_block(std::size_t size);
+    
+    public:
+        /**
+         * Blocks are counted against tag when memory stats are on
+         */
+        explicit FrameArena(std::size_t initial = 64 * 1024, MemoryTag tag = MEMORY_GENERAL);
+        ~FrameArena();
+        
+        FrameArena(const FrameArena &) = delete;
+        FrameArena & operator=(const FrameArena &) = delete;
+        
+        /**
+         * Uninitialized memory, valid until reset
+         */
+        void * allocate(std::size_t bytes, std::size_t align = alignof(std::max_align_t));
+        
+        template<typename T, typename... Args>
+        T * create(Args &&... args) {
+            return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        }
+        
+        /**
+         * count default constructed Ts
+         */
+        template<typename T>
+        T * create_array(std::size_t count) {
+            T * items = static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+            for (std::size_t i = 0; i < count; ++i) new (items + i) T();
+            return items;
+        }
+        
+        /**
+         * Forget everything allocated since the last reset
+         */
+        void reset();
+        
+        std::size_t used() const { return frame_used; }
+        std::size_t capacity() const;
+        std::size_t get_high_water() const { return high_water; }
+    };
+    
+    
+    
+    /**
+     * Standard allocator over a FrameArena so containers can live in it
+     * Freeing is a no op, memory comes back on the arena's reset
+     *
+     *     std::vector<Object*, ArenaAllocator<Object*>> list{ArenaAllocator<Object*>(&arena)};
+     */
+    template<typename T>
+    struct ArenaAllocator {
+        typedef T value_type;
+        
+        FrameArena * arena;
+        
+        explicit ArenaAllocator(FrameArena * arena) : arena(arena) {}
+        
+        template<typename U>
+        ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+        
+        T * allocate(std::size_t count) {
+            return static_cast<T*>(arena->allocate(sizeof(T) * count, alignof(T)));
+        }
+        
+        void deallocate(T *, std::size_t) {}
+        
+        template<typename U>
+        bool operator==(const ArenaAllocator<U> &other) const { return arena == other.arena; }
+        
+        template<typename U>
+        bool operator!=(const ArenaAllocator<U> &other) const { return arena != other.arena; }
+    };
+}
+
+#endif /* defined(__MSIM495__arena__) */
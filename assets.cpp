@@ -0,0 +1,246 @@
+//
+//  assets.cpp
+//  MSIM495
+//
+
+#include "assets.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+namespace Graphics {
+    static unsigned long align_16(unsigned long bytes) {
+        return (bytes + 15) & ~15ul;
+    }
+    
+    // Image //
+    ///////////
+    
+    Image::~Image() {
+        if (decoded) stbi_image_free(decoded);
+    }
+    
+    
+    
+    // AssetCache //
+    ////////////////
+    
+    AssetCache::AssetCache(const char * raw_cache_path) {
+        if (raw_cache_path) {
+            raw_path = raw_cache_path;
+            map_raw_cache();
+        }
+        worker = std::thread([this]() { loop(); });
+    }
+    
+    AssetCache::~AssetCache() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        worker.join();
+        
+        // Images handed out from the mapping must not outlive the cache
+        if (raw) munmap(const_cast<unsigned char*>(raw), raw_size);
+    }
+    
+    void AssetCache::map_raw_cache() {
+        int fd = ::open(raw_path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        
+        struct stat info;
+        if (fstat(fd, &info) != 0 || (unsigned long)info.st_size < sizeof(RawHeader)) {
+            ::close(fd);
+            return;
+        }
+        
+        void * mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) return;
+        
+        const RawHeader * header = static_cast<const RawHeader*>(mapped);
+        const unsigned long table_end = sizeof(RawHeader) + (unsigned long)header->count * sizeof(RawEntry);
+        if (
+            header->magic != magic_value
+            || header->version != current_version
+            || table_end > (unsigned long)info.st_size
+        ) {
+            munmap(mapped, info.st_size);
+            return;
+        }
+        
+        raw = static_cast<const unsigned char*>(mapped);
+        raw_size = info.st_size;
+    }
+    
+    bool AssetCache::from_raw_cache(Image &image) const {
+        if (!raw) return false;
+        
+        const RawHeader * header = reinterpret_cast<const RawHeader*>(raw);
+        const RawEntry * entries = reinterpret_cast<const RawEntry*>(raw + sizeof(RawHeader));
+        
+        for (unsigned e = 0; e < header->count; ++e) {
+            const RawEntry &entry = entries[e];
+            if (entry.mtime != image.mtime || strncmp(entry.path, image.path.c_str(), sizeof(entry.path)) != 0) continue;
+            if (image.channels && entry.channels != image.channels) continue;
+            
+            const unsigned long bytes = (unsigned long)entry.width * entry.height * entry.channels;
+            if (entry.offset > raw_size || bytes > raw_size - entry.offset) return false;
+            
+            image.width = entry.width;
+            image.height = entry.height;
+            image.channels = entry.channels;
+            image.pixels = raw + entry.offset;
+            image.cached = true;
+            return true;
+        }
+        
+        return false;
+    }
+    
+    void AssetCache::decode(Image &image) {
+        int width, height, channels;
+        image.decoded = stbi_load(image.path.c_str(), &width, &height, &channels, image.channels);
+        
+        if (!image.decoded) {
+            image.error = stbi_failure_reason();
+            image.state.store(Image::FAILED, std::memory_order_release);
+            return;
+        }
+        
+        image.width = width;
+        image.height = height;
+        if (!image.channels) image.channels = channels;
+        image.pixels = image.decoded;
+        image.state.store(Image::READY, std::memory_order_release);
+    }
+    
+    void AssetCache::loop() {
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;) {
+            wake.wait(guard, [this]() { return stopping || !queue.empty(); });
+            if (stopping) return;
+            
+            std::shared_ptr<Image> image = queue.front();
+            queue.pop_front();
+            ++decoding;
+            
+            guard.unlock();
+            decode(*image);
+            guard.lock();
+            
+            --decoding;
+            decoded_any = decoded_any || image->is_ready();
+            if (!queue.empty()) continue;
+            
+            done.notify_all();
+            
+            // Out of work, keep what was decoded for the next start
+            if (decoded_any && !raw_path.empty()) {
+                decoded_any = false;
+                guard.unlock();
+                save_raw_cache();
+                guard.lock();
+            }
+        }
+    }
+    
+    ImageRef AssetCache::request(const char * path, int channels) {
+        struct stat info;
+        const long mtime = stat(path, &info) == 0 ? (long)info.st_mtime : -1;
+        
+        std::string key = path;
+        key += '|';
+        key += std::to_string(channels);
+        
+        std::lock_guard<std::mutex> guard(lock);
+        auto found = images.find(key);
+        if (found != images.end() && found->second->mtime == mtime) return found->second;
+        
+        std::shared_ptr<Image> image = std::make_shared<Image>();
+        image->path = path;
+        image->mtime = mtime;
+        image->channels = channels;
+        images[key] = image;
+        
+        if (mtime < 0) {
+            image->error = "file not found";
+            image->state.store(Image::FAILED, std::memory_order_release);
+        }
+        else if (from_raw_cache(*image)) {
+            image->state.store(Image::READY, std::memory_order_release);
+        }
+        else {
+            queue.push_back(image);
+            wake.notify_one();
+        }
+        
+        return image;
+    }
+    
+    void AssetCache::wait() {
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [this]() { return queue.empty() && decoding == 0; });
+    }
+    
+    bool AssetCache::save_raw_cache() {
+        if (raw_path.empty()) return false;
+        
+        std::vector<std::shared_ptr<Image>> ready;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            for (auto &named : images) {
+                const Image &image = *named.second;
+                if (image.is_ready() && image.path.size() < sizeof(RawEntry::path)) ready.push_back(named.second);
+            }
+        }
+        
+        RawHeader header = { magic_value, current_version, (unsigned)ready.size(), 0 };
+        std::vector<RawEntry> entries(ready.size());
+        
+        unsigned long offset = align_16(sizeof(RawHeader) + entries.size() * sizeof(RawEntry));
+        for (unsigned e = 0; e < ready.size(); ++e) {
+            const Image &image = *ready[e];
+            RawEntry &entry = entries[e];
+            memset(&entry, 0, sizeof(RawEntry));
+            strncpy(entry.path, image.path.c_str(), sizeof(entry.path) - 1);
+            entry.mtime = image.mtime;
+            entry.width = image.width;
+            entry.height = image.height;
+            entry.channels = image.channels;
+            entry.offset = offset;
+            offset = align_16(offset + image.bytes());
+        }
+        
+        // Written beside and renamed over, images mapped from the old
+        // file keep reading the old file
+        const std::string temporary = raw_path + ".tmp";
+        FILE * file = fopen(temporary.c_str(), "wb");
+        if (!file) return false;
+        
+        static const unsigned char padding[16] = {};
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+            && (entries.empty() || fwrite(entries.data(), sizeof(RawEntry), entries.size(), file) == entries.size());
+        
+        unsigned long written = sizeof(RawHeader) + entries.size() * sizeof(RawEntry);
+        for (unsigned e = 0; e < ready.size() && ok; ++e) {
+            const unsigned long pad = entries[e].offset - written;
+            ok = fwrite(padding, 1, pad, file) == pad
+                && fwrite(ready[e]->pixels, 1, ready[e]->bytes(), file) == ready[e]->bytes();
+            written = entries[e].offset + ready[e]->bytes();
+        }
+        
+        ok = fclose(file) == 0 && ok;
+        if (!ok || rename(temporary.c_str(), raw_path.c_str()) != 0) {
+            unlink(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,163 @@
+//
+//  assets.h
+//  MSIM495
+//
+
+#ifndef __MSIM495__assets__
+#define __MSIM495__assets__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+
+namespace Graphics {
+    /**
+     * Decoded image shared by everyone who asked for the same file
+     * Pixels are only there once state is READY, they point into the
+     * raw cache mapping or at stb_image's buffer
+     */
+    struct Image {
+        enum State { PENDING, READY, FAILED };
+        
+        std::atomic<int> state{PENDING};
+        std::string path;
+        long mtime = 0;
+        int channels = 4;
+        
+        int width = 0;
+        int height = 0;
+        const unsigned char * pixels = nullptr;
+        
+        /*
+         * stb_image's reason for a FAILED image
+         */
+        const char * error = nullptr;
+        
+        /*
+         * Came out of the raw cache rather than a decode
+         */
+        bool cached = false;
+        
+        bool is_ready() const { return state.load(std::memory_order_acquire) == READY; }
+        bool is_failed() const { return state.load(std::memory_order_acquire) == FAILED; }
+        unsigned long bytes() const { return (unsigned long)width * height * channels; }
+        
+        Image() {}
+        ~Image();
+        
+        Image(const Image &) = delete;
+        Image & operator=(const Image &) = delete;
+    
+    private:
+        friend class AssetCache;
+        
+        /*
+         * Owned decode, freed with the image
+         */
+        unsigned char * decoded = nullptr;
+    };
+    
+    typedef std::shared_ptr<const Image> ImageRef;
+    
+    
+    
+    /**
+     * Images decoded on a background thread through stb_image and
+     * memoized by (path, mtime, channels), so asking again is free and
+     * an edited file is decoded again
+     *
+     * With a raw cache path, images whose path and mtime match an entry
+     * of that file are READY straight away, their pixels read in place
+     * from a read only mapping. Whenever the decoder runs out of work
+     * after decoding something, it rewrites the file with every image
+     * it holds so the next start skips the PNGs altogether
+     *
+     *     raw cache: header | entries | pixels (each 16 byte aligned)
+     *
+     *     Graphics::AssetCache assets("game.assets");
+     *     Graphics::ImageRef scope = assets.request("scope1.png");
+     *     ...
+     *     if (scope->is_ready()) upload(scope->pixels);
+     */
+    class AssetCache {
+    public:
+        static constexpr unsigned magic_value = 0x54535341; // "ASST"
+        static constexpr unsigned current_version = 1;
+        
+        struct RawHeader {
+            unsigned magic;
+            unsigned version;
+            unsigned count;
+            unsigned reserved;
+        };
+        
+        struct RawEntry {
+            char path[240];
+            long mtime;
+            int width;
+            int height;
+            int channels;
+            int reserved;
+            unsigned long offset;
+        };
+    
+    private:
+        std::string raw_path;
+        const unsigned char * raw = nullptr;
+        unsigned long raw_size = 0;
+        
+        /*
+         * Every image asked for, by path and channel count
+         */
+        std::unordered_map<std::string, std::shared_ptr<Image>> images;
+        
+        std::mutex lock;
+        std::condition_variable wake;
+        std::condition_variable done;
+        std::deque<std::shared_ptr<Image>> queue;
+        unsigned decoding = 0;
+        bool decoded_any = false;
+        bool stopping = false;
+        std::thread worker;
+        
+        void map_raw_cache();
+        bool from_raw_cache(Image &image) const;
+        void decode(Image &image);
+        void loop();
+    
+    public:
+        /**
+         * raw_cache_path may be null for no raw cache
+         */
+        explicit AssetCache(const char * raw_cache_path = nullptr);
+        ~AssetCache();
+        
+        AssetCache(const AssetCache &) = delete;
+        AssetCache & operator=(const AssetCache &) = delete;
+        
+        /**
+         * The image at path with channels components per pixel (0 keeps
+         * the file's own), decoding it in the background if it isn't
+         * known yet. Never blocks on the decode
+         */
+        ImageRef request(const char * path, int channels = 4);
+        
+        /**
+         * Block until every requested image is READY or FAILED
+         */
+        void wait();
+        
+        /**
+         * Write every READY image to the raw cache file now
+         */
+        bool save_raw_cache();
+    };
+}
+
+#endif /* defined(__MSIM495__assets__) */
@@ -38,8 +38,8 @@ namespace A3q1 {
         printf("%f\n", Graphics::get_seconds_per_frame());
         
         Physics::Vector3 new_g = attraction_point.get_position() - target.get_position();
-        Physics::real distance = target.get_position().distance(attraction_point.get_position());
-        gravity.set_gravity(new_g * ( 1 / powf(distance, 2) ));
+        Physics::real distance_squared = target.get_position().distance_squared(attraction_point.get_position());
+        gravity.set_gravity(new_g * ( 1 / distance_squared ));
         particle_force_registrar.update_forces(frame_time);
         target.integrate(frame_time);
     }
@@ -187,9 +187,8 @@ namespace A3q3 {
             for (; i != c_list->end(); ++i) {
                 if (&(*i) != this) {
                     Claustrophobe * other = &(*i);
-                    Physics::real distance = get_position().distance(i->get_position());
                     if (
-                        distance < personal_space
+                        get_position().within(i->get_position(), personal_space)
                         && !pfr->check_force_registered(this, other->get_spring())
                     ) {
                         pfr->add(other, &this->spring);
@@ -0,0 +1,48 @@
+//
+//  batch.h
+//  MSIM495
+//
+
+#ifndef __MSIM495__batch__
+#define __MSIM495__batch__
+
+#include "core.h"
+#include "jobs.h"
+
+namespace Physics {
+    /**
+     * Run one independent copy of Scene per parameter set, in parallel
+     *
+     * Scene needs:
+     *     Scene(const Params &)        build a private world
+     *     void step(real duration)     advance it
+     *     bool finished() const        stop early
+     *     Metrics metrics() const      results of the run
+     *
+     * Scenes share nothing but the damping table, which any of them may
+     * intern into while the batch runs. Each world keeps its own damping
+     * factors, so runs don't need to share a duration either
+     */
+    template<typename Scene, typename Params, typename Metrics>
+    void run_batch(
+        JobSystem * jobs,
+        const Params * params,
+        Metrics * results,
+        unsigned count,
+        real duration,
+        unsigned max_steps,
+        unsigned grain = 4
+    ) {
+        parallel_for(jobs, count, grain, [=](unsigned begin, unsigned end, unsigned) {
+            for (unsigned i = begin; i < end; ++i) {
+                Scene scene(params[i]);
+                for (unsigned s = 0; s < max_steps && !scene.finished(); ++s) {
+                    scene.step(duration);
+                }
+                results[i] = scene.metrics();
+            }
+        });
+    }
+}
+
+#endif /* defined(__MSIM495__batch__) */
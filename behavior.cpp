@@ -0,0 +1,172 @@
+//
+//  behavior.cpp
+//  MSIM495
+//
+
+#include "behavior.h"
+#include <algorithm>
+
+namespace Physics {
+    // Awaiters //
+    //////////////
+    
+    void StepAwaiter::await_suspend(Behavior::Handle h) {
+        h.promise().scheduler->wait_steps(h, steps);
+    }
+    
+    void ContactAwaiter::await_suspend(Behavior::Handle h) {
+        handle = h;
+        h.promise().scheduler->wait_contact(this);
+    }
+    
+    
+    
+    // BehaviorScheduler //
+    ///////////////////////
+    
+    void BehaviorScheduler::spawn(Behavior behavior) {
+        Behavior::Handle h = behavior.release();
+        h.promise().scheduler = this;
+        owned.push_back(h);
+        spawned.push_back(h);
+    }
+    
+    void BehaviorScheduler::wait_steps(Behavior::Handle h, unsigned steps) {
+        step_waits.push(StepWait{step + steps, wait_order++, h});
+    }
+    
+    void BehaviorScheduler::wait_condition(ConditionWait * wait) {
+        condition_waits.push_back(wait);
+    }
+    
+    void BehaviorScheduler::wait_contact(ContactAwaiter * wait) {
+        contact_waits.emplace(wait->particle, wait);
+    }
+    
+    void BehaviorScheduler::begin_step() {
+        ++step;
+        resuming = true;
+        
+        // Anything resumed below that waits again lands in the lists
+        // for a later step, never back into the pass that's running.
+        // A clear() from a behavior ends the pass, the rest are doomed
+        std::vector<Behavior::Handle> starting;
+        starting.swap(spawned);
+        for (Behavior::Handle h : starting) {
+            if (!doomed.empty()) break;
+            h.resume();
+        }
+        
+        std::vector<Behavior::Handle> due;
+        while (doomed.empty() && !step_waits.empty() && step_waits.top().step <= step) {
+            due.push_back(step_waits.top().handle);
+            step_waits.pop();
+        }
+        for (Behavior::Handle h : due) {
+            if (!doomed.empty()) break;
+            h.resume();
+        }
+        
+        std::vector<ConditionWait*> polling;
+        if (doomed.empty()) polling.swap(condition_waits);
+        for (ConditionWait * wait : polling) {
+            if (!doomed.empty()) break;
+            if (wait->ready()) wait->handle.resume();
+            else condition_waits.push_back(wait);
+        }
+        
+        resuming = false;
+        reap();
+    }
+    
+    void BehaviorScheduler::match_contacts(const ParticleContact * contacts, unsigned count) {
+        if (contact_waits.empty()) return;
+        
+        for (unsigned c = 0; c < count && !contact_waits.empty(); ++c) {
+            const ParticleContact &contact = contacts[c];
+            const Particle * ends[2] = { contact.left, contact.right };
+            
+            for (unsigned e = 0; e < 2; ++e) {
+                const Particle * other = ends[1 - e];
+                auto range = contact_waits.equal_range(ends[e]);
+                for (auto it = range.first; it != range.second;) {
+                    ContactAwaiter * wait = it->second;
+                    if (wait->other && wait->other != other) {
+                        ++it;
+                        continue;
+                    }
+                    
+                    wait->contact = contact;
+                    contact_ready.push_back(wait->handle);
+                    it = contact_waits.erase(it);
+                }
+            }
+        }
+    }
+    
+    void BehaviorScheduler::end_step() {
+        resuming = true;
+        
+        std::vector<Behavior::Handle> ready;
+        ready.swap(contact_ready);
+        for (Behavior::Handle h : ready) {
+            if (!doomed.empty()) break;
+            h.resume();
+        }
+        
+        resuming = false;
+        reap();
+    }
+    
+    void BehaviorScheduler::reap() {
+        auto done = std::partition(owned.begin(), owned.end(), [](Behavior::Handle h) {
+            return !h.done();
+        });
+        for (auto it = done; it != owned.end(); ++it) it->destroy();
+        owned.erase(done, owned.end());
+        
+        if (doomed.empty()) return;
+        
+        // The behavior that called clear() may have waited again since,
+        // its awaiter lives in the frame so it has to go first
+        auto is_doomed = [this](Behavior::Handle h) {
+            return std::find(doomed.begin(), doomed.end(), h) != doomed.end();
+        };
+        
+        condition_waits.erase(
+            std::remove_if(condition_waits.begin(), condition_waits.end(), [&](ConditionWait * wait) {
+                return is_doomed(wait->handle);
+            }),
+            condition_waits.end()
+        );
+        
+        for (auto it = contact_waits.begin(); it != contact_waits.end();) {
+            if (is_doomed(it->second->handle)) it = contact_waits.erase(it);
+            else ++it;
+        }
+        
+        std::vector<StepWait> keep;
+        for (; !step_waits.empty(); step_waits.pop()) {
+            if (!is_doomed(step_waits.top().handle)) keep.push_back(step_waits.top());
+        }
+        for (const StepWait &wait : keep) step_waits.push(wait);
+        
+        for (Behavior::Handle h : doomed) h.destroy();
+        doomed.clear();
+    }
+    
+    void BehaviorScheduler::clear() {
+        if (resuming) {
+            doomed.insert(doomed.end(), owned.begin(), owned.end());
+        }
+        else {
+            for (Behavior::Handle h : owned) h.destroy();
+        }
+        owned.clear();
+        spawned.clear();
+        contact_ready.clear();
+        condition_waits.clear();
+        contact_waits.clear();
+        step_waits = decltype(step_waits)();
+    }
+}
@@ -0,0 +1,224 @@
+//
+//  behavior.h
+//  MSIM495
+//
+
+#ifndef __MSIM495__behavior__
+#define __MSIM495__behavior__
+
+#include <coroutine>
+#include <exception>
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include "collision.h"
+
+namespace Physics {
+    class BehaviorScheduler;
+    
+    /**
+     * Scripted logic as a C++20 coroutine
+     * A behavior runs until it co_awaits wait_steps, wait_until or
+     * wait_contact and the world resumes it at a fixed point of a later step
+     *
+     *     Behavior release(Particle * hook) {
+     *         co_await wait_steps(30);
+     *         ParticleContact c = co_await wait_contact(hook);
+     *         ...
+     *     }
+     *     world.behaviors->spawn(release(hook));
+     */
+    class Behavior {
+    public:
+        struct promise_type {
+            BehaviorScheduler * scheduler = nullptr;
+            
+            Behavior get_return_object() {
+                return Behavior(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+            
+            // Started by the scheduler on the next step, kept until it reaps it
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+        
+        typedef std::coroutine_handle<promise_type> Handle;
+    
+    private:
+        Handle handle;
+    
+    public:
+        explicit Behavior(Handle h) : handle(h) {}
+        Behavior(Behavior &&other) noexcept : handle(other.handle) { other.handle = nullptr; }
+        Behavior(const Behavior &) = delete;
+        ~Behavior() { if (handle) handle.destroy(); }
+        
+        /**
+         * Hand the coroutine over, the caller destroys it from now on
+         */
+        Handle release() {
+            Handle h = handle;
+            handle = nullptr;
+            return h;
+        }
+    };
+    
+    
+    
+    /**
+     * co_await wait_steps(n), resume at the start of the nth step from now
+     */
+    struct StepAwaiter {
+        unsigned steps;
+        
+        bool await_ready() const noexcept { return steps == 0; }
+        void await_suspend(Behavior::Handle h);
+        void await_resume() const noexcept {}
+    };
+    
+    inline StepAwaiter wait_steps(unsigned steps) { return StepAwaiter{steps}; }
+    
+    /**
+     * Condition polled once per step, type erased without allocating,
+     * the awaiter itself lives in the coroutine frame
+     */
+    struct ConditionWait {
+        Behavior::Handle handle;
+        virtual bool ready() = 0;
+    };
+    
+    /**
+     * co_await wait_until(condition), resume at the start of the first
+     * step condition() returns true
+     */
+    template<typename F>
+    struct ConditionAwaiter : ConditionWait {
+        F condition;
+        
+        explicit ConditionAwaiter(F f) : condition(f) {}
+        
+        virtual bool ready() { return condition(); }
+        bool await_ready() { return condition(); }
+        void await_suspend(Behavior::Handle h);
+        void await_resume() const noexcept {}
+    };
+    
+    template<typename F>
+    ConditionAwaiter<F> wait_until(F condition) { return ConditionAwaiter<F>(condition); }
+    
+    /**
+     * co_await wait_contact(particle, other), resume at the end of the
+     * first step that generates a contact between the two, or between
+     * particle and anything when other is null. Returns the contact
+     */
+    struct ContactAwaiter {
+        const Particle * particle;
+        const Particle * other;
+        ParticleContact contact;
+        Behavior::Handle handle;
+        
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(Behavior::Handle h);
+        ParticleContact await_resume() const { return contact; }
+    };
+    
+    inline ContactAwaiter wait_contact(const Particle * particle, const Particle * other = nullptr) {
+        return ContactAwaiter{particle, other, ParticleContact(), nullptr};
+    }
+    
+    
+    
+    /**
+     * Owns behaviors and resumes them at step phases
+     * - begin_step: new behaviors, finished step waits, true conditions
+     * - match_contacts: after contact generation, only records matches
+     * - end_step: behaviors whose contact happened this step
+     * Behaviors are free to edit the world when they run, begin_step and
+     * end_step are outside of every stage
+     */
+    class BehaviorScheduler {
+        friend struct StepAwaiter;
+        template<typename F> friend struct ConditionAwaiter;
+        friend struct ContactAwaiter;
+        
+        /*
+         * Resume step, then spawn order for ties
+         */
+        struct StepWait {
+            unsigned long step;
+            unsigned long order;
+            Behavior::Handle handle;
+            
+            bool operator>(const StepWait &o) const {
+                return step != o.step ? step > o.step : order > o.order;
+            }
+        };
+        
+        std::priority_queue<StepWait, std::vector<StepWait>, std::greater<StepWait>> step_waits;
+        std::vector<ConditionWait*> condition_waits;
+        std::unordered_multimap<const Particle*, ContactAwaiter*> contact_waits;
+        
+        std::vector<Behavior::Handle> spawned;
+        std::vector<Behavior::Handle> contact_ready;
+        std::vector<Behavior::Handle> owned;
+        
+        unsigned long step = 0;
+        unsigned long wait_order = 0;
+        
+        /*
+         * Set while begin_step or end_step resumes behaviors. clear() in
+         * the middle of a pass only detaches them, they're destroyed
+         * once the pass is over
+         */
+        bool resuming = false;
+        std::vector<Behavior::Handle> doomed;
+        
+        void wait_steps(Behavior::Handle h, unsigned steps);
+        void wait_condition(ConditionWait * wait);
+        void wait_contact(ContactAwaiter * wait);
+        
+        /**
+         * Destroy behaviors that ran to completion, and those a clear()
+         * during the pass detached
+         */
+        void reap();
+    
+    public:
+        BehaviorScheduler() {}
+        ~BehaviorScheduler() { clear(); }
+        
+        BehaviorScheduler(const BehaviorScheduler &) = delete;
+        BehaviorScheduler & operator=(const BehaviorScheduler &) = delete;
+        
+        /**
+         * Take ownership of a behavior, it starts at the next begin_step
+         */
+        void spawn(Behavior behavior);
+        
+        void begin_step();
+        void match_contacts(const ParticleContact * contacts, unsigned count);
+        void end_step();
+        
+        /**
+         * Destroy every behavior, finished or not
+         * Safe from inside a behavior: the rest of the pass is skipped and
+         * the frames go when it ends. Behaviors spawned afterwards survive
+         */
+        void clear();
+        
+        unsigned active() const { return static_cast<unsigned>(owned.size()); }
+        unsigned long get_step() const { return step; }
+    };
+    
+    
+    
+    template<typename F>
+    void ConditionAwaiter<F>::await_suspend(Behavior::Handle h) {
+        handle = h;
+        h.promise().scheduler->wait_condition(this);
+    }
+}
+
+#endif /* defined(__MSIM495__behavior__) */
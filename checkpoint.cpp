@@ -0,0 +1,280 @@
+//
+//  checkpoint.cpp
+//  MSIM495
+//
+
+#include "checkpoint.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <type_traits>
+
+namespace Physics {
+    static_assert(std::is_trivially_copyable<Particle>::value, "particles are stored as raw state");
+    static_assert(std::is_trivially_copyable<RigidBody>::value, "bodies are stored as raw state");
+    
+    /*
+     * Force link as stored in the image
+     */
+    struct StoredLink {
+        unsigned particle;
+        unsigned force;
+    };
+    
+    template<typename T>
+    static unsigned index_of(const std::vector<T> &list, T item) {
+        return static_cast<unsigned>(std::find(list.begin(), list.end(), item) - list.begin());
+    }
+    
+    
+    
+    // Checkpoint //
+    ////////////////
+    
+    bool Checkpoint::capture(
+        const ParticleWorld * particle_world,
+        const World * body_world,
+        const GeneratorTable &generators
+    ) {
+        const DampingTable &table = DampingTable::global();
+        
+        Header h = {};
+        h.magic = magic;
+        h.version = version;
+        h.particle_size = sizeof(Particle);
+        h.body_size = sizeof(RigidBody);
+        h.damping_count = table.size();
+        
+        const ParticleWorld::Particles * particles = nullptr;
+        if (particle_world) {
+            particles = particle_world->get_particles();
+            h.particle_count = particles ? static_cast<unsigned>(particles->size()) : 0;
+            h.link_count = particle_world->registry.size();
+            h.contact_count = static_cast<unsigned>(particle_world->contact_generators.size());
+        }
+        if (h.link_count && !particles) return false;
+        if (body_world) h.body_count = static_cast<unsigned>(body_world->get_bodies().size());
+        
+        // Sized once, later captures of the same worlds reuse the buffer
+        data.resize(
+            sizeof(Header)
+            + h.damping_count * sizeof(real)
+            + h.particle_count * sizeof(Particle)
+            + h.body_count * sizeof(RigidBody)
+            + h.link_count * sizeof(StoredLink)
+            + h.contact_count * sizeof(unsigned)
+        );
+        
+        unsigned char * out = data.data();
+        memcpy(out, &h, sizeof(Header));
+        out += sizeof(Header);
+        
+        for (unsigned i = 0; i < h.damping_count; ++i, out += sizeof(real)) {
+            real d = table.get_damping(i);
+            memcpy(out, &d, sizeof(real));
+        }
+        
+        for (unsigned i = 0; i < h.particle_count; ++i, out += sizeof(Particle)) {
+            memcpy(out, (*particles)[i], sizeof(Particle));
+        }
+        
+        if (h.body_count) {
+            memcpy(out, body_world->get_bodies().data(), h.body_count * sizeof(RigidBody));
+            out += h.body_count * sizeof(RigidBody);
+        }
+        
+        for (unsigned i = 0; i < h.link_count; ++i, out += sizeof(StoredLink)) {
+            const ParticleForceRegistrar &registry = particle_world->registry;
+            StoredLink link;
+            link.particle = index_of<Particle*>(*particles, registry.get_particle(i));
+            link.force = index_of(generators.forces, registry.get_generator(i));
+            if (link.particle == h.particle_count || link.force == generators.forces.size()) {
+                data.clear();
+                return false;
+            }
+            memcpy(out, &link, sizeof(StoredLink));
+        }
+        
+        for (unsigned i = 0; i < h.contact_count; ++i, out += sizeof(unsigned)) {
+            unsigned id = index_of(generators.contacts, particle_world->contact_generators[i]);
+            if (id == generators.contacts.size()) {
+                data.clear();
+                return false;
+            }
+            memcpy(out, &id, sizeof(unsigned));
+        }
+        
+        return true;
+    }
+    
+    bool Checkpoint::valid() const {
+        if (data.size() < sizeof(Header)) return false;
+        
+        const Header &h = header();
+        if (h.magic != magic || h.version != version) return false;
+        if (h.particle_size != sizeof(Particle) || h.body_size != sizeof(RigidBody)) return false;
+        
+        unsigned long expected = sizeof(Header)
+            + (unsigned long)h.damping_count * sizeof(real)
+            + (unsigned long)h.particle_count * sizeof(Particle)
+            + (unsigned long)h.body_count * sizeof(RigidBody)
+            + (unsigned long)h.link_count * sizeof(StoredLink)
+            + (unsigned long)h.contact_count * sizeof(unsigned);
+        return data.size() == expected;
+    }
+    
+    bool Checkpoint::restore(
+        ParticleWorld * particle_world,
+        World * body_world,
+        const GeneratorTable &generators
+    ) {
+        if (!valid()) return false;
+        
+        const Header &h = header();
+        ParticleWorld::Particles * particles = particle_world ? particle_world->get_particles() : nullptr;
+        unsigned live_particles = particles ? static_cast<unsigned>(particles->size()) : 0;
+        unsigned live_bodies = body_world ? static_cast<unsigned>(body_world->get_bodies().size()) : 0;
+        if (h.particle_count != live_particles || h.body_count != live_bodies) return false;
+        
+        // Check IDs before touching anything so a bad image leaves the worlds alone
+        const unsigned char * links = data.data() + data.size()
+            - h.contact_count * sizeof(unsigned) - h.link_count * sizeof(StoredLink);
+        const unsigned char * contacts = links + h.link_count * sizeof(StoredLink);
+        for (unsigned i = 0; i < h.link_count; ++i) {
+            StoredLink link;
+            memcpy(&link, links + i * sizeof(StoredLink), sizeof(StoredLink));
+            if (link.particle >= h.particle_count || link.force >= generators.forces.size()) return false;
+        }
+        for (unsigned i = 0; i < h.contact_count; ++i) {
+            unsigned id;
+            memcpy(&id, contacts + i * sizeof(unsigned), sizeof(unsigned));
+            if (id >= generators.contacts.size()) return false;
+        }
+        
+        // Damping class IDs only mean something against the table they came from
+        DampingTable &table = DampingTable::global();
+        const unsigned char * in = data.data() + sizeof(Header);
+        bool remap = h.damping_count > table.size();
+        damping_map.resize(h.damping_count);
+        for (unsigned i = 0; i < h.damping_count; ++i, in += sizeof(real)) {
+            real d;
+            memcpy(&d, in, sizeof(real));
+            if (!remap && table.get_damping(i) != d) remap = true;
+            damping_map[i] = i;
+        }
+        if (remap) {
+            in = data.data() + sizeof(Header);
+            for (unsigned i = 0; i < h.damping_count; ++i, in += sizeof(real)) {
+                real d;
+                memcpy(&d, in, sizeof(real));
+                damping_map[i] = table.intern(d);
+            }
+        }
+        
+        for (unsigned i = 0; i < h.particle_count; ++i, in += sizeof(Particle)) {
+            Particle * p = (*particles)[i];
+            memcpy(p, in, sizeof(Particle));
+            if (remap) p->set_damping_class(damping_map[p->get_damping_class()]);
+        }
+        
+        if (h.body_count) {
+            World::RigidBodies &bodies = body_world->get_bodies();
+            memcpy(bodies.data(), in, h.body_count * sizeof(RigidBody));
+            if (remap) {
+                for (RigidBody &b : bodies) {
+                    b.set_damping_classes(
+                        damping_map[b.get_linear_damping_class()],
+                        damping_map[b.get_angular_damping_class()]
+                    );
+                }
+            }
+        }
+        
+        if (!particle_world) return true;
+        
+        // Keep the registry as is when nothing changed, it would rebuild its slots
+        ParticleForceRegistrar &registry = particle_world->registry;
+        bool same_links = registry.size() == h.link_count;
+        for (unsigned i = 0; same_links && i < h.link_count; ++i) {
+            StoredLink link;
+            memcpy(&link, links + i * sizeof(StoredLink), sizeof(StoredLink));
+            same_links = registry.get_particle(i) == (*particles)[link.particle]
+                && registry.get_generator(i) == generators.forces[link.force];
+        }
+        if (!same_links) {
+            registry.clear();
+            for (unsigned i = 0; i < h.link_count; ++i) {
+                StoredLink link;
+                memcpy(&link, links + i * sizeof(StoredLink), sizeof(StoredLink));
+                registry.add((*particles)[link.particle], generators.forces[link.force]);
+            }
+        }
+        
+        ParticleWorld::ContactGenerators &active = particle_world->contact_generators;
+        active.resize(h.contact_count);
+        for (unsigned i = 0; i < h.contact_count; ++i) {
+            unsigned id;
+            memcpy(&id, contacts + i * sizeof(unsigned), sizeof(unsigned));
+            active[i] = generators.contacts[id];
+        }
+        
+        return true;
+    }
+    
+    bool Checkpoint::save(const char * path) const {
+        if (data.empty()) return false;
+        
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        
+        // Regular files take the whole image in one go, loop only for
+        // the rare short write
+        const unsigned char * out = data.data();
+        unsigned long left = data.size();
+        while (left) {
+            ssize_t written = write(fd, out, left);
+            if (written <= 0) {
+                close(fd);
+                return false;
+            }
+            out += written;
+            left -= written;
+        }
+        
+        return close(fd) == 0;
+    }
+    
+    bool Checkpoint::load(const char * path) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) return false;
+        
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            return false;
+        }
+        
+        data.resize(info.st_size);
+        unsigned char * in = data.data();
+        unsigned long left = data.size();
+        while (left) {
+            ssize_t got = read(fd, in, left);
+            if (got <= 0) {
+                close(fd);
+                data.clear();
+                return false;
+            }
+            in += got;
+            left -= got;
+        }
+        close(fd);
+        
+        if (!valid()) {
+            data.clear();
+            return false;
+        }
+        return true;
+    }
+}
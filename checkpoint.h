@@ -0,0 +1,105 @@
+//
+//  checkpoint.h
+//  MSIM495
+//
+
+#ifndef __MSIM495__checkpoint__
+#define __MSIM495__checkpoint__
+
+#include <vector>
+#include "engine.h"
+
+namespace Physics {
+    /**
+     * Stable IDs for generators, the index of each pointer
+     * Checkpoints store registrations by these IDs so they can be
+     * restored into a world whose generators live somewhere else
+     */
+    struct GeneratorTable {
+        std::vector<ParticleForceGenerator*> forces;
+        std::vector<ParticleContactGenerator*> contacts;
+    };
+    
+    /**
+     * Versioned binary image of a ParticleWorld and / or a World
+     *
+     *     header | damping values | particles | bodies | force links | contact generators
+     *
+     * - particles and bodies are their raw state, in world order
+     * - force links are (particle index, force ID) pairs in registration order
+     * - contact generators are contact IDs in world order
+     * - damping classes travel as values and are re-interned on restore
+     *   when the running table differs
+     *
+     * The image is one contiguous buffer that gets reused between
+     * captures, save writes it with a single write and restore copies
+     * it back into the world's existing objects without allocating any
+     * Particles and bodies have to be the same ones, in the same order,
+     * as when the checkpoint was captured. Generator internals (rod
+     * lists, spring lengths, ...) aren't part of the image
+     */
+    class Checkpoint {
+    public:
+        static constexpr unsigned magic = 0x4b434d53; // "SMCK"
+        static constexpr unsigned version = 1;
+        
+        struct Header {
+            unsigned magic;
+            unsigned version;
+            
+            // Guards against reading an image from a differently laid out build
+            unsigned particle_size;
+            unsigned body_size;
+            
+            unsigned damping_count;
+            unsigned particle_count;
+            unsigned body_count;
+            unsigned link_count;
+            unsigned contact_count;
+        };
+    
+    protected:
+        std::vector<unsigned char> data;
+        
+        /*
+         * Class remapping when the running damping table differs
+         */
+        std::vector<DampingTable::ClassID> damping_map;
+        
+        const Header & header() const { return *reinterpret_cast<const Header*>(data.data()); }
+        bool valid() const;
+    
+    public:
+        /**
+         * Take the state of either world, pass nullptr to leave one out
+         * Returns false when a registered generator isn't in generators
+         */
+        bool capture(
+            const ParticleWorld * particle_world,
+            const World * body_world,
+            const GeneratorTable &generators
+        );
+        
+        /**
+         * Put the captured state back
+         * Returns false when the image doesn't match the worlds
+         */
+        bool restore(
+            ParticleWorld * particle_world,
+            World * body_world,
+            const GeneratorTable &generators
+        );
+        
+        /**
+         * Write / read the image, one syscall each way for any size
+         * the kernel doesn't split
+         */
+        bool save(const char * path) const;
+        bool load(const char * path);
+        
+        bool empty() const { return data.empty(); }
+        unsigned long size() const { return data.size(); }
+    };
+}
+
+#endif /* defined(__MSIM495__checkpoint__) */
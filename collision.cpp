@@ -8,127 +8,131 @@
 
 #include "collision.h"
 #include <limits.h>
+#include <cstdint>
 
 namespace Physics {
 
-    // ParticleContact //
-    /////////////////////
-    
-    void ParticleContact::resolve(real duration) {
-        resolve_velocity(duration);
-        resolve_interpenetration(duration);
-    }
+    // PackedContacts //
+    ////////////////////
     
-    real ParticleContact::calculate_separating_velocity() {
-        // Get the difference of the two colliding velocities
-        Vector3 relative_velocity = left->get_velocity();
-        if (right) relative_velocity -= right->get_velocity();
+    unsigned PackedContacts::stage(Particle * particle) {
+        const std::size_t mask = table_keys.size() - 1;
+        std::size_t slot = (reinterpret_cast<std::uintptr_t>(particle) >> 4) * 0x9E3779B97F4A7C15ull & mask;
+        while (table_keys[slot]) {
+            if (table_keys[slot] == particle) return table_values[slot];
+            slot = (slot + 1) & mask;
+        }
         
-        // Point velocity towards contact_normal
-        return relative_velocity * contact_normal;
+        const unsigned index = (unsigned)particles.size();
+        table_keys[slot] = particle;
+        table_values[slot] = index;
+        
+        particles.push_back(particle);
+        velocities.push_back(particle->get_velocity());
+        accelerations.push_back(particle->get_acceleration());
+        positions.push_back(particle->get_position());
+        inverse_masses.push_back(particle->get_inverse_mass());
+        return index;
     }
     
-    void ParticleContact::resolve_velocity(real duration) {
-        real separating_velocity = calculate_separating_velocity();
-        if (separating_velocity > 0) {
-            // Non-negative value means before or after separation
-            return;
-        }
-        
-        real new_separation_velo = -separating_velocity * restitution;
+    void PackedContacts::pack(const ParticleContact * contacts, unsigned count) {
+        lefts.resize(count);
+        rights.resize(count);
+        normals.resize(count);
+        penetrations.resize(count);
+        restitutions.resize(count);
+        inverse_mass_sums.resize(count);
+        impulses.resize(count);
         
-        // For inter-penetration checking
-        // Get velocity due to acceleration
-        Vector3 acceleration_from_velo = left->get_acceleration();
-        if (right) acceleration_from_velo -= right->get_acceleration();
+        particles.clear();
+        velocities.clear();
+        accelerations.clear();
+        positions.clear();
+        inverse_masses.clear();
         
-        real acceleration_causality =
-            acceleration_from_velo
-            * contact_normal
-            * duration;
+        // At most two particles a contact, keep the table under half full
+        std::size_t capacity = 16;
+        while (capacity < 4 * (std::size_t)count) capacity <<= 1;
+        table_keys.assign(capacity, nullptr);
+        table_values.resize(capacity);
         
-        // remove excess velocity from acceleration build up
-        if (acceleration_causality < 0) {
-            new_separation_velo +=
-                restitution
-                * acceleration_causality;
+        for (unsigned c = 0; c < count; ++c) {
+            const ParticleContact &contact = contacts[c];
+            const unsigned left = stage(contact.left);
+            const unsigned right = contact.right ? stage(contact.right) : none;
             
-            // Make sure we don't end up with a negative
-            // initial separation velocity
-            if (new_separation_velo < 0) new_separation_velo = 0;
+            lefts[c] = left;
+            rights[c] = right;
+            normals[c] = contact.contact_normal;
+            penetrations[c] = contact.penetration;
+            restitutions[c] = contact.restitution;
+            impulses[c] = contact.impulse;
+            
+            real total_inverse_mass = inverse_masses[left];
+            if (right != none) total_inverse_mass += inverse_masses[right];
+            inverse_mass_sums[c] = total_inverse_mass;
+        }
+    }
+    
+    void PackedContacts::unpack(ParticleContact * contacts, unsigned count) const {
+        for (unsigned p = 0; p < particles.size(); ++p) {
+            particles[p]->set_velocity(velocities[p]);
+            particles[p]->set_position(positions[p]);
         }
         
-        // Calculate new separation velocity
-        real delta_velocity =
-            new_separation_velo
-            - separating_velocity;
-        
-        // process total inverse mass
-        real total_inverse_mass = left->get_inverse_mass();
-        if (right) total_inverse_mass += right->get_inverse_mass();
-        if (total_inverse_mass == 0.f) return;
-        
-        // derive impulse from velocity
-        real impulse = delta_velocity / total_inverse_mass;
-        Vector3 impulse_per_inverse_mass = contact_normal * impulse;
-        
-        // Apply the impulse in direction of contact and
-        // proportional to inverse mass
-        left->set_velocity(
-            left->get_velocity()
-            + impulse_per_inverse_mass
-            * left->get_inverse_mass()
-        );
-        
-        if (right) {
-            right->set_velocity(
-                right->get_velocity()
-                + impulse_per_inverse_mass
-                * -right->get_inverse_mass()
-            );
+        for (unsigned c = 0; c < count; ++c) {
+            contacts[c].penetration = penetrations[c];
+            contacts[c].impulse = impulses[c];
         }
     }
     
-    void ParticleContact::resolve_interpenetration(real duration){
-        // Penetration 0 or negative if no penetration
-        if (penetration <= 0) return;
-        
-        real total_inverse_mass = left->get_inverse_mass();
-        if (right) total_inverse_mass += right->get_inverse_mass();
-        
-        // Ignore if infinite mass
-        if (total_inverse_mass <= 0) return;
+    void PackedContacts::resolve(unsigned c, real duration, Vector3 &move_left, Vector3 &move_right) {
+        const unsigned left = lefts[c];
+        const unsigned right = rights[c];
+        const Vector3 &normal = normals[c];
+        const real total_inverse_mass = inverse_mass_sums[c];
         
-        // Find delta position relative to mass
-        Vector3 move_per_inverse_mass =
-            contact_normal
-            * (penetration / total_inverse_mass);
-        
-        // Calculate delta movements
-        left_movement =
-            move_per_inverse_mass
-            * left->get_inverse_mass();
-        
-        if (right) {
-            right_movement =
-                move_per_inverse_mass
-                * -right->get_inverse_mass();
-        }
-        else {
-            right_movement.clear();
+        // Velocity, turned into an impulse along the normal
+        real separating_velo = separating_velocity(c);
+        if (separating_velo <= 0) {
+            real new_separation_velo = -separating_velo * restitutions[c];
+            
+            Vector3 acceleration_from_velo = accelerations[left];
+            if (right != none) acceleration_from_velo -= accelerations[right];
+            
+            // Remove the closing velocity built up by this step's acceleration
+            real acceleration_causality = acceleration_from_velo * normal * duration;
+            if (acceleration_causality < 0) {
+                new_separation_velo += restitutions[c] * acceleration_causality;
+                if (new_separation_velo < 0) new_separation_velo = 0;
+            }
+            
+            real delta_velocity = new_separation_velo - separating_velo;
+            
+            if (total_inverse_mass != 0.f) {
+                real impulse = delta_velocity / total_inverse_mass;
+                Vector3 impulse_per_inverse_mass = normal * impulse;
+                impulses[c] += impulse;
+                
+                velocities[left] = velocities[left] + impulse_per_inverse_mass * inverse_masses[left];
+                if (right != none) {
+                    velocities[right] = velocities[right] + impulse_per_inverse_mass * -inverse_masses[right];
+                }
+            }
         }
         
-        // Apply delta movements
-        left->set_position(
-            left->get_position() + left_movement
-        );
+        // Interpenetration, ends move along the normal in proportion to inverse mass
+        move_left.clear();
+        move_right.clear();
+        if (penetrations[c] <= 0 || total_inverse_mass <= 0) return;
         
-        if (right) {
-            right->set_position(
-                right->get_position() + right_movement
-            );
+        Vector3 move_per_inverse_mass = normal * (penetrations[c] / total_inverse_mass);
+        move_left = move_per_inverse_mass * inverse_masses[left];
+        positions[left] = positions[left] + move_left;
+        if (right != none) {
+            move_right = move_per_inverse_mass * -inverse_masses[right];
+            positions[right] = positions[right] + move_right;
         }
-        
     }
     
     
@@ -142,6 +146,13 @@ namespace Physics {
         real duration
     ) {
         used_iterations = 0;
+        if (!num_contacts) return;
+        
+        packed.pack(contact_array, num_contacts);
+        const unsigned * lefts = packed.lefts.data();
+        const unsigned * rights = packed.rights.data();
+        const Vector3 * normals = packed.normals.data();
+        real * penetrations = packed.penetrations.data();
         
         // Inefficient!
         while (used_iterations < iterations) {
@@ -149,11 +160,11 @@ namespace Physics {
             unsigned max_index = num_contacts;
             for (unsigned i = 0; i < num_contacts; ++i) {
                 // Find contact with largest separating velocity
-                real separating_velo = contact_array[i].calculate_separating_velocity();
+                real separating_velo = packed.separating_velocity(i);
                 
                 bool separation_condition = (
                     separating_velo < 0
-                    || contact_array[i].penetration > 0
+                    || penetrations[i] > 0
                 );
                 
                 if (
@@ -169,24 +180,27 @@ namespace Physics {
             if (max_index == num_contacts) break;
             
             // resolve contact
-            contact_array[max_index].resolve(duration);
+            Vector3 move_left, move_right;
+            packed.resolve(max_index, duration, move_left, move_right);
+            contact_array[max_index].left_movement = move_left;
+            contact_array[max_index].right_movement = move_right;
             
             // update interpenetration for all particles
-            Vector3 move_left = contact_array[max_index].left_movement;
-            Vector3 move_right = contact_array[max_index].right_movement;
+            const unsigned moved_left = lefts[max_index];
+            const unsigned moved_right = rights[max_index];
             for (unsigned i = 0; i < num_contacts; ++i) {
-                if (contact_array[i].left == contact_array[max_index].left) {
-                    contact_array[i].penetration -= move_left * contact_array[i].contact_normal;
+                if (lefts[i] == moved_left) {
+                    penetrations[i] -= move_left * normals[i];
                 }
-                else if (contact_array[i].left == contact_array[max_index].right) {
-                    contact_array[i].penetration -= move_right * contact_array[i].contact_normal;
+                else if (lefts[i] == moved_right) {
+                    penetrations[i] -= move_right * normals[i];
                 }
-                if (contact_array[i].right) {
-                    if (contact_array[i].right == contact_array[max_index].left) {
-                        contact_array[i].penetration += move_left * contact_array[i].contact_normal;
+                if (rights[i] != PackedContacts::none) {
+                    if (rights[i] == moved_left) {
+                        penetrations[i] += move_left * normals[i];
                     }
-                    else if (contact_array[i].right == contact_array[max_index].right) {
-                        contact_array[i].penetration += move_right * contact_array[i].contact_normal;
+                    else if (rights[i] == moved_right) {
+                        penetrations[i] += move_right * normals[i];
                     }
                 }
             }
@@ -194,6 +208,8 @@ namespace Physics {
             // track used iterations
             ++used_iterations;
         };
+        
+        packed.unpack(contact_array, num_contacts);
     }
     
     void ParticleContactResolver::set_iterations(unsigned max_iterations) {
@@ -209,6 +225,10 @@ namespace Physics {
         return left->get_position().distance(right->get_position());
     }
     
+    real ParticleLink::current_length_squared() {
+        return left->get_position().distance_squared(right->get_position());
+    }
+    
     
     
     // ParticleCable //
@@ -218,11 +238,8 @@ namespace Physics {
         ParticleContact * contact,
         unsigned limit
     ) {
-        real length = current_length();
-        
-        // Check if cable overextended
-        // ?
-        if (length < max_length) {
+        // Check if cable overextended, slack cables never need the sqrt
+        if (current_length_squared() < max_length * max_length) {
             return 0;
         }
         
@@ -230,13 +247,16 @@ namespace Physics {
         contact->left = left;
         contact->right = right;
         
-        // Calculate normal vector
+        // Calculate normal vector, reusing the length for normalization
         Vector3 normal = right->get_position() - left->get_position();
-        normal.normalize();
+        real length = normal.magnitude();
+        
+        if (length > 0) normal *= 1.f / length;
         
         contact->contact_normal = normal;
         contact->penetration = length - max_length;
         contact->restitution = restitution;
+        contact->feature = 0;
         
         return 1;
     }
@@ -250,7 +270,8 @@ namespace Physics {
         ParticleContact * contact,
         unsigned limit
     ) {
-        real length = current_length();
+        Vector3 normal = right->get_position() - left->get_position();
+        real length = normal.magnitude();
         
         // Check if overextended
         if (length == max_length) {
@@ -260,8 +281,8 @@ namespace Physics {
         contact->left = left;
         contact->right = right;
         
-        Vector3 normal = right->get_position() - left->get_position();
-        normal.normalize();
+        // Reuse the length rather than normalizing with a second sqrt
+        if (length > 0) normal *= 1.f / length;
         
         // Direction of normal depends on compression or expansion
         if (length > max_length) {
@@ -275,7 +296,179 @@ namespace Physics {
         
         // zero resitution
         contact->restitution = 0;
+        contact->feature = 0;
         
         return 1;
     }
+    
+    
+    
+    // ParticleLinkSet //
+    /////////////////////
+    
+    void ParticleLinkSet::clear() {
+        lefts.clear();
+        rights.clear();
+        lengths.clear();
+        ids.clear();
+        next_id = 0;
+    }
+    
+    void ParticleLinkSet::particle_removed(const Particles * list, unsigned index) {
+        if (list != particles) return;
+        
+        const unsigned moved = static_cast<unsigned>(list->size());
+        unsigned kept = 0;
+        const unsigned count = size();
+        for (unsigned i = 0; i < count; ++i) {
+            if (lefts[i] == index || rights[i] == index) continue;
+            
+            lefts[kept] = lefts[i] == moved ? index : lefts[i];
+            rights[kept] = rights[i] == moved ? index : rights[i];
+            lengths[kept] = lengths[i];
+            ids[kept] = ids[i];
+            ++kept;
+        }
+        
+        lefts.resize(kept);
+        rights.resize(kept);
+        lengths.resize(kept);
+        ids.resize(kept);
+    }
+    
+    void ParticleLinkSet::gather() {
+        const unsigned count = size();
+        left_positions.resize(count);
+        right_positions.resize(count);
+        current_lengths.resize(count);
+        
+        const Particles &ps = *particles;
+        for (unsigned i = 0; i < count; ++i) {
+            left_positions[i] = ps[lefts[i]]->get_position();
+            right_positions[i] = ps[rights[i]]->get_position();
+        }
+        
+        distances(left_positions.data(), right_positions.data(), current_lengths.data(), count);
+    }
+    
+    void ParticleLinkSet::fill_contact(
+        ParticleContact * contact,
+        unsigned link,
+        real penetration,
+        real sign,
+        real restitution
+    ) const {
+        const real length = current_lengths[link];
+        Vector3 normal = right_positions[link] - left_positions[link];
+        if (length > 0) normal *= sign / length;
+        
+        contact->left = (*particles)[lefts[link]];
+        contact->right = (*particles)[rights[link]];
+        contact->contact_normal = normal;
+        contact->penetration = penetration;
+        contact->restitution = restitution;
+        contact->feature = ids[link];
+    }
+    
+    
+    
+    // RodSet //
+    ////////////
+    
+    unsigned RodSet::add(unsigned left, unsigned right, real length) {
+        lefts.push_back(left);
+        rights.push_back(right);
+        lengths.push_back(length);
+        ids.push_back(next_id++);
+        return size() - 1;
+    }
+    
+    unsigned RodSet::add_contact(
+        ParticleContact * contact,
+        unsigned limit
+    ) {
+        gather();
+        
+        unsigned used = 0;
+        const unsigned count = size();
+        truncated = false;
+        for (unsigned i = 0; i < count; ++i) {
+            const real length = current_lengths[i];
+            const real rest = lengths[i];
+            if (length == rest) continue;
+            
+            if (used == limit) {
+                truncated = true;
+                break;
+            }
+            
+            // Direction of normal depends on compression or expansion, zero resitution
+            if (length > rest) fill_contact(contact + used, i, length - rest, 1, 0);
+            else fill_contact(contact + used, i, rest - length, -1, 0);
+            ++used;
+        }
+        
+        return used;
+    }
+    
+    
+    
+    // CableSet //
+    //////////////
+    
+    unsigned CableSet::add(unsigned left, unsigned right, real max_length, real restitution) {
+        lefts.push_back(left);
+        rights.push_back(right);
+        lengths.push_back(max_length);
+        restitutions.push_back(restitution);
+        ids.push_back(next_id++);
+        return size() - 1;
+    }
+    
+    void CableSet::clear() {
+        ParticleLinkSet::clear();
+        restitutions.clear();
+    }
+    
+    void CableSet::particle_removed(const Particles * list, unsigned index) {
+        if (list != particles) return;
+        
+        // Compact restitutions the same way before the base drops the ends
+        unsigned kept = 0;
+        const unsigned count = size();
+        for (unsigned i = 0; i < count; ++i) {
+            if (lefts[i] == index || rights[i] == index) continue;
+            restitutions[kept++] = restitutions[i];
+        }
+        restitutions.resize(kept);
+        
+        ParticleLinkSet::particle_removed(list, index);
+    }
+    
+    unsigned CableSet::add_contact(
+        ParticleContact * contact,
+        unsigned limit
+    ) {
+        gather();
+        
+        unsigned used = 0;
+        const unsigned count = size();
+        truncated = false;
+        for (unsigned i = 0; i < count; ++i) {
+            const real length = current_lengths[i];
+            
+            // Slack cables don't generate contacts
+            if (length < lengths[i]) continue;
+            
+            if (used == limit) {
+                truncated = true;
+                break;
+            }
+            
+            fill_contact(contact + used, i, length - lengths[i], 1, restitutions[i]);
+            ++used;
+        }
+        
+        return used;
+    }
 };
\ No newline at end of file
@@ -10,20 +10,15 @@
 #define __MSIM495__collision__
 
 #include <stdio.h>
+#include <vector>
 #include "core.h"
+#include "memstats.h"
 
 namespace Physics {
-    /*
-     * Forward declaration
-     */
-    class ParticleContactResolver;
-    
     /**
-     * Data and resolution for contact event
+     * Data for contact event, resolved in batches by ParticleContactResolver
      */
     class ParticleContact {
-        friend class ParticleContactResolver;
-    
     public:
         /*
          * Two particles involved in a contact
@@ -49,29 +44,81 @@ namespace Physics {
          */
         real penetration = 0;
         
-    protected:
         /*
-         * Resolves the velocity calculation
+         * Which part of its generator made the contact, e.g. a link index,
+         * so one pair touching in two ways is told apart across steps
          */
-        void resolve(real duration);
+        unsigned feature = 0;
         
         /*
-         * Calculates resulting velocity at contact
+         * Impulse applied along contact_normal this step, summed by the
+         * resolver. Only meaningful once a ContactCache has prepared the
+         * contacts, it zeroes or warm starts it
          */
-        real calculate_separating_velocity();
+        real impulse = 0;
+    };
+    
+    /**
+     * Solver side copy of a batch of contacts, as structure of arrays
+     * Contacts refer to their particles by index. Every particle they
+     * touch is staged once, in order of first use, with the velocity,
+     * position and masses the resolver works on. The iteration loop then
+     * runs over a few flat arrays instead of chasing particle pointers,
+     * and results go back to the particles once at the end
+     */
+    struct PackedContacts {
+        template<typename T>
+        using Array = std::vector<T, TaggedAllocator<T, MEMORY_CONTACTS>>;
+        
+        static constexpr unsigned none = ~0u;
+        
+        /*
+         * Per contact, right is none for a contact with the scenery
+         */
+        Array<unsigned> lefts;
+        Array<unsigned> rights;
+        Array<Vector3> normals;
+        Array<real> penetrations;
+        Array<real> restitutions;
+        Array<real> inverse_mass_sums;
+        Array<real> impulses;
+        
+        /*
+         * Per staged particle
+         */
+        Array<Particle*> particles;
+        Array<Vector3> velocities;
+        Array<Vector3> accelerations;
+        Array<Vector3> positions;
+        Array<real> inverse_masses;
+        
+        /*
+         * Open addressed particle -> index table for staging
+         */
+        Array<Particle*> table_keys;
+        Array<unsigned> table_values;
+        
+        unsigned stage(Particle * particle);
+        
+        void pack(const ParticleContact * contacts, unsigned count);
         
-    private:
         /**
-         * Turns velocity to impulse resolution
+         * Write velocities and positions back to the particles, and
+         * penetrations and impulses back to contacts
          */
-        void resolve_velocity(real duration);
+        void unpack(ParticleContact * contacts, unsigned count) const;
+        
+        real separating_velocity(unsigned contact) const {
+            Vector3 relative_velocity = velocities[lefts[contact]];
+            if (rights[contact] != none) relative_velocity -= velocities[rights[contact]];
+            return relative_velocity * normals[contact];
+        }
         
         /**
-         * Handles inter-penetration between contact points
-         * Idea is to get a delta position relative to mass
-         * in the direction of the contact_normal
+         * Resolve one contact's velocity, then its interpenetration, on
+         * the staged state, moves are the position changes of the two ends
          */
-         void resolve_interpenetration(real duration);
+        void resolve(unsigned contact, real duration, Vector3 &move_left, Vector3 &move_right);
     };
     
     /**
@@ -84,6 +131,11 @@ namespace Physics {
          */
         unsigned iterations;
         unsigned used_iterations;
+        
+        /*
+         * Staging reused from step to step
+         */
+        PackedContacts packed;
 
     public:
         /*
@@ -96,6 +148,7 @@ namespace Physics {
          * Getters / Setters
          */
         void set_iterations(unsigned max_iterations);
+        unsigned get_used_iterations() const { return used_iterations; }
         
         /**
          * Resolve contact for both inter-penetration and 
@@ -112,15 +165,39 @@ namespace Physics {
      * Base class for contact based generators
      */
     class ParticleContactGenerator {
+    protected:
+        /*
+         * Set by add_contact when it had more contacts than limit let it
+         * write, generators that can stop at limit keep this current
+         */
+        bool truncated = false;
+    
     public:
     
         /**
-         *
+         * Write up to limit contacts, returns how many
+         * Contact buffers are reused, every field of a written contact
+         * but impulse has to be set, feature included
+         * The world may call it again in the same step with a bigger
+         * buffer after a truncated call, so it has to rewrite the same
+         * contacts each time
          */
         virtual unsigned add_contact(
             ParticleContact * particle,
             unsigned limit
         ) = 0;
+        
+        /**
+         * Whether the last add_contact stopped at limit with contacts left
+         */
+        bool was_truncated() const { return truncated; }
+        
+        /**
+         * Called by a world after it took list[index] out by moving its
+         * last particle (formerly at list->size()) into the hole
+         * Generators that keep indices into list drop or remap them here
+         */
+        virtual void particle_removed(const std::vector<Particle*> *, unsigned) {}
     };
     
     
@@ -140,6 +217,11 @@ namespace Physics {
          * Returns length of the linkage
          */
         real current_length();
+        
+        /**
+         * Returns squared length of the linkage
+         */
+        real current_length_squared();
     
     public:
         /**
@@ -193,6 +275,116 @@ namespace Physics {
         );
         
     };
+    
+    
+    /**
+     * Base class for link sets
+     * Links are stored as indices into a shared particle list with their
+     * lengths in flat arrays, and the whole set registers as one generator
+     */
+    class ParticleLinkSet : public ParticleContactGenerator {
+    public:
+        typedef std::vector<Particle*> Particles;
+    
+    protected:
+        Particles * particles;
+        
+        /*
+         * Ends and length of every link
+         */
+        std::vector<unsigned> lefts;
+        std::vector<unsigned> rights;
+        std::vector<real> lengths;
+        
+        /*
+         * ID of every link, kept when removals compact the arrays so the
+         * contact cache still recognises the links that stayed
+         */
+        std::vector<unsigned> ids;
+        unsigned next_id = 0;
+        
+        /*
+         * Per step scratch, endpoint positions gathered once
+         * and current lengths from one batched distance pass
+         */
+        std::vector<Vector3> left_positions;
+        std::vector<Vector3> right_positions;
+        std::vector<real> current_lengths;
+        
+        /**
+         * Fill the scratch arrays for every link
+         */
+        void gather();
+        
+        /**
+         * Write contact for link, normal pointing left to right
+         * Feature is the link's ID
+         */
+        void fill_contact(
+            ParticleContact * contact,
+            unsigned link,
+            real penetration,
+            real sign,
+            real restitution
+        ) const;
+    
+    public:
+        ParticleLinkSet(Particles * particles) : particles(particles) {}
+        
+        unsigned size() const { return static_cast<unsigned>(lefts.size()); }
+        void clear();
+        
+        /**
+         * Links touching the removed particle go, links to the particle
+         * moved into its place follow it
+         */
+        virtual void particle_removed(const Particles * list, unsigned index);
+    };
+    
+    
+    /**
+     * Any number of rods as a single contact generator
+     */
+    class RodSet : public ParticleLinkSet {
+    public:
+        RodSet(Particles * particles) : ParticleLinkSet(particles) {}
+        
+        /**
+         * Rod between particles[left] and particles[right],
+         * returns the rod's index in the set
+         */
+        unsigned add(unsigned left, unsigned right, real length);
+        
+        virtual unsigned add_contact(
+            ParticleContact * contact,
+            unsigned limit
+        );
+    };
+    
+    
+    /**
+     * Any number of cables as a single contact generator
+     */
+    class CableSet : public ParticleLinkSet {
+        std::vector<real> restitutions;
+    
+    public:
+        CableSet(Particles * particles) : ParticleLinkSet(particles) {}
+        
+        /**
+         * Cable between particles[left] and particles[right],
+         * returns the cable's index in the set
+         */
+        unsigned add(unsigned left, unsigned right, real max_length, real restitution);
+        
+        void clear();
+        virtual void particle_removed(const Particles * list, unsigned index);
+        
+        virtual unsigned add_contact(
+            ParticleContact * contact,
+            unsigned limit
+        );
+    };
 };
 
 #endif /* defined(__MSIM495__collision__) */
@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include "core.h"
+#include "arena.h"
 
 /**
  * Binary Space Partitioning tree implementation
@@ -89,11 +90,40 @@ namespace Physics {
     typedef std::vector<Object *> BSPObjects;
     typedef std::vector<Plane> BSPPlanes;
     
+    /**
+     * Stable partition that takes its scratch from an arena,
+     * returns the first item that failed test
+     */
+    template<typename T, typename F>
+    T * arena_partition(FrameArena &arena, T * begin, T * end, F test) {
+        T * scratch = static_cast<T*>(arena.allocate(sizeof(T) * (end - begin), alignof(T)));
+        T * front = begin;
+        unsigned spilled = 0;
+        for (T * it = begin; it != end; ++it) {
+            if (test(*it)) *front++ = *it;
+            else new (scratch + spilled++) T(*it);
+        }
+        for (unsigned i = 0; i < spilled; ++i) front[i] = scratch[i];
+        return front;
+    }
+    
     enum BSPChildType {
         NODE,
         OBJECTS
     };
     
+    /**
+     * Objects of a leaf, a run of the tree's working copy of the object list
+     */
+    struct BSPLeaf {
+        Object ** objects;
+        unsigned count;
+        
+        Object ** begin() const { return objects; }
+        Object ** end() const { return objects + count; }
+        unsigned size() const { return count; }
+    };
+    
     /**
      * PARTICLE CHILD
      */
@@ -106,26 +136,16 @@ namespace Physics {
         union {
             BSPNode * node;
             // set of objects in front of plane
-            BSPObjects * objects;
+            BSPLeaf * objects;
         };
         
     public:
         BSPChild() : type(NODE), node(nullptr) {}
         BSPChild(BSPNode * n): type(NODE), node(n) {}
-        BSPChild(BSPObjects * o, bool front): type(OBJECTS), objects(o), front(front) {}
-        void destroy() {
-            if (type == OBJECTS) {
-                delete objects;
-                objects = nullptr;
-            }
-            if (type == NODE) {
-                delete node;
-                node = nullptr;
-            }
-        }
+        BSPChild(BSPLeaf * o, bool front): type(OBJECTS), front(front), objects(o) {}
         
         void set_node(BSPNode * n) { assert(type == NODE); node = n; }
-        void set_objects(BSPObjects * o) { assert(type == OBJECTS); objects = o; }
+        void set_objects(BSPLeaf * o) { assert(type == OBJECTS); objects = o; }
     };
     
     /**
@@ -143,6 +163,9 @@ namespace Physics {
      * :: FOR COLLISION ::
      * Traverse down to each object node
      * check members for collision based on distance
+     * Nodes, leaves and the working copies of walls and objects all
+     * live in the tree's arena, a rebuild resets it instead of freeing
+     * the old tree piece by piece
      */
     class BSPTree {
         BSPNode root;
@@ -151,73 +174,68 @@ namespace Physics {
         BSPObjects objects_cache;
         unsigned rebuild_count = 0;
         
-        void add_partitions(BSPNode * n, BSPPlanes walls, BSPObjects objects) {
-            if (walls.size()) {
-                // get first wall in set
-                Plane c = walls.back();
-                n->plane = c;
-                walls.pop_back();
-                
-                BSPObjects front_objects;
-                BSPObjects back_objects;
-                BSPPlanes front_walls;
-                BSPPlanes back_walls;
-                
-                auto objects_it = objects.begin();
-                for (; objects_it != objects.end(); ++objects_it) {
-                    // sort objects
-                    real indicator = n->plane.positive_side((*objects_it)->get_position());
+        FrameArena arena{16 * 1024, MEMORY_BROADPHASE};
+        
+        /*
+         * Splits the walls and objects in place at each level,
+         * front runs first, so nothing is copied per level
+         */
+        void add_partitions(
+            BSPNode * n,
+            Plane * walls_begin, Plane * walls_end,
+            Object ** objects_begin, Object ** objects_end
+        ) {
+            if (walls_begin == walls_end) return;
             
-                    if (indicator) front_objects.push_back(*objects_it);
-                    else back_objects.push_back(*objects_it);
-                }
-                
-                auto walls_it = walls.begin();
-                for (; walls_it != walls.end(); ++walls_it) {
-                    // sort walls
-                    real indicator = n->plane.side_of_plane(walls_it->position);
+            // get last wall in set
+            Plane * last = walls_end - 1;
+            n->plane = *last;
             
-                    if (indicator > 0) front_walls.push_back(*walls_it);
-                    else back_walls.push_back(*walls_it);
-                }
-                
-                if (front_walls.size()) {
-                    n->front = BSPChild(new BSPNode());
-                    add_partitions(n->front.node, front_walls, front_objects);
-                }
-                else {
-                    n->front = BSPChild(new BSPObjects(front_objects), true);
-                }
-                if (back_walls.size()) {
-                    n->back = BSPChild(new BSPNode());
-                    add_partitions(n->back.node, back_walls, back_objects);
-                }
-                else {
-                    n->back = BSPChild(new BSPObjects(back_objects), false);
-                }
+            // sort objects
+            Object ** objects_split = arena_partition(arena, objects_begin, objects_end, [n](Object * o) {
+                return n->plane.positive_side(o->get_position());
+            });
+            
+            // sort walls
+            Plane * walls_split = arena_partition(arena, walls_begin, last, [n](const Plane &w) {
+                return n->plane.side_of_plane(w.position) > 0;
+            });
+            
+            if (walls_split != walls_begin) {
+                n->front = BSPChild(arena.create<BSPNode>());
+                add_partitions(n->front.node, walls_begin, walls_split, objects_begin, objects_split);
+            }
+            else {
+                n->front = BSPChild(leaf(objects_begin, objects_split), true);
+            }
+            if (last != walls_split) {
+                n->back = BSPChild(arena.create<BSPNode>());
+                add_partitions(n->back.node, walls_split, last, objects_split, objects_end);
+            }
+            else {
+                n->back = BSPChild(leaf(objects_split, objects_end), false);
             }
         }
         
-        void kill() {
-            std::function<void(BSPNode *)> recur = [&](BSPNode * n){
-                // recurse all points
-                if (n->back.type == NODE && n->back.node != nullptr) {
-                    recur(n->back.node);
-                }
-                if (n->front.type == NODE && n->front.node != nullptr) {
-                    recur(n->front.node);
-                }
-                // delete from bottom up
-                if (n) n->back.destroy();
-                if (n) n->front.destroy();
-                return;
-            };
-            recur(&root);
+        BSPLeaf * leaf(Object ** begin, Object ** end) {
+            return arena.create<BSPLeaf>(BSPLeaf{begin, static_cast<unsigned>(end - begin)});
         }
         
         void rebuild() {
-            kill();
-            add_partitions(&root, walls_cache, objects_cache);
+            MemoryScope scope(MEMORY_BROADPHASE);
+            arena.reset();
+            root = BSPNode();
+            
+            Plane * walls = arena.create_array<Plane>(walls_cache.size());
+            std::copy(walls_cache.begin(), walls_cache.end(), walls);
+            Object ** objects = arena.create_array<Object*>(objects_cache.size());
+            std::copy(objects_cache.begin(), objects_cache.end(), objects);
+            
+            add_partitions(
+                &root,
+                walls, walls + walls_cache.size(),
+                objects, objects + objects_cache.size()
+            );
         }
         
     public:
@@ -229,11 +247,15 @@ namespace Physics {
          * recurse each side
          */
         BSPTree(BSPPlanes * walls, BSPObjects * objects) {
+            MemoryScope scope(MEMORY_BROADPHASE);
             walls_cache = BSPPlanes(*walls);
             objects_cache = BSPObjects(*objects);
-            add_partitions(&root, walls_cache, objects_cache);
+            rebuild();
         }
         
+        BSPTree(const BSPTree &) = delete;
+        BSPTree & operator=(const BSPTree &) = delete;
+        
         void each_object_node(std::function<void(BSPNode)> f) {
             std::function<void(BSPNode *)> recur = [&](BSPNode * n){
                 if (n->back.type == OBJECTS || n->front.type == OBJECTS) {
@@ -257,7 +279,7 @@ namespace Physics {
             // Only rebuild if object not on right side
             bool rebuild = false;
             // return whether to rebuild
-            auto check_bound = [](BSPObjects * os, Plane &p, bool front){
+            auto check_bound = [](BSPLeaf * os, Plane &p, bool front){
                 auto it = os->begin();
                 for (; it != os->end(); ++it) {
                     Vector3 pos = (*it)->get_position();
@@ -661,36 +683,51 @@ namespace Physics {
     struct BoundingSphereHierarchy {
         BVH::BVHNode<BVH::BoundingSphere> root;
         
-        Vector3 get_centroid(std::vector<R_Object*> *rbs) {
+        Vector3 get_centroid(R_Object ** begin, R_Object ** end) {
             Vector3 sum;
-            real ratio = rbs->size();
-            auto it = rbs->begin();
-            for (; it != rbs->end(); ++it) {
+            real ratio = end - begin;
+            for (R_Object ** it = begin; it != end; ++it) {
                 sum += (*it)->get_position();
             }
             return sum * ratio;
         }
         
-        real get_radius(std::vector<R_Object*> *rbs) {
-            Vector3 center = get_centroid(rbs);
+        real get_radius(R_Object ** begin, R_Object ** end) {
+            Vector3 center = get_centroid(begin, end);
             real longest = 0.0;
-            auto it = rbs->begin();
-            for (; it != rbs->end(); ++it) {
-                real distance = center.distance((*it)->get_position());
+            for (R_Object ** it = begin; it != end; ++it) {
+                real distance = center.distance_squared((*it)->get_position());
                 if (distance > longest) longest = distance;
             }
-            return longest;
+            return sqrtf(longest);
         }
         
         BoundingSphereHierarchy(
-            std::vector<R_Object*> rbs
-        ) : root(NULL, BVH::BoundingSphere(get_centroid(&rbs), get_radius(&rbs))) {
-            auto it = rbs.begin();
-            for (; it != rbs.end(); ++it) {
+            R_Object ** begin,
+            R_Object ** end
+        ) : root(NULL, BVH::BoundingSphere(get_centroid(begin, end), get_radius(begin, end))) {
+            for (R_Object ** it = begin; it != end; ++it) {
                 const BVH::BoundingSphere bs((*it)->get_position(), 3.f);
                 root.insert(*it, bs);
             }
         }
+        
+        BoundingSphereHierarchy(
+            R_BSPObjects rbs
+        ) : BoundingSphereHierarchy(rbs.data(), rbs.data() + rbs.size()) {}
+    };
+    
+    /**
+     * Objects of a rigid body leaf and their bounding sphere hierarchy
+     */
+    struct R_BSPLeaf {
+        R_Object ** objects;
+        unsigned count;
+        BoundingSphereHierarchy * BSH;
+        
+        R_Object ** begin() const { return objects; }
+        R_Object ** end() const { return objects + count; }
+        unsigned size() const { return count; }
     };
     
     /**
@@ -705,34 +742,16 @@ namespace Physics {
         union {
             R_BSPNode * node;
             // set of objects in front of plane
-            R_BSPObjects * objects;
+            R_BSPLeaf * objects;
         };
         
-        // Loaded when type == OBJECTS
-        BoundingSphereHierarchy * BSH;
-        
     public:
         R_BSPChild() : type(NODE), node(nullptr) {}
         R_BSPChild(R_BSPNode * n): type(NODE), node(n) {}
-        R_BSPChild(
-            R_BSPObjects * o,
-            bool front
-        ) : type(OBJECTS), objects(o), front(front), BSH(new BoundingSphereHierarchy(*o)) {}
-        
-        void destroy() {
-            if (type == OBJECTS) {
-                delete objects;
-                delete BSH;
-                objects = nullptr;
-            }
-            if (type == NODE) {
-                delete node;
-                node = nullptr;
-            }
-        }
+        R_BSPChild(R_BSPLeaf * o, bool front) : type(OBJECTS), front(front), objects(o) {}
         
         void set_node(R_BSPNode * n) { assert(type == NODE); node = n; }
-        void set_objects(R_BSPObjects * o) { assert(type == OBJECTS); objects = o; }
+        void set_objects(R_BSPLeaf * o) { assert(type == OBJECTS); objects = o; }
     };
     
     /**
@@ -746,6 +765,12 @@ namespace Physics {
         R_BSPNode() {}
     };
     
+    /**
+     * Same layout as BSPTree, each leaf also carries a bounding sphere
+     * hierarchy. The hierarchies sit in the arena as well but their
+     * BVH nodes are still heap allocated, so they get destroyed before
+     * the arena resets
+     */
     class BVH_BSPTree {
         R_BSPNode root;
         // cache for rebuilding
@@ -753,73 +778,77 @@ namespace Physics {
         R_BSPObjects objects_cache;
         unsigned rebuild_count = 0;
         
-        void add_partitions(R_BSPNode * n, BSPPlanes walls, R_BSPObjects objects) {
-            if (walls.size()) {
-                // get first wall in set
-                Plane c = walls.back();
-                n->plane = c;
-                walls.pop_back();
-                
-                R_BSPObjects front_objects;
-                R_BSPObjects back_objects;
-                BSPPlanes front_walls;
-                BSPPlanes back_walls;
-                
-                auto objects_it = objects.begin();
-                for (; objects_it != objects.end(); ++objects_it) {
-                    // sort objects
-                    real indicator = n->plane.positive_side((*objects_it)->get_position());
+        FrameArena arena{16 * 1024, MEMORY_BROADPHASE};
+        std::vector<R_BSPLeaf*> leaves;
+        
+        void add_partitions(
+            R_BSPNode * n,
+            Plane * walls_begin, Plane * walls_end,
+            R_Object ** objects_begin, R_Object ** objects_end
+        ) {
+            if (walls_begin == walls_end) return;
             
-                    if (indicator) front_objects.push_back(*objects_it);
-                    else back_objects.push_back(*objects_it);
-                }
-                
-                auto walls_it = walls.begin();
-                for (; walls_it != walls.end(); ++walls_it) {
-                    // sort walls
-                    real indicator = n->plane.side_of_plane(walls_it->position);
+            // get last wall in set
+            Plane * last = walls_end - 1;
+            n->plane = *last;
             
-                    if (indicator > 0) front_walls.push_back(*walls_it);
-                    else back_walls.push_back(*walls_it);
-                }
-                
-                if (front_walls.size()) {
-                    n->front = R_BSPChild(new R_BSPNode());
-                    add_partitions(n->front.node, front_walls, front_objects);
-                }
-                else {
-                    n->front = R_BSPChild(new R_BSPObjects(front_objects), true);
-                }
-                if (back_walls.size()) {
-                    n->back = R_BSPChild(new R_BSPNode());
-                    add_partitions(n->back.node, back_walls, back_objects);
-                }
-                else {
-                    n->back = R_BSPChild(new R_BSPObjects(back_objects), false);
-                }
+            // sort objects
+            R_Object ** objects_split = arena_partition(arena, objects_begin, objects_end, [n](R_Object * o) {
+                return n->plane.positive_side(o->get_position());
+            });
+            
+            // sort walls
+            Plane * walls_split = arena_partition(arena, walls_begin, last, [n](const Plane &w) {
+                return n->plane.side_of_plane(w.position) > 0;
+            });
+            
+            if (walls_split != walls_begin) {
+                n->front = R_BSPChild(arena.create<R_BSPNode>());
+                add_partitions(n->front.node, walls_begin, walls_split, objects_begin, objects_split);
+            }
+            else {
+                n->front = R_BSPChild(leaf(objects_begin, objects_split), true);
+            }
+            if (last != walls_split) {
+                n->back = R_BSPChild(arena.create<R_BSPNode>());
+                add_partitions(n->back.node, walls_split, last, objects_split, objects_end);
+            }
+            else {
+                n->back = R_BSPChild(leaf(objects_split, objects_end), false);
             }
         }
         
+        R_BSPLeaf * leaf(R_Object ** begin, R_Object ** end) {
+            R_BSPLeaf * l = arena.create<R_BSPLeaf>(R_BSPLeaf{
+                begin,
+                static_cast<unsigned>(end - begin),
+                arena.create<BoundingSphereHierarchy>(begin, end)
+            });
+            leaves.push_back(l);
+            return l;
+        }
+        
         void kill() {
-            std::function<void(R_BSPNode *)> recur = [&](R_BSPNode * n){
-                // recurse all points
-                if (n->back.type == NODE && n->back.node != nullptr) {
-                    recur(n->back.node);
-                }
-                if (n->front.type == NODE && n->front.node != nullptr) {
-                    recur(n->front.node);
-                }
-                // delete from bottom up
-                if (n) n->back.destroy();
-                if (n) n->front.destroy();
-                return;
-            };
-            recur(&root);
+            for (R_BSPLeaf * l : leaves) l->BSH->~BoundingSphereHierarchy();
+            leaves.clear();
+            arena.reset();
+            root = R_BSPNode();
         }
         
         void rebuild() {
+            MemoryScope scope(MEMORY_BROADPHASE);
             kill();
-            add_partitions(&root, walls_cache, objects_cache);
+            
+            Plane * walls = arena.create_array<Plane>(walls_cache.size());
+            std::copy(walls_cache.begin(), walls_cache.end(), walls);
+            R_Object ** objects = arena.create_array<R_Object*>(objects_cache.size());
+            std::copy(objects_cache.begin(), objects_cache.end(), objects);
+            
+            add_partitions(
+                &root,
+                walls, walls + walls_cache.size(),
+                objects, objects + objects_cache.size()
+            );
         }
         
     public:
@@ -831,11 +860,17 @@ namespace Physics {
          * recurse each side
          */
         BVH_BSPTree(BSPPlanes * walls, R_BSPObjects * objects) {
+            MemoryScope scope(MEMORY_BROADPHASE);
             walls_cache = BSPPlanes(*walls);
             objects_cache = R_BSPObjects(*objects);
-            add_partitions(&root, walls_cache, objects_cache);
+            rebuild();
         }
         
+        ~BVH_BSPTree() { kill(); }
+        
+        BVH_BSPTree(const BVH_BSPTree &) = delete;
+        BVH_BSPTree & operator=(const BVH_BSPTree &) = delete;
+        
         void each_object_node(std::function<void(R_BSPNode)> f) {
             std::function<void(R_BSPNode *)> recur = [&](R_BSPNode * n){
                 if (n->back.type == OBJECTS || n->front.type == OBJECTS) {
@@ -859,7 +894,7 @@ namespace Physics {
             // Only rebuild if object not on right side
             bool rebuild = false;
             // return whether to rebuild
-            auto check_bound = [](R_BSPObjects * os, Plane &p, bool front){
+            auto check_bound = [](R_BSPLeaf * os, Plane &p, bool front){
                 auto it = os->begin();
                 for (; it != os->end(); ++it) {
                     Vector3 pos = (*it)->get_position();
@@ -0,0 +1,229 @@
+//
+//  commands.h
+//  MSIM495
+//
+
+#ifndef __MSIM495__commands__
+#define __MSIM495__commands__
+
+#include <atomic>
+#include <memory>
+#include <assert.h>
+#include "core.h"
+
+namespace Physics {
+    class ParticleForceGenerator;
+    class ParticleContactGenerator;
+    
+    /**
+     * One change to a ParticleWorld, queued by any thread and applied by
+     * the world at the start of its next step
+     * The world never owns what commands point at, spawned particles and
+     * generators have to outlive their registration
+     */
+    struct WorldCommand {
+        enum Type {
+            SPAWN_PARTICLE,
+            REMOVE_PARTICLE,
+            APPLY_IMPULSE,
+            SET_MASS,
+            SET_DAMPING,
+            SET_VELOCITY,
+            ADD_FORCE,
+            REMOVE_FORCE,
+            ADD_CONTACTS,
+            REMOVE_CONTACTS
+        };
+        
+        Type type = SPAWN_PARTICLE;
+        Particle * particle = nullptr;
+        ParticleForceGenerator * force = nullptr;
+        ParticleContactGenerator * contacts = nullptr;
+        Vector3 vector;
+        real value = 0;
+        
+        /**
+         * Add a particle to the world, registered with force when given one
+         */
+        static WorldCommand spawn(Particle * p, ParticleForceGenerator * fg = nullptr) {
+            WorldCommand c;
+            c.type = SPAWN_PARTICLE;
+            c.particle = p;
+            c.force = fg;
+            return c;
+        }
+        
+        /**
+         * Take a particle out of the world and out of every force registration
+         * The list's last particle takes its place, link sets over the list
+         * drop the removed particle's links and remap the moved one's,
+         * other contact generators still pointing at it have to be removed
+         */
+        static WorldCommand remove(Particle * p) {
+            WorldCommand c;
+            c.type = REMOVE_PARTICLE;
+            c.particle = p;
+            return c;
+        }
+        
+        /**
+         * Instant change of momentum, velocity += impulse / mass
+         */
+        static WorldCommand impulse(Particle * p, const Vector3 &impulse) {
+            WorldCommand c;
+            c.type = APPLY_IMPULSE;
+            c.particle = p;
+            c.vector = impulse;
+            return c;
+        }
+        
+        static WorldCommand set_mass(Particle * p, real mass) {
+            WorldCommand c;
+            c.type = SET_MASS;
+            c.particle = p;
+            c.value = mass;
+            return c;
+        }
+        
+        static WorldCommand set_damping(Particle * p, real damping) {
+            WorldCommand c;
+            c.type = SET_DAMPING;
+            c.particle = p;
+            c.value = damping;
+            return c;
+        }
+        
+        static WorldCommand set_velocity(Particle * p, const Vector3 &velocity) {
+            WorldCommand c;
+            c.type = SET_VELOCITY;
+            c.particle = p;
+            c.vector = velocity;
+            return c;
+        }
+        
+        static WorldCommand add_force(Particle * p, ParticleForceGenerator * fg) {
+            WorldCommand c;
+            c.type = ADD_FORCE;
+            c.particle = p;
+            c.force = fg;
+            return c;
+        }
+        
+        static WorldCommand remove_force(Particle * p, ParticleForceGenerator * fg) {
+            WorldCommand c;
+            c.type = REMOVE_FORCE;
+            c.particle = p;
+            c.force = fg;
+            return c;
+        }
+        
+        static WorldCommand add_contacts(ParticleContactGenerator * cg) {
+            WorldCommand c;
+            c.type = ADD_CONTACTS;
+            c.contacts = cg;
+            return c;
+        }
+        
+        static WorldCommand remove_contacts(ParticleContactGenerator * cg) {
+            WorldCommand c;
+            c.type = REMOVE_CONTACTS;
+            c.contacts = cg;
+            return c;
+        }
+    };
+    
+    
+    
+    /**
+     * Bounded multi producer, single consumer queue
+     * Producers claim a slot with one compare and swap and publish it
+     * through the slot's sequence number, they never wait on the consumer
+     * or on each other. A full queue rejects the push instead of blocking
+     * Only the owning thread may call drain
+     */
+    template<typename T>
+    class CommandQueue {
+        struct Slot {
+            std::atomic<unsigned long> sequence;
+            T value;
+        };
+        
+        std::unique_ptr<Slot[]> slots;
+        const unsigned long mask;
+        
+        /*
+         * Producers and the consumer on their own cache lines
+         */
+        alignas(64) std::atomic<unsigned long> tail{0};
+        alignas(64) unsigned long head = 0;
+    
+    public:
+        /**
+         * capacity has to be a power of two
+         */
+        explicit CommandQueue(unsigned capacity = 1024) :
+            slots(new Slot[capacity]),
+            mask(capacity - 1)
+        {
+            assert(capacity && (capacity & (capacity - 1)) == 0);
+            for (unsigned i = 0; i < capacity; ++i) {
+                slots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+        
+        CommandQueue(const CommandQueue &) = delete;
+        CommandQueue & operator=(const CommandQueue &) = delete;
+        
+        /**
+         * Any thread, returns false when the queue is full
+         */
+        bool push(const T &value) {
+            unsigned long position = tail.load(std::memory_order_relaxed);
+            for (;;) {
+                Slot &slot = slots[position & mask];
+                unsigned long sequence = slot.sequence.load(std::memory_order_acquire);
+                long lag = static_cast<long>(sequence - position);
+                
+                if (lag == 0) {
+                    // Slot is free for this position, try to claim it
+                    if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        slot.value = value;
+                        slot.sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (lag < 0) {
+                    // Consumer hasn't freed the slot from a lap ago
+                    return false;
+                }
+                else {
+                    position = tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+        
+        /**
+         * Owning thread only, hands every published value to f in push
+         * order and returns how many there were
+         * Stops at a slot that's claimed but not yet written, the rest
+         * is picked up by the next drain
+         */
+        template<typename F>
+        unsigned drain(F f) {
+            unsigned count = 0;
+            for (;;) {
+                Slot &slot = slots[head & mask];
+                if (slot.sequence.load(std::memory_order_acquire) != head + 1) return count;
+                
+                f(slot.value);
+                slot.sequence.store(head + mask + 1, std::memory_order_release);
+                ++head;
+                ++count;
+            }
+        }
+        
+        unsigned capacity() const { return static_cast<unsigned>(mask + 1); }
+    };
+}
+
+#endif /* defined(__MSIM495__commands__) */
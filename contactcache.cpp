@@ -0,0 +1,82 @@
+//
+//  contactcache.cpp
+//  MSIM495
+//
+
+#include "contactcache.h"
+
+namespace Physics {
+    // ContactCache //
+    //////////////////
+    
+    void ContactCache::begin_step(ParticleContact * contacts, unsigned count) {
+        ++step;
+        events.clear();
+        matched.resize(count);
+        
+        for (unsigned i = 0; i < count; ++i) {
+            ParticleContact &contact = contacts[i];
+            const Key key = { contact.left, contact.right, contact.feature };
+            auto found = entries.try_emplace(key, Entry{Vector3(), step});
+            Entry &entry = found.first->second;
+            matched[i] = &entry;
+            
+            // Same contact generated twice in one step, nothing to carry over
+            if (!found.second && entry.step == step) {
+                contact.impulse = 0;
+                continue;
+            }
+            
+            const bool persisting = !found.second;
+            events.push_back(Event{persisting ? Event::PERSIST : Event::BEGIN, key, 0});
+            entry.step = step;
+            
+            contact.impulse = 0;
+            if (!persisting || !warm_starting) continue;
+            
+            // Apply the share of last step's impulse the resolver would
+            // otherwise have to find again, contacts only ever push
+            const real warm = (entry.impulse * contact.contact_normal) * warm_factor;
+            if (warm <= 0) continue;
+            
+            Particle * left = contact.left;
+            Particle * right = contact.right;
+            const Vector3 impulse = contact.contact_normal * warm;
+            
+            left->set_velocity(left->get_velocity() + impulse * left->get_inverse_mass());
+            if (right) right->set_velocity(right->get_velocity() - impulse * right->get_inverse_mass());
+            contact.impulse = warm;
+        }
+    }
+    
+    void ContactCache::end_step(const ParticleContact * contacts, unsigned count) {
+        // A contact generated more than once keeps the sum of its impulses
+        for (unsigned i = 0; i < count; ++i) matched[i]->impulse.clear();
+        for (unsigned i = 0; i < count; ++i) {
+            matched[i]->impulse += contacts[i].contact_normal * contacts[i].impulse;
+        }
+        
+        // Events are in contact order, minus duplicates
+        unsigned e = 0;
+        for (unsigned i = 0; i < count && e < events.size(); ++i) {
+            const Key key = { contacts[i].left, contacts[i].right, contacts[i].feature };
+            if (events[e].key == key) events[e++].impulse = matched[i]->impulse.magnitude();
+        }
+        
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (it->second.step == step) {
+                ++it;
+                continue;
+            }
+            
+            events.push_back(Event{Event::END, it->first, it->second.impulse.magnitude()});
+            it = entries.erase(it);
+        }
+    }
+    
+    void ContactCache::clear() {
+        entries.clear();
+        events.clear();
+        matched.clear();
+    }
+}
@@ -0,0 +1,122 @@
+//
+//  contactcache.h
+//  MSIM495
+//
+
+#ifndef __MSIM495__contactcache__
+#define __MSIM495__contactcache__
+
+#include <vector>
+#include <unordered_map>
+#include "collision.h"
+#include "memstats.h"
+
+namespace Physics {
+    /**
+     * Contacts carried across steps, keyed by (left, right, feature)
+     * Each step's contacts are matched against the last step's, a match
+     * starts with the impulse it ended on (warm start) so contacts that
+     * hold from step to step, resting stacks and taut links, only need
+     * the resolver to correct what changed
+     * Keys are only compared, never dereferenced, so removed particles
+     * just stop matching
+     *
+     *     Physics::ContactCache cache;
+     *     world.set_contact_cache(&cache);
+     *     ...
+     *     for (const ContactCache::Event &e : cache.get_events()) ...
+     */
+    class ContactCache {
+    public:
+        struct Key {
+            const Particle * left;
+            const Particle * right;
+            unsigned feature;
+            
+            bool operator==(const Key &o) const {
+                return left == o.left && right == o.right && feature == o.feature;
+            }
+        };
+        
+        struct Event {
+            enum Type { BEGIN, PERSIST, END };
+            
+            Type type;
+            Key key;
+            
+            /*
+             * Impulse the contact ended the step with,
+             * for END the last step it existed
+             */
+            real impulse;
+        };
+        
+        /**
+         * Share of the cached impulse applied up front, below 1 so a
+         * contact that is letting go isn't held on to
+         */
+        real warm_factor = real(0.8);
+        
+        /**
+         * Off keeps the events and matching but starts every contact cold
+         */
+        bool warm_starting = true;
+    
+    private:
+        struct KeyHash {
+            std::size_t operator()(const Key &k) const {
+                std::size_t h = reinterpret_cast<std::size_t>(k.left) * 0x9e3779b97f4a7c15ull;
+                h ^= reinterpret_cast<std::size_t>(k.right) + 0x632be59bd9b4e019ull + (h << 6) + (h >> 2);
+                h ^= k.feature + 0x9e3779b9u + (h << 6) + (h >> 2);
+                return h;
+            }
+        };
+        
+        /*
+         * Impulse kept as a vector so a contact whose normal turned or
+         * flipped (a rod going from stretched to compressed) only gets
+         * the part that still pushes along its new normal
+         */
+        struct Entry {
+            Vector3 impulse;
+            unsigned step;
+        };
+        
+        typedef TaggedAllocator<std::pair<const Key, Entry>, MEMORY_CONTACTS> EntryAllocator;
+        std::unordered_map<Key, Entry, KeyHash, std::equal_to<Key>, EntryAllocator> entries;
+        std::vector<Event> events;
+        
+        /*
+         * Entry of each contact of the current step, in contact order
+         */
+        std::vector<Entry*> matched;
+        unsigned step = 0;
+    
+    public:
+        /**
+         * Match contacts with the cache and warm start them,
+         * called after generation and before resolution
+         */
+        void begin_step(ParticleContact * contacts, unsigned count);
+        
+        /**
+         * Keep the resolved impulses for the next step and
+         * raise END for everything that didn't come back
+         */
+        void end_step(const ParticleContact * contacts, unsigned count);
+        
+        /**
+         * Begin / persist / end events of the last step
+         */
+        const std::vector<Event> & get_events() const { return events; }
+        
+        unsigned size() const { return static_cast<unsigned>(entries.size()); }
+        
+        /**
+         * Forget every contact without raising END, e.g. after a checkpoint restore
+         */
+        void clear();
+    };
+}
+
+#endif /* defined(__MSIM495__contactcache__) */
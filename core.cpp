@@ -9,19 +9,15 @@
 #include "core.h"
 #include <math.h>
 #include <assert.h>
+#include <string.h>
 
 #define real_pow powf
-#define real_sqrt sqrtf
 
 namespace Physics {
     /* 
      * Namespace Functions
      */
     
-    real real_sqrt(real x) {
-        return static_cast<real>(sqrt(x));
-    }
-    
     void makeOrthonormalBasis(Vector3 * a, Vector3 * b, Vector3 * c) {
         a->normalize();
         (*c) = a->vector_product(*b);
@@ -41,88 +37,38 @@ namespace Physics {
     // Vector 3 //
     //////////////
     
-    void Vector3::invert() {
-        x = -x;
-        y = -y;
-        z = -z;
-    }
-    
-    void Vector3::print() {
+    void Vector3::print() const {
         printf("<%f, %f, %f>\n", x, y, z);
     }
     
-    void Vector3::clear() {
-        (*this) = Vector3();
-    }
-    
-    real Vector3::magnitude_squared() {
-        // Avoids sqrt and square
-        return x*x + y*y + z*z;
-    }
-    
-    real Vector3::magnitude() {
-        return real_sqrt( magnitude_squared() );
+    real Vector3::magnitude() const noexcept {
+        return sqrtf(magnitude_squared());
     }
     
-    void Vector3::normalize() {
+    void Vector3::normalize() noexcept {
         real length = magnitude();
         if (length > 0) {
             (*this) *= static_cast<real>(1) / length;
         }
     }
-    
-    void Vector3::scale_vector_and_add(Vector3 &v, const real scale) {
-        (*this) += (v * scale);
-    }
-    
-    Vector3 Vector3::component_product(Vector3 &v) {
-        return Vector3(x * v.x, y * v.y, z * v.z);
-    }
-    
-    void Vector3::set_component_product(Vector3 &v) {
-        x *= v.x;
-        y *= v.y;
-        z *= v.z;
-    }
-    
-    real Vector3::scalar_product(Vector3 &v) const {
-        return x*v.x + y*v.y + z*v.z;
-    }
-    
-    Vector3 Vector3::vector_product(Vector3 &v) {
-        return Vector3(
-            y*v.z - z*v.y,
-            z*v.x - x*v.z,
-            x*v.y - y*v.x
-        );
-    }
 
-    real Vector3::distance(Vector3 b) {
-        return real_sqrt(
-            real_pow(x - b.x, 2)
-            + real_pow(y - b.y, 2)
-            + real_pow(z - b.z, 2)
-        );
-    }
-    
-    Vector3 Vector3::midpoint(Vector3 b) {
-        Vector3 n = (*this) + b;
-        return Vector3(n.x / 2, n.y / 2, n.z /2);
+    real Vector3::distance(const Vector3 &b) const noexcept {
+        return sqrtf(distance_squared(b));
     }
     
-    Vector3 Vector3::direction(Vector3 b) {
+    Vector3 Vector3::direction(const Vector3 &b) const noexcept {
         Vector3 n = b - (*this);
         n.normalize();
         return n;
     }
     
-    real Vector3::angle_2d(Vector3 b) {
+    real Vector3::angle_2d(const Vector3 &b) const noexcept {
         real mag = x * b.x - z * b.z;
         int sign = (mag < 0 ? -1 : 1);
         return sign * acos((scalar_product(b)) / (magnitude() * b.magnitude()));
     }
     
-    real Vector3::angle(Vector3 b) {
+    real Vector3::angle(const Vector3 &b) const noexcept {
         real dot = scalar_product(b);
         real mag = magnitude() * b.magnitude();
         return acosf(dot/mag);
@@ -130,6 +76,65 @@ namespace Physics {
     
     
     
+    // DampingTable //
+    //////////////////
+    
+    DampingTable::DampingTable() {
+        intern(default_damping);
+    }
+    
+    DampingTable & DampingTable::global() {
+        static DampingTable table;
+        return table;
+    }
+    
+    DampingTable::ClassID DampingTable::intern(real d) {
+        uint32_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        
+        std::lock_guard<std::mutex> guard(lock);
+        auto found = classes.find(bits);
+        if (found != classes.end()) return found->second;
+        
+        const unsigned n = count.load(std::memory_order_relaxed);
+        if (n == max_classes) {
+            ClassID nearest = default_class;
+            for (ClassID i = 1; i < n; ++i) {
+                if (fabsf(damping[i] - d) < fabsf(damping[nearest] - d)) nearest = i;
+            }
+            return nearest;
+        }
+        
+        // Value first, readers only look below count
+        damping[n] = d;
+        count.store(n + 1, std::memory_order_release);
+        classes[bits] = n;
+        return n;
+    }
+    
+    
+    
+    // DampingFactors //
+    ////////////////////
+    
+    void DampingFactors::update(real duration) {
+        const DampingTable &table = DampingTable::global();
+        const unsigned classes = table.size();
+        
+        unsigned first = static_cast<unsigned>(factors.size());
+        if (duration != this->duration) {
+            this->duration = duration;
+            first = 0;
+        }
+        
+        factors.resize(classes);
+        for (unsigned i = first; i < classes; ++i) {
+            factors[i] = real_pow(table.get_damping(i), duration);
+        }
+    }
+    
+    
+    
     // Particle //
     //////////////
     
@@ -138,7 +143,7 @@ namespace Physics {
         else inverse_mass = 1.0 / mass;
     }
     
-    void Particle::integrate(real time) {
+    void Particle::integrate(real time, real damping_factor) {
         if (inverse_mass <= 0.0f) return;
         assert(time > 0.0);
         // update position
@@ -146,10 +151,311 @@ namespace Physics {
         // update velocity with time adjusted damping factor
         Vector3 adjusted_acc = acceleration;
         adjusted_acc += force_accumulator * inverse_mass;
-        velocity = (velocity * real_pow(damping, time)) + (adjusted_acc * time);
+        velocity = (velocity * damping_factor) + (adjusted_acc * time);
         clear_impulse();
     }
     
+    void Particle::integrate(real time) {
+        integrate(time, real_pow(get_damping(), time));
+    }
+    
+    
+    
+    // Quaternion //
+    ////////////////
+    
+    void integrate_orientations(
+        Quaternion * orientations,
+        const Vector3 * rotations,
+        unsigned count,
+        real duration
+    ) {
+        unsigned n = 0;
+
+#ifdef PHYSICS_SIMD
+        const __m128 half_duration = _mm_set1_ps(duration * ((real)0.5));
+        const __m128 one = _mm_set1_ps(1);
+        const __m128 epsilon = _mm_set1_ps(FLT_EPSILON);
+        
+        // Four orientations at a time, transposed so each register
+        // holds one component of all four
+        for (; n + 4 <= count; n += 4) {
+            __m128 r = _mm_loadu_ps(orientations[n + 0].data);
+            __m128 i = _mm_loadu_ps(orientations[n + 1].data);
+            __m128 j = _mm_loadu_ps(orientations[n + 2].data);
+            __m128 k = _mm_loadu_ps(orientations[n + 3].data);
+            _MM_TRANSPOSE4_PS(r, i, j, k);
+            
+            __m128 x = _mm_loadu_ps(&rotations[n + 0].x);
+            __m128 y = _mm_loadu_ps(&rotations[n + 1].x);
+            __m128 z = _mm_loadu_ps(&rotations[n + 2].x);
+            __m128 w = _mm_loadu_ps(&rotations[n + 3].x);
+            _MM_TRANSPOSE4_PS(x, y, z, w);
+            x = _mm_mul_ps(x, half_duration);
+            y = _mm_mul_ps(y, half_duration);
+            z = _mm_mul_ps(z, half_duration);
+            
+            // q += (0, x, y, z) * q
+            __m128 dr = _mm_sub_ps(_mm_setzero_ps(), _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(x, i), _mm_mul_ps(y, j)),
+                _mm_mul_ps(z, k)
+            ));
+            __m128 di = _mm_sub_ps(
+                _mm_add_ps(_mm_mul_ps(x, r), _mm_mul_ps(y, k)),
+                _mm_mul_ps(z, j)
+            );
+            __m128 dj = _mm_sub_ps(
+                _mm_add_ps(_mm_mul_ps(y, r), _mm_mul_ps(z, i)),
+                _mm_mul_ps(x, k)
+            );
+            __m128 dk = _mm_sub_ps(
+                _mm_add_ps(_mm_mul_ps(z, r), _mm_mul_ps(x, j)),
+                _mm_mul_ps(y, i)
+            );
+            r = _mm_add_ps(r, dr);
+            i = _mm_add_ps(i, di);
+            j = _mm_add_ps(j, dj);
+            k = _mm_add_ps(k, dk);
+            
+            // Normalize, zero length lanes get r = 1 like Quaternion::normalize
+            __m128 d = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(i, i)),
+                _mm_add_ps(_mm_mul_ps(j, j), _mm_mul_ps(k, k))
+            );
+            __m128 degenerate = _mm_cmplt_ps(d, epsilon);
+            __m128 inv = SIMD::rsqrt(_mm_max_ps(d, epsilon));
+            r = SIMD::select(degenerate, one, _mm_mul_ps(r, inv));
+            i = SIMD::select(degenerate, i, _mm_mul_ps(i, inv));
+            j = SIMD::select(degenerate, j, _mm_mul_ps(j, inv));
+            k = SIMD::select(degenerate, k, _mm_mul_ps(k, inv));
+            
+            _MM_TRANSPOSE4_PS(r, i, j, k);
+            _mm_storeu_ps(orientations[n + 0].data, r);
+            _mm_storeu_ps(orientations[n + 1].data, i);
+            _mm_storeu_ps(orientations[n + 2].data, j);
+            _mm_storeu_ps(orientations[n + 3].data, k);
+        }
+#endif
+        
+        // Remainder
+        for (; n < count; ++n) {
+            orientations[n].add_scaled_vector(rotations[n], duration);
+            orientations[n].normalize();
+        }
+    }
+    
+    
+    
+    // Distance Queries //
+    //////////////////////
+    
+#ifdef PHYSICS_SIMD
+    /**
+     * Squared distances of four padded vectors from four others,
+     * one lane per pair
+     */
+    static inline __m128 distance_squared4(
+        const Vector3 * a,
+        __m128 bx, __m128 by, __m128 bz
+    ) {
+        __m128 x = _mm_loadu_ps(&a[0].x);
+        __m128 y = _mm_loadu_ps(&a[1].x);
+        __m128 z = _mm_loadu_ps(&a[2].x);
+        __m128 w = _mm_loadu_ps(&a[3].x);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        
+        x = _mm_sub_ps(x, bx);
+        y = _mm_sub_ps(y, by);
+        z = _mm_sub_ps(z, bz);
+        return _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+            _mm_mul_ps(z, z)
+        );
+    }
+#endif
+    
+    unsigned points_within(
+        const Vector3 * points,
+        unsigned count,
+        const Vector3 &center,
+        real radius,
+        unsigned * out_indices
+    ) {
+        const real radius_squared = radius * radius;
+        unsigned found = 0;
+        unsigned n = 0;
+        
+#ifdef PHYSICS_SIMD
+        const __m128 cx = _mm_set1_ps(center.x);
+        const __m128 cy = _mm_set1_ps(center.y);
+        const __m128 cz = _mm_set1_ps(center.z);
+        const __m128 r2 = _mm_set1_ps(radius_squared);
+        for (; n + 4 <= count; n += 4) {
+            __m128 d2 = distance_squared4(points + n, cx, cy, cz);
+            int hits = _mm_movemask_ps(_mm_cmplt_ps(d2, r2));
+            
+            // Common case is no hits in the whole group
+            if (!hits) continue;
+            for (unsigned lane = 0; lane < 4; ++lane) {
+                if (hits & (1 << lane)) out_indices[found++] = n + lane;
+            }
+        }
+#endif
+        
+        // Remainder
+        for (; n < count; ++n) {
+            if (points[n].distance_squared(center) < radius_squared) {
+                out_indices[found++] = n;
+            }
+        }
+        return found;
+    }
+    
+    void distances(
+        const Vector3 * a,
+        const Vector3 * b,
+        real * out,
+        unsigned count
+    ) {
+        unsigned n = 0;
+        
+#ifdef PHYSICS_SIMD
+        for (; n + 4 <= count; n += 4) {
+            __m128 x = _mm_loadu_ps(&b[n + 0].x);
+            __m128 y = _mm_loadu_ps(&b[n + 1].x);
+            __m128 z = _mm_loadu_ps(&b[n + 2].x);
+            __m128 w = _mm_loadu_ps(&b[n + 3].x);
+            _MM_TRANSPOSE4_PS(x, y, z, w);
+            
+            _mm_storeu_ps(out + n, _mm_sqrt_ps(distance_squared4(a + n, x, y, z)));
+        }
+#endif
+        
+        // Remainder
+        for (; n < count; ++n) {
+            out[n] = a[n].distance(b[n]);
+        }
+    }
+    
+    
+    
+    // Matrix3 //
+    /////////////
+    
+    void Matrix3::transform(const Vector3 * in, Vector3 * out, unsigned count) const {
+#ifdef PHYSICS_SIMD
+        // Columns only need to be gathered once for the whole batch
+        __m128 c0 = _mm_setr_ps(data[0], data[3], data[6], 0);
+        __m128 c1 = _mm_setr_ps(data[1], data[4], data[7], 0);
+        __m128 c2 = _mm_setr_ps(data[2], data[5], data[8], 0);
+        for (unsigned i = 0; i < count; ++i) {
+            SIMD::store3(&out[i].x, SIMD::combine(c0, c1, c2, SIMD::load3(&in[i].x)));
+        }
+#else
+        for (unsigned i = 0; i < count; ++i) out[i] = (*this) * in[i];
+#endif
+    }
+    
+    void Matrix3::transform_each(
+        const Matrix3 * m,
+        const Vector3 * in,
+        Vector3 * out,
+        unsigned count
+    ) {
+        for (unsigned i = 0; i < count; ++i) out[i] = m[i] * in[i];
+    }
+    
+    
+    
+    // Matrix4 //
+    /////////////
+
+#ifdef PHYSICS_SIMD
+    /**
+     * Columns of the 3x4 matrix, c3 holds the translation
+     */
+    struct Matrix4Columns {
+        __m128 c0, c1, c2, c3;
+        
+        Matrix4Columns(const Matrix4 &m) {
+            c0 = _mm_loadu_ps(m.data);
+            c1 = _mm_loadu_ps(m.data + 4);
+            c2 = _mm_loadu_ps(m.data + 8);
+            c3 = _mm_setzero_ps();
+            _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+        }
+    };
+#endif
+    
+    void Matrix4::transform(const Vector3 * in, Vector3 * out, unsigned count) const {
+#ifdef PHYSICS_SIMD
+        Matrix4Columns m(*this);
+        for (unsigned i = 0; i < count; ++i) {
+            __m128 v = SIMD::combine(m.c0, m.c1, m.c2, SIMD::load3(&in[i].x));
+            SIMD::store3(&out[i].x, _mm_add_ps(v, m.c3));
+        }
+#else
+        for (unsigned i = 0; i < count; ++i) out[i] = (*this) * in[i];
+#endif
+    }
+    
+    void Matrix4::transform_direction(const Vector3 * in, Vector3 * out, unsigned count) const {
+#ifdef PHYSICS_SIMD
+        Matrix4Columns m(*this);
+        for (unsigned i = 0; i < count; ++i) {
+            SIMD::store3(&out[i].x, SIMD::combine(m.c0, m.c1, m.c2, SIMD::load3(&in[i].x)));
+        }
+#else
+        for (unsigned i = 0; i < count; ++i) out[i] = transform_direction(in[i]);
+#endif
+    }
+    
+    void Matrix4::transform_inverse(const Vector3 * in, Vector3 * out, unsigned count) const {
+#ifdef PHYSICS_SIMD
+        __m128 r0 = _mm_loadu_ps(data);
+        __m128 r1 = _mm_loadu_ps(data + 4);
+        __m128 r2 = _mm_loadu_ps(data + 8);
+        __m128 t = _mm_setr_ps(data[3], data[7], data[11], 0);
+        for (unsigned i = 0; i < count; ++i) {
+            __m128 v = _mm_sub_ps(SIMD::load3(&in[i].x), t);
+            SIMD::store3(&out[i].x, SIMD::combine(r0, r1, r2, v));
+        }
+#else
+        for (unsigned i = 0; i < count; ++i) out[i] = transform_inverse(in[i]);
+#endif
+    }
+    
+    void Matrix4::transform_inverse_direction(const Vector3 * in, Vector3 * out, unsigned count) const {
+#ifdef PHYSICS_SIMD
+        __m128 r0 = _mm_loadu_ps(data);
+        __m128 r1 = _mm_loadu_ps(data + 4);
+        __m128 r2 = _mm_loadu_ps(data + 8);
+        for (unsigned i = 0; i < count; ++i) {
+            SIMD::store3(&out[i].x, SIMD::combine(r0, r1, r2, SIMD::load3(&in[i].x)));
+        }
+#else
+        for (unsigned i = 0; i < count; ++i) out[i] = transform_inverse_direction(in[i]);
+#endif
+    }
+    
+    void Matrix4::transform_each(
+        const Matrix4 * m,
+        const Vector3 * in,
+        Vector3 * out,
+        unsigned count
+    ) {
+        for (unsigned i = 0; i < count; ++i) out[i] = m[i] * in[i];
+    }
+    
+    void Matrix4::transform_direction_each(
+        const Matrix4 * m,
+        const Vector3 * in,
+        Vector3 * out,
+        unsigned count
+    ) {
+        for (unsigned i = 0; i < count; ++i) out[i] = m[i].transform_direction(in[i]);
+    }
+    
     
     
     // RigidBody //
@@ -259,7 +565,10 @@ namespace Physics {
     
     void RigidBody::calculate_derived_data() {
         orientation.normalize();
-        
+        calculate_transforms();
+    }
+    
+    void RigidBody::calculate_transforms() {
         _calculate_transform_matrix(
             transform_matrix,
             position,
@@ -14,6 +14,11 @@
 #include <math.h>
 #include <functional>
 #include <float.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include "simd.h"
 
 namespace Util {
     /**
@@ -78,96 +83,142 @@ namespace Physics {
         /* 
          * Constructors 
          */
-        Vector3():
-            x(0), y(0), z(0) {}
+        constexpr Vector3() noexcept:
+            x(0), y(0), z(0), pad(0) {}
         
-        Vector3(const real x, const real y, const real z):
-            x(x), y(y), z(z) {}
+        constexpr Vector3(const real x, const real y, const real z) noexcept:
+            x(x), y(y), z(z), pad(0) {}
         
         /**
          * (Vector * -1)
          */
-        void invert();
+        constexpr void invert() noexcept {
+            x = -x;
+            y = -y;
+            z = -z;
+        }
         
         /**
          * Formatted print of vector components
          */
-        void print();
+        void print() const;
         
         /**
          * Zero vector components
          */
-        void clear();
+        constexpr void clear() noexcept {
+            x = y = z = 0;
+        }
         
         /**
          * Avoids redundant calculation
          * Calculates summed square of component vectors
          */
-        real magnitude_squared();
+        [[nodiscard]] constexpr real magnitude_squared() const noexcept {
+            return x*x + y*y + z*z;
+        }
         
         /**
          * Returns total length of vector
          */
-        real magnitude();
+        [[nodiscard]] real magnitude() const noexcept;
         
         /**
          * Normalizing a vector makes its magnitude == 1
          * Makes vector calculations easier
          */
-        void normalize();
+        void normalize() noexcept;
         
         /**
          * Example usage: p' = p + (dp)t ---> position += velocity * time;
          */
-        void scale_vector_and_add(Vector3 &v, real scale);
+        constexpr void scale_vector_and_add(const Vector3 &v, const real scale) noexcept {
+            x += v.x * scale;
+            y += v.y * scale;
+            z += v.z * scale;
+        }
         
         /**
          * Resulting vector from component multiplication of
          * this vector and another
          */
-        Vector3 component_product(Vector3 &v);
+        [[nodiscard]] constexpr Vector3 component_product(const Vector3 &v) const noexcept {
+            return Vector3(x * v.x, y * v.y, z * v.z);
+        }
         
         /**
          * Above operation applies product to this vector
          */
-        void set_component_product(Vector3 &v);
+        constexpr void set_component_product(const Vector3 &v) noexcept {
+            x *= v.x;
+            y *= v.y;
+            z *= v.z;
+        }
         
         /**
          * Equal to |a||b|cos(theta) where theta is angle between two vectors
          */
-        real scalar_product(Vector3 &v) const;
+        [[nodiscard]] constexpr real scalar_product(const Vector3 &v) const noexcept {
+            return x*v.x + y*v.y + z*v.z;
+        }
         
         /**
          * Dot Product
          * Equal to |a||b|sin(theta) where theta is angle between two vectors
          * Difference is sin vs cos
          */
-        Vector3 vector_product(Vector3 &v);
+        [[nodiscard]] constexpr Vector3 vector_product(const Vector3 &v) const noexcept {
+            return Vector3(
+                y*v.z - z*v.y,
+                z*v.x - x*v.z,
+                x*v.y - y*v.x
+            );
+        }
         
         /**
          * Get distance between this vector and another
          */
-        real distance(Vector3 b);
-        Vector3 midpoint(Vector3 b);
-        Vector3 direction(Vector3 b);
-        real angle(Vector3 b);
+        [[nodiscard]] real distance(const Vector3 &b) const noexcept;
+        
+        /**
+         * Squared distance, use for comparisons to skip the sqrt
+         */
+        [[nodiscard]] constexpr real distance_squared(const Vector3 &b) const noexcept {
+            const real dx = x - b.x;
+            const real dy = y - b.y;
+            const real dz = z - b.z;
+            return dx*dx + dy*dy + dz*dz;
+        }
+        
+        /**
+         * True when b lies strictly inside radius of this point
+         */
+        [[nodiscard]] constexpr bool within(const Vector3 &b, real radius) const noexcept {
+            return distance_squared(b) < radius * radius;
+        }
+        
+        [[nodiscard]] constexpr Vector3 midpoint(const Vector3 &b) const noexcept {
+            return Vector3((x + b.x) / 2, (y + b.y) / 2, (z + b.z) / 2);
+        }
+        [[nodiscard]] Vector3 direction(const Vector3 &b) const noexcept;
+        [[nodiscard]] real angle(const Vector3 &b) const noexcept;
         
         /**
          * Return angle between current and reference vector on xz plane
          */
-        real angle_2d(Vector3 b);
+        [[nodiscard]] real angle_2d(const Vector3 &b) const noexcept;
         
         /* 
          * Operators 
          */
         // Products
-        void operator*=(real value) {
+        constexpr void operator*=(const real value) noexcept {
             x *= value;
             y *= value;
             z *= value;
         };
         
-        Vector3 operator*(const real value) const {
+        [[nodiscard]] constexpr Vector3 operator*(const real value) const noexcept {
             return Vector3(
                 x * value,
                 y * value,
@@ -175,18 +226,18 @@ namespace Physics {
             );
         };
         
-        real operator*(Vector3 &v) const {
+        [[nodiscard]] constexpr real operator*(const Vector3 &v) const noexcept {
             return scalar_product(v);
         }
         
         // Addition
-        void operator+=(const Vector3 &v) {
+        constexpr void operator+=(const Vector3 &v) noexcept {
             x += v.x;
             y += v.y;
             z += v.z;
         };
         
-        Vector3 operator+(const Vector3 &v) const {
+        [[nodiscard]] constexpr Vector3 operator+(const Vector3 &v) const noexcept {
             return Vector3(
                 x + v.x,
                 y + v.y,
@@ -195,13 +246,13 @@ namespace Physics {
         };
         
         // Subtraction
-        void operator-=(const Vector3 &v) {
+        constexpr void operator-=(const Vector3 &v) noexcept {
             x -= v.x;
             y -= v.y;
             z -= v.z;
         };
         
-        Vector3 operator-(const Vector3 &v) const {
+        [[nodiscard]] constexpr Vector3 operator-(const Vector3 &v) const noexcept {
             return Vector3(
                 x - v.x,
                 y - v.y,
@@ -212,6 +263,92 @@ namespace Physics {
     
     
     
+    /**
+     * Shared table of damping classes
+     * Particles and bodies reference a class ID instead of a raw value
+     * so damping^duration is only evaluated once per class per step,
+     * by the DampingFactors of whichever world steps them
+     *
+     * Classes are never removed or moved, so reading one needs no lock
+     * and interning is safe from any thread. Once max_classes exist,
+     * new values share the class with the nearest damping
+     */
+    class DampingTable {
+    public:
+        typedef unsigned ClassID;
+        
+        /*
+         * Class 0 is always the default particle damping
+         */
+        constexpr static ClassID default_class = 0;
+        constexpr static real default_damping = 0.999;
+        constexpr static unsigned max_classes = 1024;
+    
+    protected:
+        /*
+         * Raw damping value per class, the first count are in use
+         */
+        real damping[max_classes];
+        std::atomic<unsigned> count{0};
+        
+        /*
+         * Value bits -> class, only touched under lock
+         */
+        std::mutex lock;
+        std::unordered_map<uint32_t, ClassID> classes;
+    
+    public:
+        DampingTable();
+        
+        /**
+         * Table shared by all particles and bodies
+         */
+        static DampingTable & global();
+        
+        /**
+         * Find the class with the given damping value or create one
+         */
+        ClassID intern(real d);
+        
+        /**
+         * Raw damping value of a class
+         */
+        real get_damping(ClassID id) const { return damping[id]; }
+        
+        /**
+         * Number of classes
+         */
+        unsigned size() const { return count.load(std::memory_order_acquire); }
+    };
+    
+    /**
+     * damping^duration for every class of the shared table, owned by
+     * one world so worlds stepping at different rates keep their own
+     */
+    class DampingFactors {
+    protected:
+        std::vector<real> factors;
+        real duration = 0;
+    
+    public:
+        /**
+         * Recompute every factor if duration changed, or just the classes
+         * interned since the last call. Call once per step before integrating
+         */
+        void update(real duration);
+        
+        /**
+         * Cached damping^duration, classes interned after update are
+         * evaluated on the spot
+         */
+        real operator[](DampingTable::ClassID id) const {
+            if (id < factors.size()) return factors[id];
+            return powf(DampingTable::global().get_damping(id), duration);
+        }
+    };
+    
+    
+    
     class Particle {
         /*
          * Info:
@@ -237,8 +374,9 @@ namespace Physics {
          * Factor to remove any inaccuracy in the integrator stage
          * range 0..1
          * Value of 0.999 for example will be enough to remove any excess energy
+         * Stored as a class in the shared DampingTable
          */
-        real damping = 0.999;
+        DampingTable::ClassID damping_class = DampingTable::default_class;
         
         /*
          * This solves two problems, ease calculation of (a = f/m) to instead (a = (im)*f),
@@ -252,44 +390,52 @@ namespace Physics {
          * Constructors
          */
         Particle(): position(Vector3(0,0,0)){}
-        Particle(Vector3 v): position(v) {}
+        Particle(const Vector3 &v): position(v) {}
         Particle(real x, real y, real z): position(Vector3(x, y, z)) {}
         
         /*
          * Getters / Setters
          */
-        Vector3 get_position() const { return position; }
-        Vector3 get_velocity() { return velocity; }
-        Vector3 get_acceleration() { return acceleration; }
-        Vector3 get_force() { return force_accumulator; }
-        real get_damping() { return damping; }
-        real get_mass() { return inverse_mass <= 0.0 ? 0.0 : 1.f/inverse_mass; }
-        real get_inverse_mass() { return inverse_mass; }
+        [[nodiscard]] const Vector3 & get_position() const noexcept { return position; }
+        [[nodiscard]] const Vector3 & get_velocity() const noexcept { return velocity; }
+        [[nodiscard]] const Vector3 & get_acceleration() const noexcept { return acceleration; }
+        [[nodiscard]] const Vector3 & get_force() const noexcept { return force_accumulator; }
+        [[nodiscard]] real get_damping() const { return DampingTable::global().get_damping(damping_class); }
+        [[nodiscard]] DampingTable::ClassID get_damping_class() const noexcept { return damping_class; }
+        [[nodiscard]] real get_mass() const noexcept { return inverse_mass <= 0.0 ? 0.0 : 1.f/inverse_mass; }
+        [[nodiscard]] real get_inverse_mass() const noexcept { return inverse_mass; }
         void set_mass(real mass);
-        void set_position(Vector3 v) { position = v; }
-        void set_velocity(Vector3 v) { velocity = v; }
-        void set_acceleration(Vector3 v) { acceleration = v; }
-        void set_damping(real d) { damping = d; }
+        void set_position(const Vector3 &v) noexcept { position = v; }
+        void set_velocity(const Vector3 &v) noexcept { velocity = v; }
+        void set_acceleration(const Vector3 &v) noexcept { acceleration = v; }
+        void set_damping(real d) { damping_class = DampingTable::global().intern(d); }
+        void set_damping_class(DampingTable::ClassID id) { damping_class = id; }
         
         /**
          * Summation of all forces equals resultant force
          */
-        void add_impulse(Vector3 v) { force_accumulator += v; }
+        void add_impulse(const Vector3 &v) noexcept { force_accumulator += v; }
         
         /**
          * Zero the force accumulator
          */
-        void clear_impulse() { force_accumulator = Vector3(); }
+        void clear_impulse() noexcept { force_accumulator = Vector3(); }
         
         /**
          * Zero everything
          */
-        void clear() { acceleration = Vector3(); velocity = Vector3(); position = Vector3(); }
+        void clear() noexcept { acceleration = Vector3(); velocity = Vector3(); position = Vector3(); }
         
         /**
          * Handle particles physics at
          */
         void integrate(real time);
+        
+        /**
+         * Same with damping^time already evaluated, as worlds do through
+         * their DampingFactors
+         */
+        void integrate(real time, real damping_factor);
     };
     
     
@@ -326,7 +472,7 @@ namespace Physics {
         /**
          * Print quaternion to console
          */
-        void print() {
+        void print() const {
             printf("%%{r: %f, i: %f, j: %f, k: %f}\n", r, i, j, k);
         }
         
@@ -334,7 +480,19 @@ namespace Physics {
          * Multiply all components by the magnitude
          * Component magnitude becomes 1
          */
-        void normalize() {
+        void normalize() noexcept {
+#ifdef PHYSICS_SIMD
+            __m128 q = _mm_loadu_ps(data);
+            __m128 d = SIMD::dot4(q, q);
+            
+            // Zero length quaternion falls back to no-rotation
+            if (_mm_cvtss_f32(d) < FLT_EPSILON) {
+                r = 1;
+                return;
+            }
+            
+            _mm_storeu_ps(data, _mm_mul_ps(q, SIMD::rsqrt(d)));
+#else
             real d = r*r+i*i+j*j+k*k;
 
             // Check for zero length quaternion, and use the no-rotation
@@ -349,6 +507,7 @@ namespace Physics {
             i *= d;
             j *= d;
             k *= d;
+#endif
         }
         
         /**
@@ -356,7 +515,17 @@ namespace Physics {
          * Rotate input by (this)
          * Add input to (this)
          */
-        void add_scaled_vector(Vector3 vector, real scale) {
+        void add_scaled_vector(const Vector3 &vector, real scale) noexcept {
+#ifdef PHYSICS_SIMD
+            // Pure quaternion (0, v * scale / 2), rotated by (this)
+            __m128 v = _mm_mul_ps(
+                SIMD::load3(&vector.x),
+                _mm_set1_ps(scale * ((real)0.5))
+            );
+            __m128 p = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 1, 0, 3));
+            __m128 q = _mm_loadu_ps(data);
+            _mm_storeu_ps(data, _mm_add_ps(q, SIMD::quaternion_product(p, q)));
+#else
             Quaternion q(
                 0,
                 vector.x * scale,
@@ -369,9 +538,10 @@ namespace Physics {
             i += q.i * ((real)0.5);
             j += q.j * ((real)0.5);
             k += q.k * ((real)0.5);
+#endif
         }
 
-        void rotate_by_vector(Vector3& vector) {
+        void rotate_by_vector(const Vector3& vector) noexcept {
             Quaternion q(0, vector.x, vector.y, vector.z);
             (*this) *= q;
         }
@@ -379,8 +549,14 @@ namespace Physics {
         /**
          * Operators
          */
-        void operator *=(Quaternion &multiplier)
+        void operator *=(const Quaternion &multiplier) noexcept
         {
+#ifdef PHYSICS_SIMD
+            _mm_storeu_ps(data, SIMD::quaternion_product(
+                _mm_loadu_ps(data),
+                _mm_loadu_ps(multiplier.data)
+            ));
+#else
             Quaternion q = *this;
             
             r = (
@@ -402,9 +578,45 @@ namespace Physics {
                 q.r*multiplier.k + q.k*multiplier.r
                 + q.i*multiplier.j - q.j*multiplier.i
             );
+#endif
         }
     };
     
+    /**
+     * Batched orientation update for count bodies
+     * Same as add_scaled_vector(rotations[n], duration) then normalize()
+     * on each orientation, four orientations per pass
+     */
+    void integrate_orientations(
+        Quaternion * orientations,
+        const Vector3 * rotations,
+        unsigned count,
+        real duration
+    );
+    
+    /**
+     * Batched Vector3::within against one point
+     * Writes the index of every point strictly inside radius of center
+     * to out_indices in order, returns how many were written
+     */
+    unsigned points_within(
+        const Vector3 * points,
+        unsigned count,
+        const Vector3 &center,
+        real radius,
+        unsigned * out_indices
+    );
+    
+    /**
+     * out[n] = a[n].distance(b[n]), square roots four at a time
+     */
+    void distances(
+        const Vector3 * a,
+        const Vector3 * b,
+        real * out,
+        unsigned count
+    );
+    
     
     
     /**
@@ -425,7 +637,7 @@ namespace Physics {
             data[6] = data[7] = data[8] = 0;
         }
         
-        Matrix3(Matrix3 * m) {
+        Matrix3(const Matrix3 * m) {
             for (unsigned i = 0; i < 9; ++i) data[i] = m->data[i];
         }
     
@@ -439,7 +651,7 @@ namespace Physics {
             data[6] = c6; data[7] = c7; data[8] = c8;
         }
         
-        Matrix3 operator*(Matrix3 &o)
+        [[nodiscard]] Matrix3 operator*(const Matrix3 &o) const noexcept
         {
             return Matrix3(
                 data[0]*o.data[0] + data[1]*o.data[3] + data[2]*o.data[6],
@@ -456,7 +668,11 @@ namespace Physics {
             );
         }
         
-        static Matrix3 linear_interpolate(Matrix3 &a, Matrix3 &b, real prop) {
+        [[nodiscard]] static Matrix3 linear_interpolate(
+            const Matrix3 &a,
+            const Matrix3 &b,
+            real prop
+        ) noexcept {
             Matrix3 result;
             
             for (unsigned i = 0; i < 9; ++i) {
@@ -466,15 +682,42 @@ namespace Physics {
             return result;
         }
     
-        Vector3 operator*(Vector3 &v) {
+        [[nodiscard]] Vector3 operator*(const Vector3 &v) const noexcept {
+#ifdef PHYSICS_SIMD
+            // Columns scaled by each component
+            Vector3 result;
+            SIMD::store3(&result.x, SIMD::combine(
+                _mm_setr_ps(data[0], data[3], data[6], 0),
+                _mm_setr_ps(data[1], data[4], data[7], 0),
+                _mm_setr_ps(data[2], data[5], data[8], 0),
+                SIMD::load3(&v.x)
+            ));
+            return result;
+#else
             return Vector3(
                 v.x * data[0] + v.y * data[1] + v.z * data[2],
                 v.x * data[3] + v.y * data[4] + v.z * data[5],
                 v.x * data[6] + v.y * data[7] + v.z * data[8]
             );
+#endif
         }
         
-        void set_inverse(Matrix3 &m) {
+        /**
+         * Batch transform, out[i] = (*this) * in[i]
+         */
+        void transform(const Vector3 * in, Vector3 * out, unsigned count) const;
+        
+        /**
+         * Batch transform of N vectors by N matrices, out[i] = m[i] * in[i]
+         */
+        static void transform_each(
+            const Matrix3 * m,
+            const Vector3 * in,
+            Vector3 * out,
+            unsigned count
+        );
+        
+        void set_inverse(const Matrix3 &m) noexcept {
             // Calculate the determinant
             real t16 = (
                   m.data[0]*m.data[4]*m.data[8] - m.data[0]*m.data[5]*m.data[7]
@@ -497,13 +740,13 @@ namespace Physics {
             data[8] =  (m.data[0]*m.data[4]-m.data[1]*m.data[3])*t17;
         }
         
-        Matrix3 inverse() {
+        [[nodiscard]] Matrix3 inverse() const noexcept {
             Matrix3 result;
             result.set_inverse(*this);
             return result;
         }
         
-        void set_transpose(Matrix3 &m) {
+        void set_transpose(const Matrix3 &m) noexcept {
             data[0] = m.data[0];
             data[1] = m.data[3];
             data[2] = m.data[6];
@@ -515,7 +758,7 @@ namespace Physics {
             data[8] = m.data[8];
         }
         
-        void set_orientation(Quaternion &q) {
+        void set_orientation(const Quaternion &q) noexcept {
             data[0] = 1 - (2*q.j*q.j + 2*q.k*q.k);
             data[1] = 2*q.i*q.j + 2*q.k*q.r;
             data[2] = 2*q.i*q.k - 2*q.j*q.r;
@@ -530,7 +773,7 @@ namespace Physics {
         void set_inertia_tensor_coeffs(
             real ix, real iy, real iz,
             real ixy=0, real ixz=0, real iyz=0
-        ) {
+        ) noexcept {
             data[0] = ix;
             data[1] = data[3] = -ixy;
             data[2] = data[6] = -ixz;
@@ -539,7 +782,7 @@ namespace Physics {
             data[8] = iz;
         }
         
-        void set_block_inertia_tensor(Vector3 &halfSizes, real mass) {
+        void set_block_inertia_tensor(const Vector3 &halfSizes, real mass) noexcept {
             Vector3 squares = halfSizes.component_product(halfSizes);
             set_inertia_tensor_coeffs(
                 0.3f*mass*(squares.y + squares.z),
@@ -548,13 +791,13 @@ namespace Physics {
             );
         }
 
-        Matrix3 transpose() {
+        [[nodiscard]] Matrix3 transpose() const noexcept {
             Matrix3 result;
             result.set_transpose(*this);
             return result;
         }
         
-        Vector3 transform(Vector3 &v) {
+        [[nodiscard]] Vector3 transform(const Vector3 &v) const noexcept {
             return (*this) * v;
         }
     };
@@ -576,15 +819,21 @@ namespace Physics {
         real padding[4];
         
     public:
-        Vector3 operator*(Vector3 &v) {
+        [[nodiscard]] Vector3 operator*(const Vector3 &v) const noexcept {
+#ifdef PHYSICS_SIMD
+            Vector3 result;
+            SIMD::store3(&result.x, rows_dot(SIMD::load_point(&v.x)));
+            return result;
+#else
             return Vector3(
                 v.x * data[0] + v.y * data[1] + v.z * data[ 2] + data[ 3],
                 v.x * data[4] + v.y * data[5] + v.z * data[ 6] + data[ 7],
                 v.x * data[8] + v.y * data[9] + v.z * data[10] + data[11]
             );
+#endif
         }
         
-        Matrix4 operator*(const Matrix4 &o) const
+        [[nodiscard]] Matrix4 operator*(const Matrix4 &o) const noexcept
         {
             Matrix4 result;
             result.data[ 0] = (o.data[0]*data[0]) + (o.data[4]*data[1]) + (o.data[ 8]*data[ 2]);
@@ -606,7 +855,7 @@ namespace Physics {
             return result;
         }
         
-        real get_determinant() {
+        [[nodiscard]] real get_determinant() const noexcept {
             return (
                 - data[8]*data[5]*data[ 2]
                 + data[4]*data[9]*data[ 2]
@@ -617,7 +866,7 @@ namespace Physics {
             );
         }
         
-        void set_inverse(Matrix4 &m) {
+        void set_inverse(const Matrix4 &m) noexcept {
             // Make sure the determinant is non-zero.
             real det = get_determinant();
             if (det == 0) return;
@@ -663,7 +912,7 @@ namespace Physics {
             ) * det;
         }
         
-        void set_orientation_and_pos(const Quaternion &q, const Vector3 &pos) {
+        void set_orientation_and_pos(const Quaternion &q, const Vector3 &pos) noexcept {
             data[0] = 1 - (2*q.j*q.j + 2*q.k*q.k);
             data[1] = 2*q.i*q.j + 2*q.k*q.r;
             data[2] = 2*q.i*q.k - 2*q.j*q.r;
@@ -680,7 +929,22 @@ namespace Physics {
             data[11] = pos.z;
         }
         
-        Vector3 transform_inverse(Vector3 &vector) {
+        [[nodiscard]] Vector3 transform_inverse(const Vector3 &vector) const noexcept {
+#ifdef PHYSICS_SIMD
+            // Rows of the rotation are the columns of its inverse
+            __m128 tmp = _mm_sub_ps(
+                SIMD::load3(&vector.x),
+                _mm_setr_ps(data[3], data[7], data[11], 0)
+            );
+            Vector3 result;
+            SIMD::store3(&result.x, SIMD::combine(
+                _mm_loadu_ps(data),
+                _mm_loadu_ps(data + 4),
+                _mm_loadu_ps(data + 8),
+                tmp
+            ));
+            return result;
+#else
             Vector3 tmp = vector;
             tmp.x -= data[3];
             tmp.y -= data[7];
@@ -698,9 +962,15 @@ namespace Physics {
                 + tmp.y * data[6]
                 + tmp.z * data[10]
             );
+#endif
         }
         
-        Vector3 transform_direction(Vector3 &vector) {
+        [[nodiscard]] Vector3 transform_direction(const Vector3 &vector) const noexcept {
+#ifdef PHYSICS_SIMD
+            Vector3 result;
+            SIMD::store3(&result.x, rows_dot(SIMD::load3(&vector.x)));
+            return result;
+#else
             return Vector3(
                 vector.x * data[0] +
                 vector.y * data[1] +
@@ -714,9 +984,20 @@ namespace Physics {
                 vector.y * data[9] +
                 vector.z * data[10]
             );
+#endif
         }
         
-        Vector3 transform_inverse_direction(Vector3 &vector) {
+        [[nodiscard]] Vector3 transform_inverse_direction(const Vector3 &vector) const noexcept {
+#ifdef PHYSICS_SIMD
+            Vector3 result;
+            SIMD::store3(&result.x, SIMD::combine(
+                _mm_loadu_ps(data),
+                _mm_loadu_ps(data + 4),
+                _mm_loadu_ps(data + 8),
+                SIMD::load3(&vector.x)
+            ));
+            return result;
+#else
             return Vector3(
                 vector.x * data[0] +
                 vector.y * data[4] +
@@ -730,9 +1011,35 @@ namespace Physics {
                 vector.y * data[6] +
                 vector.z * data[10]
             );
+#endif
         }
         
-        void fill_GL_array(float array[16]) {
+        /**
+         * Batch versions of the transforms above
+         * One matrix applied to count points or directions
+         */
+        void transform(const Vector3 * in, Vector3 * out, unsigned count) const;
+        void transform_direction(const Vector3 * in, Vector3 * out, unsigned count) const;
+        void transform_inverse(const Vector3 * in, Vector3 * out, unsigned count) const;
+        void transform_inverse_direction(const Vector3 * in, Vector3 * out, unsigned count) const;
+        
+        /**
+         * Batch transform of N points or directions by N matrices
+         */
+        static void transform_each(
+            const Matrix4 * m,
+            const Vector3 * in,
+            Vector3 * out,
+            unsigned count
+        );
+        static void transform_direction_each(
+            const Matrix4 * m,
+            const Vector3 * in,
+            Vector3 * out,
+            unsigned count
+        );
+        
+        void fill_GL_array(float array[16]) const noexcept {
             array[0] = (float)data[0];
             array[1] = (float)data[4];
             array[2] = (float)data[8];
@@ -754,7 +1061,7 @@ namespace Physics {
             array[15] = (float)1;
         }
         
-        void print() {
+        void print() const {
             printf(
                 "-                     -\n"
                 "| %.2f %.2f %.2f %.2f |\n"
@@ -769,7 +1076,7 @@ namespace Physics {
             );
         }
         
-        void print_gl() {
+        void print_gl() const {
             float datagl[16];
             fill_GL_array(datagl);
             printf(
@@ -786,21 +1093,36 @@ namespace Physics {
             );
         }
         
-        static Vector3 world_to_local(Vector3 &world, Matrix4 transform) {
+        [[nodiscard]] static Vector3 world_to_local(const Vector3 &world, const Matrix4 &transform) {
             return transform.transform_inverse(world);
         }
         
-        static Vector3 local_to_world_direction(Vector3 &local, Matrix4 &transform) {
+        [[nodiscard]] static Vector3 local_to_world_direction(const Vector3 &local, const Matrix4 &transform) {
             return transform.transform_direction(local);
         }
         
-        static Vector3 world_to_local_direction(Vector3 &world, Matrix4 &transform) {
+        [[nodiscard]] static Vector3 world_to_local_direction(const Vector3 &world, const Matrix4 &transform) {
             return transform.transform_inverse_direction(world);
         }
         
-        Vector3 transform(Vector3 &v) {
+        [[nodiscard]] Vector3 transform(const Vector3 &v) const noexcept {
             return (*this) * v;
         }
+        
+#ifdef PHYSICS_SIMD
+    private:
+        /**
+         * Dot each of the three rows with v, lanes (row0, row1, row2, 0)
+         */
+        __m128 rows_dot(__m128 v) const noexcept {
+            __m128 r0 = _mm_mul_ps(_mm_loadu_ps(data), v);
+            __m128 r1 = _mm_mul_ps(_mm_loadu_ps(data + 4), v);
+            __m128 r2 = _mm_mul_ps(_mm_loadu_ps(data + 8), v);
+            __m128 r3 = _mm_setzero_ps();
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+            return _mm_add_ps(_mm_add_ps(r0, r1), _mm_add_ps(r2, r3));
+        }
+#endif
     };
     
     
@@ -811,8 +1133,8 @@ namespace Physics {
     class RigidBody {
     protected:
         real inverse_mass;
-        real linear_damping;
-        real angular_damping;
+        DampingTable::ClassID linear_damping = DampingTable::default_class;
+        DampingTable::ClassID angular_damping = DampingTable::default_class;
         
         Quaternion orientation;
         
@@ -837,58 +1159,102 @@ namespace Physics {
             else inverse_mass = 1.0 / mass;
         }
         void set_damping(real linear, real angular) {
+            linear_damping = DampingTable::global().intern(linear);
+            angular_damping = DampingTable::global().intern(angular);
+        }
+        void set_damping_classes(
+            DampingTable::ClassID linear,
+            DampingTable::ClassID angular
+        ) {
             linear_damping = linear;
             angular_damping = angular;
         }
-        void set_acceleration(Vector3 acc) { acceleration = acc; }
-        void set_velocity(Vector3 vel) { velocity = vel; }
-        void set_position(Vector3 pos) { position = pos; }
-        void set_rotation(Vector3 r) { rotation = r; }
-        void set_orientation(Quaternion o) { orientation = o; }
+        void set_acceleration(const Vector3 &acc) noexcept { acceleration = acc; }
+        void set_velocity(const Vector3 &vel) noexcept { velocity = vel; }
+        void set_position(const Vector3 &pos) noexcept { position = pos; }
+        void set_rotation(const Vector3 &r) noexcept { rotation = r; }
+        void set_orientation(const Quaternion &o) noexcept { orientation = o; }
         void set_awake(bool a) { is_awake = a; }
         void set_can_sleep(bool cs) { can_sleep = cs; if (!can_sleep && !is_awake) set_awake(true); }
-        bool has_finite_mass() { return inverse_mass > 0; }
-        real get_mass() { return inverse_mass > 0 ? 1.f/inverse_mass : 0; }
-        Vector3 get_position() { return position; }
-        Vector3 get_velocity() { return velocity; }
-        Vector3 get_acceleration() { return acceleration; }
-        Matrix4 get_transform() { return transform_matrix; }
-        Quaternion get_orientation() { return orientation; }
+        [[nodiscard]] bool has_finite_mass() const noexcept { return inverse_mass > 0; }
+        [[nodiscard]] real get_mass() const noexcept { return inverse_mass > 0 ? 1.f/inverse_mass : 0; }
+        [[nodiscard]] const Vector3 & get_position() const noexcept { return position; }
+        [[nodiscard]] const Vector3 & get_velocity() const noexcept { return velocity; }
+        [[nodiscard]] const Vector3 & get_acceleration() const noexcept { return acceleration; }
+        [[nodiscard]] const Vector3 & get_rotation() const noexcept { return rotation; }
+        [[nodiscard]] const Matrix4 & get_transform() const noexcept { return transform_matrix; }
+        [[nodiscard]] const Quaternion & get_orientation() const noexcept { return orientation; }
+        [[nodiscard]] DampingTable::ClassID get_linear_damping_class() const noexcept { return linear_damping; }
+        [[nodiscard]] DampingTable::ClassID get_angular_damping_class() const noexcept { return angular_damping; }
         
         void calculate_derived_data();
         
-        Vector3 get_point_in_local_space(Vector3 &point) {
+        /**
+         * calculate_derived_data for an orientation already normalized
+         */
+        void calculate_transforms();
+        
+        [[nodiscard]] Vector3 get_point_in_local_space(const Vector3 &point) const noexcept {
             return transform_matrix.transform_inverse(point);
         }
         
-        Vector3 get_point_in_world_space(Vector3 &point) {
+        [[nodiscard]] Vector3 get_point_in_world_space(const Vector3 &point) const noexcept {
             return transform_matrix.transform(point);
         }
         
-        Vector3 get_direction_in_local_space(Vector3 &direction) {
+        [[nodiscard]] Vector3 get_direction_in_local_space(const Vector3 &direction) const noexcept {
             return transform_matrix.transform_inverse_direction(direction);
         }
         
-        Vector3 get_direction_in_world_space(Vector3 &direction) {
+        [[nodiscard]] Vector3 get_direction_in_world_space(const Vector3 &direction) const noexcept {
             return transform_matrix.transform_direction(direction);
         }
         
-        void set_inertia_tensor(Matrix3 &inertia_tensor) {
+        void set_inertia_tensor(const Matrix3 &inertia_tensor) noexcept {
             inverse_inertia_tensor.set_inverse(inertia_tensor);
         }
         
-        void add_force(Vector3 &force) {
+        void add_force(const Vector3 &force) noexcept {
             force_accumulator += force;
             is_awake = true;
         }
         
-        void clear_accumulator() {
+        void clear_accumulator() noexcept {
             force_accumulator = Vector3();
             torque_accumulator = Vector3();
         }
         
         // Breakpoints don't work if this function is named integrate...????
         void intergrate(real duration) {
+            const DampingTable &table = DampingTable::global();
+            intergrate(
+                duration,
+                powf(table.get_damping(linear_damping), duration),
+                powf(table.get_damping(angular_damping), duration)
+            );
+        }
+        
+        /**
+         * Same with damping^duration of both classes already evaluated
+         */
+        void intergrate(real duration, real linear_factor, real angular_factor) {
+            integrate_motion(duration, linear_factor, angular_factor);
+            
+            // Update angular positions
+            orientation.add_scaled_vector(rotation, duration);
+            
+            // Normalize orientation
+            calculate_derived_data();
+            
+            clear_accumulator();
+        }
+        
+        /**
+         * Velocities, drag and position for one step, orientation and
+         * derived data are left to the caller so World::integrate can
+         * update every orientation in one batch
+         */
+        void integrate_motion(real duration, real linear_factor, real angular_factor) {
             // Calculate linear acceleration
             last_frame_accerlation = acceleration;
             last_frame_accerlation.scale_vector_and_add(force_accumulator, inverse_mass);
@@ -904,45 +1270,31 @@ namespace Physics {
             rotation.scale_vector_and_add(angular_acceleration, duration);
             
             // Calculate drag
-            velocity *= powf(linear_damping, duration);
-            rotation *= powf(angular_damping, duration);
+            velocity *= linear_factor;
+            rotation *= angular_factor;
             
             // Update positions
             position.scale_vector_and_add(velocity, duration);
-                        
-            // Update angular positions
-            orientation.add_scaled_vector(rotation, duration);
-            
-            // Normalize orientation
-            calculate_derived_data();
-            
-            clear_accumulator();
         }
         
         void add_force_at_point(
-            Vector3 &force,
-            Vector3 &point
-        ) {
-            Vector3 point_copy = point;
-            point_copy -= position;
-            
+            const Vector3 &force,
+            const Vector3 &point
+        ) noexcept {
             force_accumulator += force;
-            torque_accumulator += point_copy.vector_product(force);
+            torque_accumulator += (point - position).vector_product(force);
             
             is_awake = true;
         }
         
         void add_force_at_body_point(
-            Vector3 &force,
-            Vector3 &point
-        ) {
-            Vector3 piws = get_point_in_world_space(point);
-            add_force_at_point(force, piws);
-            
-            is_awake = true;
+            const Vector3 &force,
+            const Vector3 &point
+        ) noexcept {
+            add_force_at_point(force, get_point_in_world_space(point));
         }
         
-        void get_gl_transform(float matrix[16]) {
+        void get_gl_transform(float matrix[16]) const noexcept {
             matrix[0] = (float)transform_matrix.data[0];
             matrix[1] = (float)transform_matrix.data[4];
             matrix[2] = (float)transform_matrix.data[8];
@@ -979,16 +1331,16 @@ namespace Physics {
         
         AngleAxis() : x(0), y(0), z(0), angle(0) {}
         AngleAxis(real angle, real x, real y, real z) : x(x), y(y), z(z), angle(angle) {}
-        AngleAxis(Quaternion &q) { from_quaternion(q); }
+        AngleAxis(const Quaternion &q) { from_quaternion(q); }
         
-        void from_quaternion(Quaternion &q) {
+        void from_quaternion(const Quaternion &q) noexcept {
             angle = 2 * acosf(q.w);
             x = q.x / sqrtf(1 - q.w * q.w);
             y = q.y / sqrtf(1 - q.w * q.w);
             z = q.z / sqrtf(1 - q.w * q.w);
         }
         
-        void print() {
+        void print() const {
             printf("%%{angle: %f, x: %f, y: %f, z: %f}\n", angle, x, y, z);
         }
     };
@@ -4,52 +4,277 @@
 //
 
 #include "engine.h"
+#include "behavior.h"
+#include <atomic>
+#include <algorithm>
 
 namespace Physics {
     ParticleWorld::ParticleWorld(
         unsigned max_contacts,
         unsigned iterations
     ) : resolver(iterations),
-        max_contacts(max_contacts)
+        max_contacts(max_contacts),
+        behaviors(new BehaviorScheduler())
     {
+        MemoryScope scope(MEMORY_CONTACTS);
         contacts = new ParticleContact[max_contacts];
         calculate_iterations = (iterations == 0);
+        
+        const TaskGraph::ComponentSet positions = TaskGraph::component(POSITIONS);
+        const TaskGraph::ComponentSet velocities = TaskGraph::component(VELOCITIES);
+        const TaskGraph::ComponentSet forces = TaskGraph::component(FORCES);
+        const TaskGraph::ComponentSet contact_list = TaskGraph::component(CONTACTS);
+        
+        stages.add_stage("forces", positions | velocities, forces, [this]() {
+            MemoryScope scope(MEMORY_REGISTRY);
+            registry.update_forces(step_duration, jobs);
+        });
+        stages.add_stage("integrate", forces, positions | velocities | forces, [this]() {
+            integrate(step_duration);
+        });
+        stages.add_stage("contacts", positions, contact_list, [this]() {
+            MemoryScope scope(MEMORY_CONTACTS);
+            used_contacts = generate_contacts();
+            behaviors->match_contacts(contacts, used_contacts);
+        });
+        stages.add_stage("resolve", contact_list, positions | velocities, [this]() {
+            MemoryScope scope(MEMORY_CONTACTS);
+            if (contact_cache) contact_cache->begin_step(contacts, used_contacts);
+            
+            if (used_contacts) {
+                if (calculate_iterations) resolver.set_iterations(used_contacts * 2);
+                resolver.resolve_contacts(contacts, used_contacts, step_duration);
+            }
+            
+            // Runs on an empty step too so the last contacts end
+            if (contact_cache) contact_cache->end_step(contacts, used_contacts);
+        });
     }
     
     ParticleWorld::~ParticleWorld() {
         delete [] contacts;
     }
 
+    void ParticleWorld::grow_contacts(unsigned capacity, unsigned keep) {
+        if (capacity <= max_contacts) return;
+        
+        MemoryScope scope(MEMORY_CONTACTS);
+        ParticleContact * grown = new ParticleContact[capacity];
+        std::copy(contacts, contacts + keep, grown);
+        delete [] contacts;
+        contacts = grown;
+        max_contacts = capacity;
+    }
+    
     unsigned ParticleWorld::generate_contacts() {
-        unsigned limit = max_contacts;
-        ParticleContact * next_contact = contacts;
+        contacts_overflowed = false;
+        if (jobs) return generate_contacts_parallel();
+        
+        unsigned used_total = 0;
+        unsigned retries = 0;
         
         ContactGenerators::iterator g = contact_generators.begin();
-        for (; g != contact_generators.end(); ++g) {
-            unsigned used = (*g)->add_contact(next_contact, limit);
-            limit -= used;
-            next_contact += used;
-            if (limit <= 0) break;
+        while (g != contact_generators.end()) {
+            const unsigned limit = max_contacts - used_total;
+            
+            // With no room a generator can't say whether it had anything
+            const unsigned used = limit ? (*g)->add_contact(contacts + used_total, limit) : 0;
+            const bool full = !limit || (*g)->was_truncated();
+            
+            // Generators rewrite the same contacts when run again
+            if (full && growable_contacts && retries < max_contact_retries) {
+                grow_contacts(max_contacts ? max_contacts * 2 : 16, used_total);
+                ++retries;
+                continue;
+            }
+            
+            if (full) contacts_overflowed = true;
+            if (!limit) break;
+            
+            used_total += used;
+            retries = 0;
+            ++g;
         }
         
-        return max_contacts - limit;
+        return used_total;
+    }
+    
+    unsigned ParticleWorld::generate_contacts_parallel() {
+        const unsigned count = static_cast<unsigned>(contact_generators.size());
+        const unsigned chunks = chunk_count(count, generator_grain);
+        const unsigned workers = jobs->worker_count();
+        
+        if (worker_contacts.size() != workers) worker_contacts.resize(workers);
+        worker_used.assign(workers, 0);
+        contact_runs = arena.create_array<ContactRun>(chunks);
+        
+        std::atomic<unsigned> cursor{0};
+        std::atomic<bool> truncated{false};
+        
+        // Generate into worker scratch and reserve a range of contacts
+        jobs->parallel_for(count, generator_grain, [this, &cursor, &truncated](unsigned begin, unsigned end, unsigned chunk) {
+            const unsigned worker = jobs->current_worker();
+            ContactScratch &scratch = worker_contacts[worker];
+            unsigned &used = worker_used[worker];
+            const unsigned start = used;
+            
+            for (unsigned g = begin; g < end; ++g) {
+                if (scratch.size() - used < 16) scratch.resize(scratch.size() * 2 + 16);
+                
+                ParticleContactGenerator * generator = contact_generators[g];
+                unsigned added = generator->add_contact(&scratch[used], static_cast<unsigned>(scratch.size()) - used);
+                
+                // Scratch is always growable, rerun generators that ran out of it
+                for (unsigned retry = 0; generator->was_truncated() && retry < max_contact_retries; ++retry) {
+                    scratch.resize(scratch.size() * 2);
+                    added = generator->add_contact(&scratch[used], static_cast<unsigned>(scratch.size()) - used);
+                }
+                if (generator->was_truncated()) truncated = true;
+                used += added;
+            }
+            
+            const unsigned run = used - start;
+            const unsigned offset = deterministic ? 0 : cursor.fetch_add(run);
+            contact_runs[chunk] = ContactRun{worker, start, run, offset};
+        });
+        
+        // Deterministic layout is chunk order, i.e. generator order
+        if (deterministic) {
+            unsigned offset = 0;
+            for (unsigned c = 0; c < chunks; ++c) {
+                contact_runs[c].offset = offset;
+                offset += contact_runs[c].count;
+            }
+            cursor = offset;
+        }
+        
+        contacts_overflowed = truncated.load();
+        
+        unsigned total = cursor.load();
+        if (total > max_contacts) {
+            if (growable_contacts) {
+                grow_contacts(total, 0);
+            }
+            else {
+                contacts_overflowed = true;
+                total = max_contacts;
+            }
+        }
+        
+        // Copy every run into its reserved range, ranges past the end are dropped
+        jobs->parallel_for(chunks, 1, [this, total](unsigned begin, unsigned end, unsigned) {
+            for (unsigned c = begin; c < end; ++c) {
+                const ContactRun &run = contact_runs[c];
+                if (run.offset >= total) continue;
+                
+                const unsigned n = std::min(run.count, total - run.offset);
+                const ParticleContact * from = worker_contacts[run.worker].data() + run.begin;
+                std::copy(from, from + n, contacts + run.offset);
+            }
+        });
+        
+        return total;
     }
     
     void ParticleWorld::integrate(real duration) {
-        Particles::iterator p = particles->begin();
-        for (; p != particles->end(); ++p) {
-            (*p)->integrate(duration);
+        // Evaluate damping^duration once for every damping class
+        damping.update(duration);
+        
+        // Particles only touch their own state, the factors are read only now
+        Particles &ps = *particles;
+        const DampingFactors &factors = damping;
+        parallel_for(jobs, static_cast<unsigned>(ps.size()), particle_grain, [&ps, &factors, duration](unsigned begin, unsigned end, unsigned) {
+            for (unsigned i = begin; i < end; ++i) {
+                ps[i]->integrate(duration, factors[ps[i]->get_damping_class()]);
+            }
+        });
+    }
+    
+    void ParticleWorld::apply_command(const WorldCommand &command) {
+        Particle * p = command.particle;
+        
+        switch (command.type) {
+            case WorldCommand::SPAWN_PARTICLE:
+                particles->push_back(p);
+                if (command.force) registry.add(p, command.force);
+                break;
+            
+            case WorldCommand::REMOVE_PARTICLE: {
+                Particles::iterator found = std::find(particles->begin(), particles->end(), p);
+                if (found == particles->end()) break;
+                
+                // Swap the last particle into the hole, as Pool::destroy does,
+                // index based generators remap the one that moved
+                const unsigned index = static_cast<unsigned>(found - particles->begin());
+                *found = particles->back();
+                particles->pop_back();
+                registry.remove(p);
+                removing.push_back(p);
+                for (ParticleContactGenerator * generator : contact_generators) {
+                    generator->particle_removed(particles, index);
+                }
+                break;
+            }
+            
+            case WorldCommand::APPLY_IMPULSE:
+                p->set_velocity(p->get_velocity() + command.vector * p->get_inverse_mass());
+                break;
+            
+            case WorldCommand::SET_MASS:
+                p->set_mass(command.value);
+                break;
+            
+            case WorldCommand::SET_DAMPING:
+                p->set_damping(command.value);
+                break;
+            
+            case WorldCommand::SET_VELOCITY:
+                p->set_velocity(command.vector);
+                break;
+            
+            case WorldCommand::ADD_FORCE:
+                registry.add(p, command.force);
+                break;
+            
+            case WorldCommand::REMOVE_FORCE:
+                registry.remove(p, command.force);
+                break;
+            
+            case WorldCommand::ADD_CONTACTS:
+                contact_generators.push_back(command.contacts);
+                break;
+            
+            case WorldCommand::REMOVE_CONTACTS:
+                contact_generators.erase(
+                    std::remove(contact_generators.begin(), contact_generators.end(), command.contacts),
+                    contact_generators.end()
+                );
+                break;
         }
     }
     
+    unsigned ParticleWorld::apply_commands() {
+        return commands.drain([this](const WorldCommand &command) {
+            apply_command(command);
+        });
+    }
+    
     void ParticleWorld::run_physics(real duration){
-        registry.update_forces(duration);
-        integrate(duration);
-        unsigned used_contacts = generate_contacts();
-        if (used_contacts) {
-            if (calculate_iterations) resolver.set_iterations(used_contacts * 2);
-            resolver.resolve_contacts(contacts, used_contacts, duration);
-        }
+        const MemorySnapshot before = MemoryStats::snapshot();
+        arena.reset();
+        apply_commands();
+        behaviors->begin_step();
+        
+        step_duration = duration;
+        stages.run(jobs);
+        
+        behaviors->end_step();
+        
+        // The contact cache has dropped this step's removals by now
+        removed.insert(removed.end(), removing.begin(), removing.end());
+        removing.clear();
+        
+        if (MemoryStats::enabled) step_memory = MemoryStats::snapshot() - before;
     }
     
     
@@ -66,9 +291,31 @@ namespace Physics {
     }
     
     void World::integrate(real duration) {
-        RigidBodies::iterator b = bodies.begin();
-        for (; b != bodies.end(); ++b) {
-            b->intergrate(duration);
+        damping.update(duration);
+        
+        const unsigned count = static_cast<unsigned>(bodies.size());
+        orientations.resize(count);
+        rotations.resize(count);
+        
+        for (unsigned i = 0; i < count; ++i) {
+            RigidBody &b = bodies[i];
+            b.integrate_motion(
+                duration,
+                damping[b.get_linear_damping_class()],
+                damping[b.get_angular_damping_class()]
+            );
+            orientations[i] = b.get_orientation();
+            rotations[i] = b.get_rotation();
+        }
+        
+        // Add rotation and normalize, four bodies at a time
+        integrate_orientations(orientations.data(), rotations.data(), count, duration);
+        
+        for (unsigned i = 0; i < count; ++i) {
+            RigidBody &b = bodies[i];
+            b.set_orientation(orientations[i]);
+            b.calculate_transforms();
+            b.clear_accumulator();
         }
     }
     
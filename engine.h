@@ -9,8 +9,16 @@
 #include "core.h"
 #include "collision.h"
 #include "forces.h"
+#include "jobs.h"
+#include "taskgraph.h"
+#include "commands.h"
+#include "arena.h"
+#include "memstats.h"
+#include "contactcache.h"
 
 namespace Physics {
+    class BehaviorScheduler;
+    
     class ParticleWorld {
     public:
         typedef std::vector<Particle*> Particles;
@@ -22,9 +30,143 @@ namespace Physics {
         unsigned max_contacts;
         bool calculate_iterations;
         
+        /**
+         * Grow contacts instead of dropping what doesn't fit
+         */
+        bool growable_contacts = false;
+        
+        /**
+         * Pin contact order and force summation so results don't depend
+         * on the thread count, see set_deterministic
+         */
+        bool deterministic = false;
+        
+        /**
+         * Set by generate_contacts when contacts may have been dropped:
+         * a generator reported it was truncated, or max_contacts filled up
+         * with generators left to run
+         */
+        bool contacts_overflowed = false;
+        
+        /**
+         * Times one generator is rerun on a bigger buffer in a step
+         * before what it managed to write is kept as is
+         */
+        static constexpr unsigned max_contact_retries = 8;
+        
+        /**
+         * Items per parallel chunk for each stage
+         */
+        static constexpr unsigned particle_grain = 256;
+        static constexpr unsigned generator_grain = 64;
+        
+        /**
+         * Components the built in stages read and write,
+         * extra stages can use these and anything from USER_COMPONENT up
+         */
+        enum Component {
+            POSITIONS,
+            VELOCITIES,
+            FORCES,
+            CONTACTS,
+            USER_COMPONENT = 8
+        };
+        
+        /**
+         * Stages of one run_physics call, forces -> integrate -> contacts -> resolve
+         * Stages added here run in the same frame, in parallel with
+         * whatever they don't conflict with
+         */
+        TaskGraph stages;
+        
+        /**
+         * Scripted behaviors, resumed before and after the stages of every step
+         * Include behavior.h to spawn any
+         */
+        std::unique_ptr<BehaviorScheduler> behaviors;
+        
+        /**
+         * Changes submitted from any thread, applied in submission order
+         * at the start of the next step, before behaviors run
+         *
+         *     world.commands.push(WorldCommand::impulse(p, Vector3(0, 5, 0)));
+         */
+        CommandQueue<WorldCommand> commands;
+        
+        /**
+         * Scratch for data that only lives through one step, reset at the
+         * start of run_physics, nothing allocated here survives into the
+         * next step
+         * FrameArena isn't thread safe: the world's own stages and code on
+         * the stepping thread outside the stages (behaviors, commands) may
+         * draw from it. Generators and extra stages can run on workers
+         * alongside them and must not
+         */
+        FrameArena arena{4 * 1024, MEMORY_CONTACTS};
+        
+        /**
+         * Heap traffic of the last run_physics call by subsystem,
+         * all zero unless built with PHYSICS_MEMORY_STATS
+         */
+        MemorySnapshot step_memory;
+    
     protected:
         Particles * particles;
         
+        /*
+         * damping^duration of every class at this world's step duration
+         */
+        DampingFactors damping;
+        
+        /**
+         * Null runs every stage serially on the calling thread
+         */
+        JobSystem * jobs = nullptr;
+        
+        /**
+         * Null resolves every step's contacts from a cold start
+         */
+        ContactCache * contact_cache = nullptr;
+        
+        /**
+         * Contacts of one generator chunk, parked in its worker's scratch
+         * until offset is reserved for them in contacts
+         */
+        struct ContactRun {
+            unsigned worker;
+            unsigned begin;
+            unsigned count;
+            unsigned offset;
+        };
+        
+        typedef std::vector<ParticleContact, TaggedAllocator<ParticleContact, MEMORY_CONTACTS>> ContactScratch;
+        std::vector<ContactScratch> worker_contacts;
+        std::vector<unsigned> worker_used;
+        ContactRun * contact_runs = nullptr;
+        
+        /**
+         * Reallocate contacts to hold at least capacity, keeping the first keep
+         */
+        void grow_contacts(unsigned capacity, unsigned keep);
+        
+        unsigned generate_contacts_parallel();
+        
+        void apply_command(const WorldCommand &command);
+        
+        /*
+         * Particles REMOVE_PARTICLE took out, removing until the step that
+         * applied it is over (the contact cache still knows them), removed
+         * once nothing in the world points at them
+         */
+        Particles removing;
+        Particles removed;
+        
+        /*
+         * Inputs and outputs of the stages for the current step
+         */
+        real step_duration = 0;
+        unsigned used_contacts = 0;
+    
     public:
         ParticleWorld(
             unsigned max_contacts,
@@ -37,8 +179,52 @@ namespace Physics {
         unsigned generate_contacts();
         void integrate(real duration);
         void run_physics(real duration);
+        
+        /**
+         * Apply every queued command, run_physics calls this first thing
+         * Returns the number applied
+         */
+        unsigned apply_commands();
+        
+        /**
+         * Move every removed particle nothing in the world points at any
+         * more into out, the point to destroy them in their pool
+         * A particle shows up here once the run_physics that applied (or
+         * followed) its REMOVE_PARTICLE has returned
+         */
+        void take_removed(Particles &out) {
+            out.swap(removed);
+            removed.clear();
+        }
+        
         void pass_particles(Particles * p) { particles = p; }
+        Particles * get_particles() const { return particles; }
+        
+        /**
+         * Run forces, integration and contact generation on a job system
+         * The world doesn't own it, pass nullptr to go back to serial
+         */
+        void set_job_system(JobSystem * j) { jobs = j; }
+        JobSystem * get_job_system() const { return jobs; }
+        
+        /**
+         * Carry contacts and their impulses across steps, warm starting
+         * the resolver. The world doesn't own it, nullptr turns it off
+         */
+        void set_contact_cache(ContactCache * c) { contact_cache = c; }
+        ContactCache * get_contact_cache() const { return contact_cache; }
         
+        /**
+         * Deterministic mode, bit identical steps on any number of threads
+         * - forces are summed per particle in registration order, onto
+         *   whatever was accumulated before the force stage
+         * - contacts are laid out by (generator, emission) order, the serial
+         *   order, so the resolver scans and breaks ties the same way
+         * - chunk boundaries only depend on the grains
+         */
+        void set_deterministic(bool d) { deterministic = d; registry.set_deterministic(d); }
+        bool is_deterministic() const { return deterministic; }
+    
     };
     
     
@@ -49,11 +235,22 @@ namespace Physics {
         
     protected:
         RigidBodies bodies;
+        DampingFactors damping;
         
+        /*
+         * Orientation and angular velocity of every body, staged for
+         * integrate_orientations
+         */
+        std::vector<Quaternion> orientations;
+        std::vector<Vector3> rotations;
+    
     public:
         void start_frame();
         void run_physics(real duration);
         void integrate(real duration);
+        
+        RigidBodies & get_bodies() { return bodies; }
+        const RigidBodies & get_bodies() const { return bodies; }
     };
 }
 
@@ -10,9 +10,14 @@
 #include "physics.h"
 #include <math.h>
 #include <assert.h>
+#include <vector>
 
 namespace Physics {
+    class AeroGroup;
+    
     class Aero : public ForceGenerator {
+        friend class AeroGroup;
+    
     protected:
         Matrix3 tensor;
         Vector3 position;
@@ -29,22 +34,25 @@ namespace Physics {
             update_force_from_tensor(body, duration, tensor);
         }
         
+        /**
+         * Tensor in effect for the current control setting
+         */
+        virtual Matrix3 get_current_tensor() { return tensor; }
+    
     protected:
         void update_force_from_tensor(
             RigidBody * body,
             real duration,
-            Matrix3 &tensor
+            const Matrix3 &tensor
         ) {
             Vector3 velocity = body->get_velocity();
             velocity += *windspeed;
             
-            Vector3 body_velo =
-                body->get_transform().transform_inverse_direction(velocity);
+            const Matrix4 &transform = body->get_transform();
+            const Vector3 body_velo = transform.transform_inverse_direction(velocity);
+            const Vector3 force = transform.transform_direction(tensor.transform(body_velo));
             
-            Vector3 body_force = tensor.transform(body_velo);
-            Vector3 force = body->get_transform().transform_direction(body_force);
-            
-            body->add_force_at_body_point(force, position);
+            body->add_force_at_point(force, transform.transform(position));
         }
     };
     
@@ -82,8 +90,59 @@ namespace Physics {
         void set_control(real value) { control_setting = value; }
         
         virtual void update_force(RigidBody * body, real duration) {
-            Matrix3 tensor = get_tensor();
-            Aero::update_force_from_tensor(body, duration, tensor);
+            Aero::update_force_from_tensor(body, duration, get_tensor());
+        }
+        
+        virtual Matrix3 get_current_tensor() { return get_tensor(); }
+    };
+    
+    
+    /**
+     * Set of aero surfaces on one body evaluated as a batch
+     * Each stage of the tensor calculation runs over all surfaces at once
+     */
+    class AeroGroup : public ForceGenerator {
+        std::vector<Aero *> surfaces;
+        
+        /*
+         * Per surface scratch, kept between steps to avoid reallocating
+         */
+        std::vector<Matrix3> tensors;
+        std::vector<Vector3> velocities;
+        std::vector<Vector3> forces;
+        std::vector<Vector3> points;
+    
+    public:
+        void add(Aero * surface) {
+            surfaces.push_back(surface);
+            tensors.resize(surfaces.size());
+            velocities.resize(surfaces.size());
+            forces.resize(surfaces.size());
+            points.resize(surfaces.size());
+        }
+        
+        virtual void update_force(RigidBody * body, real duration) {
+            unsigned count = (unsigned)surfaces.size();
+            if (count == 0) return;
+            
+            const Matrix4 transform = body->get_transform();
+            const Vector3 velocity = body->get_velocity();
+            
+            for (unsigned i = 0; i < count; ++i) {
+                tensors[i] = surfaces[i]->get_current_tensor();
+                velocities[i] = velocity + *surfaces[i]->windspeed;
+                points[i] = surfaces[i]->position;
+            }
+            
+            // World velocity -> body velocity -> body force -> world force
+            transform.transform_inverse_direction(&velocities[0], &velocities[0], count);
+            Matrix3::transform_each(&tensors[0], &velocities[0], &forces[0], count);
+            transform.transform_direction(&forces[0], &forces[0], count);
+            transform.transform(&points[0], &points[0], count);
+            
+            for (unsigned i = 0; i < count; ++i) {
+                body->add_force_at_point(forces[i], points[i]);
+            }
         }
     };
     
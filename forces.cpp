@@ -9,33 +9,54 @@
 #include "forces.h"
 #include "core.h"
 #include <cmath>
+#include <unordered_map>
+#include <algorithm>
 
 namespace Physics {
     // Force Generator //
     /////////////////////
     
+    Vector3 ParticleForceGenerator::compute_force(const Particle * particle, real duration) {
+        Particle copy = *particle;
+        copy.clear_impulse();
+        update_force(&copy, duration);
+        return copy.get_force();
+    }
+    
     void ParticleForceRegistrar::add(
         Particle * particle,
         ParticleForceGenerator * fg
     ) {
         links.push_back(ParticleForceLink{particle, fg});
+        slots_dirty = true;
     }
     
     void ParticleForceRegistrar::remove(
         Particle * particle,
         ParticleForceGenerator * fg
     ) {
-        int i = 0;
-        for (ParticleForceLink pfl : links) {
-            if (pfl.particle == particle && pfl.fg == fg) {
-                links.erase(links.begin() + i);
-            }
-            ++i;
-        }
+        links.erase(
+            std::remove_if(links.begin(), links.end(), [particle, fg](const ParticleForceLink &pfl) {
+                return pfl.particle == particle && pfl.fg == fg;
+            }),
+            links.end()
+        );
+        slots_dirty = true;
+    }
+    
+    void ParticleForceRegistrar::remove(Particle * particle) {
+        links.erase(
+            std::remove_if(links.begin(), links.end(), [particle](const ParticleForceLink &pfl) {
+                return pfl.particle == particle;
+            }),
+            links.end()
+        );
+        slots_dirty = true;
     }
     
     void ParticleForceRegistrar::clear() {
         links.clear();
+        slots_dirty = true;
     }
     
     bool ParticleForceRegistrar::check_force_registered(
@@ -51,11 +72,121 @@ namespace Physics {
         return false;
     }
     
-    void ParticleForceRegistrar::update_forces(real duration) {
-        Registry::iterator i = links.begin();
-        for (; i != links.end(); ++i) {
-            i->fg->update_force(i->particle, duration);
+    void ParticleForceRegistrar::build_slots() {
+        std::unordered_map<Particle*, unsigned> ids;
+        
+        link_slots.resize(links.size());
+        slot_particles.clear();
+        for (unsigned i = 0; i < links.size(); ++i) {
+            auto found = ids.emplace(links[i].particle, static_cast<unsigned>(slot_particles.size()));
+            if (found.second) slot_particles.push_back(links[i].particle);
+            link_slots[i] = found.first->second;
+        }
+        
+        // Bucket links by slot, a counting sort keeps registration order
+        slot_link_starts.assign(slot_particles.size() + 1, 0);
+        for (unsigned slot : link_slots) ++slot_link_starts[slot + 1];
+        for (unsigned s = 0; s < slot_particles.size(); ++s) {
+            slot_link_starts[s + 1] += slot_link_starts[s];
+        }
+        
+        std::vector<unsigned> fill(slot_link_starts.begin(), slot_link_starts.end() - 1);
+        slot_links.resize(links.size());
+        for (unsigned i = 0; i < links.size(); ++i) {
+            slot_links[fill[link_slots[i]]++] = i;
+        }
+        
+        slots_dirty = false;
+    }
+    
+    void ParticleForceRegistrar::reduce_forces(JobSystem * jobs) {
+        const unsigned workers = static_cast<unsigned>(worker_forces.size());
+        const unsigned slots = static_cast<unsigned>(slot_particles.size());
+        
+        jobs->parallel_for(slots, slot_grain, [this, workers](unsigned begin, unsigned end, unsigned) {
+            for (unsigned s = begin; s < end; ++s) {
+#ifdef PHYSICS_SIMD
+                // Padding lanes are zero in every buffer so whole registers can be summed
+                __m128 sum = _mm_setzero_ps();
+                for (unsigned w = 0; w < workers; ++w) {
+                    float * f = &worker_forces[w][s].x;
+                    sum = _mm_add_ps(sum, _mm_loadu_ps(f));
+                    _mm_storeu_ps(f, _mm_setzero_ps());
+                }
+                Vector3 total;
+                SIMD::store3(&total.x, sum);
+#else
+                Vector3 total;
+                for (unsigned w = 0; w < workers; ++w) {
+                    total += worker_forces[w][s];
+                    worker_forces[w][s].clear();
+                }
+#endif
+                slot_particles[s]->add_impulse(total);
+            }
+        });
+    }
+    
+    void ParticleForceRegistrar::update_forces(real duration, JobSystem * jobs) {
+        if (!jobs) {
+            Registry::iterator i = links.begin();
+            for (; i != links.end(); ++i) {
+                i->fg->update_force(i->particle, duration);
+            }
+            return;
+        }
+        
+        if (slots_dirty) build_slots();
+        if (deterministic) {
+            update_forces_deterministic(duration, jobs);
+            return;
         }
+        
+        const unsigned workers = jobs->worker_count();
+        if (worker_forces.size() != workers) worker_forces.resize(workers);
+        for (WorkerForces &forces : worker_forces) {
+            if (forces.size() != slot_particles.size()) forces.assign(slot_particles.size(), Vector3());
+        }
+        
+        const unsigned count = static_cast<unsigned>(links.size());
+        jobs->parallel_for(count, link_grain, [this, jobs, duration](unsigned begin, unsigned end, unsigned) {
+            WorkerForces &forces = worker_forces[jobs->current_worker()];
+            
+            for (unsigned i = begin; i < end; ++i) {
+                const ParticleForceLink &link = links[i];
+                forces[link_slots[i]] += link.fg->compute_force(link.particle, duration);
+            }
+        });
+        
+        reduce_forces(jobs);
+    }
+    
+    void ParticleForceRegistrar::update_forces_deterministic(real duration, JobSystem * jobs) {
+        const unsigned count = static_cast<unsigned>(links.size());
+        link_forces.resize(count);
+        
+        // Each link owns its output, nothing depends on which worker ran it
+        jobs->parallel_for(count, link_grain, [this, duration](unsigned begin, unsigned end, unsigned) {
+            for (unsigned i = begin; i < end; ++i) {
+                const ParticleForceLink &link = links[i];
+                link_forces[i] = link.fg->compute_force(link.particle, duration);
+            }
+        });
+        
+        // Fixed order sums, same as the serial walk would add them, starting
+        // from whatever was already accumulated before the stage
+        const unsigned slots = static_cast<unsigned>(slot_particles.size());
+        jobs->parallel_for(slots, slot_grain, [this](unsigned begin, unsigned end, unsigned) {
+            for (unsigned s = begin; s < end; ++s) {
+                Particle * particle = slot_particles[s];
+                Vector3 total = particle->get_force();
+                for (unsigned k = slot_link_starts[s]; k < slot_link_starts[s + 1]; ++k) {
+                    total += link_forces[slot_links[k]];
+                }
+                particle->clear_impulse();
+                particle->add_impulse(total);
+            }
+        });
     }
     
     
@@ -64,10 +195,14 @@ namespace Physics {
     /////////////////////
     
     void ParticleGravity::update_force(Particle * particle, real duration) {
-        if (particle->get_mass() == 0) return;
+        particle->add_impulse(compute_force(particle, duration));
+    }
+    
+    Vector3 ParticleGravity::compute_force(const Particle * particle, real duration) {
+        if (particle->get_mass() == 0) return Vector3();
         
         // F = m * g
-        particle->add_impulse(gravity * particle->get_mass());
+        return gravity * particle->get_mass();
     }
     
     
@@ -76,6 +211,10 @@ namespace Physics {
     ////////////////////
     
     void ParticleSpring::update_force(Particle * particle, real duration) {
+        particle->add_impulse(compute_force(particle, duration));
+    }
+    
+    Vector3 ParticleSpring::compute_force(const Particle * particle, real duration) {
         // Calculate vector of spring
         Vector3 force = particle->get_position();
         force -= end->get_position();
@@ -88,7 +227,7 @@ namespace Physics {
         // Calculate final force
         force.normalize();
         force *= -magnitude;
-        particle->add_impulse(force);
+        return force;
     }
     
     
@@ -97,7 +236,11 @@ namespace Physics {
     /////////////////////////
     
     void ParticleStiffSpring::update_force(Particle * particle, real duration) {
-        if (particle->get_mass() <= 0.0) return;
+        particle->add_impulse(compute_force(particle, duration));
+    }
+    
+    Vector3 ParticleStiffSpring::compute_force(const Particle * particle, real duration) {
+        if (particle->get_mass() <= 0.0) return Vector3();
         
         // Calculate vector of spring
         Vector3 position = particle->get_position();
@@ -105,7 +248,7 @@ namespace Physics {
         
         // Calculate constants
         real gamma = 0.5f * sqrtf(4 * spring_constant - damping * damping);
-        if (gamma == 0.f) return;
+        if (gamma == 0.f) return Vector3();
         Vector3 constant = position * (damping / (2.0f * gamma))
             + particle->get_velocity() * (1.0f / gamma);
         
@@ -117,7 +260,7 @@ namespace Physics {
         // calculate resulting acceleration
         Vector3 acceleration = (target - position) * (1.0f / duration * duration)
             - particle->get_velocity() * duration;
-        particle->add_impulse(acceleration * particle->get_mass());
+        return acceleration * particle->get_mass();
     }
     
     
@@ -132,8 +275,7 @@ namespace Physics {
     void Gravity::update_force(RigidBody * body, real duration) {
         if (!body->has_finite_mass()) return;
         
-        Vector3 c_gravity = gravity * body->get_mass();
-        body->add_force(c_gravity);
+        body->add_force(gravity * body->get_mass());
     }
     
     
@@ -142,28 +284,29 @@ namespace Physics {
     ////////////
     
     Spring::Spring(
-        Vector3 &left_connection_point,
-        Vector3 &right_connection_point,
+        const Vector3 &left_connection_point,
+        const Vector3 &right_connection_point,
         RigidBody * other,
         real spring_constant,
         real rest_length
-    ) {
-        
-    };
+    ) :
+        connection_point_left(left_connection_point),
+        connection_point_right(right_connection_point),
+        other(other),
+        spring_constant(spring_constant),
+        rest_length(rest_length)
+    {}
     
     void Spring::update_force(RigidBody * body, real duration) {
-        Vector3 left_piws = body->get_point_in_world_space(connection_point_left);
-        Vector3 right_piws = body->get_point_in_world_space(connection_point_right);
+        const Vector3 left_piws = body->get_point_in_world_space(connection_point_left);
+        const Vector3 right_piws = body->get_point_in_world_space(connection_point_right);
         
         Vector3 force = left_piws - right_piws;
         
-        real magnitude = force.magnitude();
-        magnitude = std::abs(magnitude);
-        magnitude *= spring_constant;
+        real magnitude = std::abs(force.magnitude()) * spring_constant;
         
         force.normalize();
-        force *= -magnitude;
-        body->add_force_at_point(force, left_piws);
+        body->add_force_at_point(force * -magnitude, left_piws);
     }
     
     // Force Registry //
@@ -180,13 +323,12 @@ namespace Physics {
         RigidBody * RigidBody,
         ForceGenerator * fg
     ) {
-        int i = 0;
-        for (ForceRegistration pfl : links) {
-            if (pfl.body == RigidBody && pfl.fg == fg) {
-                links.erase(links.begin() + i);
-            }
-            ++i;
-        }
+        links.erase(
+            std::remove_if(links.begin(), links.end(), [RigidBody, fg](const ForceRegistration &pfl) {
+                return pfl.body == RigidBody && pfl.fg == fg;
+            }),
+            links.end()
+        );
     }
     
     void ForceRegistry::clear() {
@@ -11,6 +11,8 @@
 
 #include <stdio.h>
 #include "core.h"
+#include "jobs.h"
+#include "memstats.h"
 
 namespace Physics {
     /**
@@ -20,6 +22,14 @@ namespace Physics {
     class ParticleForceGenerator {
     public:
         virtual void update_force(Particle *p, real time) = 0;
+        
+        /**
+         * Force update_force would add to p, without adding it
+         * The parallel force stage sums these into per worker buffers.
+         * By default update_force runs on a copy of p, generators that
+         * compare particle pointers or are called often should override
+         */
+        virtual Vector3 compute_force(const Particle *p, real time);
     };
     
     /*
@@ -39,10 +49,44 @@ namespace Physics {
         /*
          * Link Container
          */
-        typedef std::vector<ParticleForceLink> Registry;
+        typedef std::vector<ParticleForceLink, TaggedAllocator<ParticleForceLink, MEMORY_REGISTRY>> Registry;
         Registry links;
+        
+        /*
+         * Registry local particle IDs, link i writes slot_particles[link_slots[i]]
+         */
+        std::vector<unsigned> link_slots;
+        std::vector<Particle*> slot_particles;
+        bool slots_dirty = true;
+        
+        /*
+         * One force per slot for every worker, summed into the particles
+         * and zeroed again after each parallel update
+         */
+        typedef std::vector<Vector3, TaggedAllocator<Vector3, MEMORY_REGISTRY>> WorkerForces;
+        std::vector<WorkerForces> worker_forces;
+        
+        /*
+         * Deterministic mode keeps every link's force apart and sums them
+         * per particle in registration order. Slot s owns link indices
+         * slot_links[slot_link_starts[s]] to slot_links[slot_link_starts[s + 1]]
+         */
+        bool deterministic = false;
+        std::vector<Vector3> link_forces;
+        std::vector<unsigned> slot_links;
+        std::vector<unsigned> slot_link_starts;
+        
+        void build_slots();
+        void reduce_forces(JobSystem * jobs);
+        void update_forces_deterministic(real duration, JobSystem * jobs);
     
     public:
+        /**
+         * Links and particles per parallel chunk
+         */
+        static constexpr unsigned link_grain = 256;
+        static constexpr unsigned slot_grain = 1024;
+        
         /*
          * Methods
          */
@@ -56,6 +100,11 @@ namespace Physics {
          * Remove link between particle and force generator
          */
         void remove(Particle * particle, ParticleForceGenerator * fg);
+        
+        /**
+         * Remove every link of a particle
+         */
+        void remove(Particle * particle);
     
         /**
          * Clear all connections
@@ -73,8 +122,27 @@ namespace Physics {
     
         /**
          * Updates all connections for one time step
+         * With jobs, links run in parallel through compute_force into per
+         * worker buffers that get reduced into the particles afterwards
          */
-        void update_forces(real duration);
+        void update_forces(real duration, JobSystem * jobs = nullptr);
+        
+        /**
+         * Make parallel updates independent of thread count and scheduling
+         * Every particle's forces are summed in registration order onto
+         * whatever it had accumulated already, which matches the serial
+         * path bit for bit when update_force adds compute_force as one
+         * impulse, as the built in generators do
+         */
+        void set_deterministic(bool d) { deterministic = d; }
+        bool is_deterministic() const { return deterministic; }
+        
+        /**
+         * Links in registration order
+         */
+        unsigned size() const { return static_cast<unsigned>(links.size()); }
+        Particle * get_particle(unsigned link) const { return links[link].particle; }
+        ParticleForceGenerator * get_generator(unsigned link) const { return links[link].fg; }
     };
     
     
@@ -92,17 +160,18 @@ namespace Physics {
         /*
          * Constructors
          */
-        ParticleGravity(Vector3 v) : gravity(v) {}
+        ParticleGravity(const Vector3 &v) : gravity(v) {}
         
         /*
          * Getters / Setters
          */
-        void set_gravity(Vector3 g) { gravity = g; }
+        void set_gravity(const Vector3 &g) { gravity = g; }
         
         /**
          * Particle force generator implementation
          */
         void update_force(Particle * particle, real duration);
+        Vector3 compute_force(const Particle * particle, real duration);
     };
     
     
@@ -137,6 +206,7 @@ namespace Physics {
          * Particle force generator implementation
          */
         void update_force(Particle * particle, real duration);
+        Vector3 compute_force(const Particle * particle, real duration);
     };
     
     
@@ -171,6 +241,7 @@ namespace Physics {
          * Particle force generator implementation
          */
         void update_force(Particle * particle, real duration);
+        Vector3 compute_force(const Particle * particle, real duration);
     };
     
     
@@ -201,7 +272,7 @@ namespace Physics {
         /**
          * Constructor
          */
-        Gravity(Vector3 &gravity);
+        Gravity(const Vector3 &gravity) : gravity(gravity) {}
         
         /**
          * RigidBody force generation gravity implementation
@@ -228,8 +299,8 @@ namespace Physics {
          * Constructor
          */
         Spring(
-            Vector3 &left_connection_point,
-            Vector3 &right_connection_point,
+            const Vector3 &left_connection_point,
+            const Vector3 &right_connection_point,
             RigidBody * other,
             real spring_constant,
             real rest_length
@@ -32,6 +32,7 @@ class FlightSimDemo
     Physics::AeroControl right_wing;
     Physics::AeroControl rudder;
     Physics::Aero tail;
+    Physics::AeroGroup surfaces;
     Physics::RigidBody aircraft;
     Physics::PropulsionForce propel;
     Physics::ForceRegistry registry;
@@ -113,10 +114,13 @@ windspeed(0,0,0)
     aircraft.set_awake(true);
     aircraft.set_can_sleep(false);
 
-    registry.add(&aircraft, &left_wing);
-    registry.add(&aircraft, &right_wing);
-    registry.add(&aircraft, &rudder);
-    registry.add(&aircraft, &tail);
+    // Control surfaces are evaluated together as one batch
+    surfaces.add(&left_wing);
+    surfaces.add(&right_wing);
+    surfaces.add(&rudder);
+    surfaces.add(&tail);
+    
+    registry.add(&aircraft, &surfaces);
     registry.add(&aircraft, &propel);
 }
 
@@ -43,6 +43,7 @@ namespace GroundForce {
             contact->contact_normal = normal;
             contact->penetration = 0 - height;
             contact->restitution = 0.8;
+            contact->feature = 0;
             
             return 1;
         }
@@ -54,18 +55,20 @@ namespace GroundForce {
     Physics::ParticleGravity gravity(Physics::Vector3(0,-9.8,0));
     Physics::Particle ground = Physics::Vector3();
     ParticleGround ground_contact;
-    bool physics_paused = true;
     std::vector<Physics::Particle*> particles;
     
-    void draw_particle() {
-        Graphics::draw_sphere(particle, 0.2);
-    }
+    /**
+     * Physics steps on its own thread, drawing only reads its snapshots
+     */
+    Physics::SimulationThread simulation(
+        [](Physics::real duration) { world.run_physics(duration); },
+        [](Physics::Snapshot &snapshot) { Physics::capture_particles(particles, snapshot); }
+    );
     
-    void step_physics() {
-        if (!physics_paused) {
-            Physics::real frame_duration = Graphics::get_seconds_per_frame();
-            world.run_physics(frame_duration);
-        }
+    void draw_particle() {
+        const Physics::Snapshot &snapshot = simulation.latest();
+        if (snapshot.positions.empty()) return;
+        Graphics::draw_sphere(snapshot.positions[0], 0.2);
     }
     
     int main(int argc, char ** argv) {
@@ -80,12 +83,14 @@ namespace GroundForce {
         world.contact_generators.push_back(&ground_contact);
         
         Graphics::register_fire([](){
-            physics_paused = !physics_paused;
+            simulation.set_paused(!simulation.is_paused());
         }, ENTER_KEY);
         Graphics::push_draw_pipeline(Graphics::draw_ground);
         Graphics::push_draw_pipeline(Graphics::draw_reference_points);
         Graphics::push_draw_pipeline(draw_particle);
-        Graphics::push_draw_pipeline(step_physics);
+        
+        simulation.set_paused(true);
+        simulation.start();
         
         Graphics::start();
         return 0;
@@ -0,0 +1,181 @@
+//
+//  jobs.cpp
+//  MSIM495
+//
+
+#include "jobs.h"
+
+namespace Physics {
+    /*
+     * Pool and queue of the calling thread,
+     * null / 0 outside of any pool
+     */
+    static thread_local const JobSystem * current_system = nullptr;
+    static thread_local unsigned current_index = 0;
+    
+    
+    
+    // JobSystem //
+    ///////////////
+    
+    JobSystem::JobSystem(unsigned thread_count) {
+        if (thread_count == 0) {
+            unsigned cores = std::thread::hardware_concurrency();
+            thread_count = cores > 1 ? cores - 1 : 0;
+        }
+        
+        for (unsigned i = 0; i <= thread_count; ++i) {
+            queues.emplace_back(new Queue());
+        }
+        
+        for (unsigned i = 1; i <= thread_count; ++i) {
+            threads.emplace_back([this, i]() { worker_loop(i); });
+        }
+    }
+    
+    JobSystem::~JobSystem() {
+        {
+            std::lock_guard<std::mutex> guard(sleep_lock);
+            running = false;
+        }
+        wake.notify_all();
+        
+        for (std::thread &t : threads) t.join();
+    }
+    
+    unsigned JobSystem::current_worker() const {
+        return current_system == this ? current_index : 0;
+    }
+    
+    bool JobSystem::in_pool() const {
+        return current_system == this;
+    }
+    
+    void JobSystem::submit(Job job) {
+        // Count before publishing so a thief can never take it below zero
+        {
+            std::lock_guard<std::mutex> guard(sleep_lock);
+            ++queued;
+        }
+        
+        Queue &q = *queues[current_worker()];
+        {
+            std::lock_guard<std::mutex> guard(q.lock);
+            q.jobs.push_back(std::move(job));
+        }
+        wake.notify_one();
+    }
+    
+    bool JobSystem::pop(unsigned worker, Job &job) {
+        const unsigned count = worker_count();
+        
+        // Own work, newest first while it's still in cache
+        {
+            Queue &q = *queues[worker];
+            std::lock_guard<std::mutex> guard(q.lock);
+            if (!q.jobs.empty()) {
+                job = std::move(q.jobs.back());
+                q.jobs.pop_back();
+                --queued;
+                return true;
+            }
+        }
+        
+        // Steal oldest work from everyone else
+        for (unsigned n = 1; n < count; ++n) {
+            Queue &q = *queues[(worker + n) % count];
+            std::lock_guard<std::mutex> guard(q.lock);
+            if (!q.jobs.empty()) {
+                job = std::move(q.jobs.front());
+                q.jobs.pop_front();
+                --queued;
+                return true;
+            }
+        }
+        
+        return false;
+    }
+    
+    bool JobSystem::run_one() {
+        Job job;
+        if (!pop(current_worker(), job)) return false;
+        job();
+        return true;
+    }
+    
+    void JobSystem::worker_loop(unsigned worker) {
+        current_system = this;
+        current_index = worker;
+        
+        Job job;
+        while (true) {
+            if (pop(worker, job)) {
+                job();
+                job = nullptr;
+                continue;
+            }
+            
+            std::unique_lock<std::mutex> guard(sleep_lock);
+            wake.wait(guard, [this]() { return queued > 0 || !running; });
+            if (!running) return;
+        }
+    }
+    
+    
+    
+    // TaskGroup //
+    ///////////////
+    
+    TaskGroup::TaskGroup(JobSystem * jobs) : jobs(jobs) {
+        if (jobs && !jobs->in_pool()) {
+            jobs->driver_lock.lock();
+            driving = true;
+        }
+    }
+    
+    TaskGroup::~TaskGroup() {
+        join();
+        if (driving) jobs->driver_lock.unlock();
+    }
+    
+    void TaskGroup::run(JobSystem::Job job) {
+        if (!jobs) {
+            job();
+            return;
+        }
+        
+        ++pending;
+        jobs->submit([this, job = std::move(job)]() {
+            // Counted down however the job ends, or wait() never returns
+            struct Finished {
+                std::atomic<unsigned> &pending;
+                ~Finished() { --pending; }
+            } finished{pending};
+            
+            try {
+                job();
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> guard(error_lock);
+                if (!error) error = std::current_exception();
+            }
+        });
+    }
+    
+    void TaskGroup::join() {
+        while (pending > 0) {
+            if (!jobs->run_one()) std::this_thread::yield();
+        }
+    }
+    
+    void TaskGroup::wait() {
+        join();
+        
+        std::exception_ptr thrown;
+        {
+            std::lock_guard<std::mutex> guard(error_lock);
+            std::swap(thrown, error);
+        }
+        if (thrown) std::rethrow_exception(thrown);
+    }
+}
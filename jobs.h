@@ -0,0 +1,215 @@
+//
+//  jobs.h
+//  MSIM495
+//
+
+#ifndef __MSIM495__jobs__
+#define __MSIM495__jobs__
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <exception>
+
+namespace Physics {
+    /**
+     * Work stealing thread pool
+     * Every worker owns a deque, it pushes and pops its own work at the
+     * back while idle workers steal from the front of the others
+     * Queue 0 belongs to whichever outside thread is driving the pool,
+     * that thread runs jobs too while it waits on a TaskGroup. Outside
+     * threads take turns: a TaskGroup opened outside the pool holds the
+     * pool until it's gone, so index 0 of anything kept per worker only
+     * ever belongs to one of them at a time
+     */
+    class JobSystem {
+    public:
+        typedef std::function<void()> Job;
+    
+    private:
+        struct Queue {
+            std::mutex lock;
+            std::deque<Job> jobs;
+        };
+        
+        std::vector<std::unique_ptr<Queue>> queues;
+        std::vector<std::thread> threads;
+        
+        /*
+         * Sleeping workers wake when queued goes above zero
+         */
+        std::mutex sleep_lock;
+        std::condition_variable wake;
+        std::atomic<unsigned> queued{0};
+        std::atomic<bool> running{true};
+        
+        /*
+         * Held by the outside thread driving the pool, recursive so its
+         * jobs can open nested groups
+         */
+        std::recursive_mutex driver_lock;
+        friend class TaskGroup;
+        
+        /**
+         * Take from the back of own queue, otherwise steal from the
+         * front of another starting with the next queue over
+         */
+        bool pop(unsigned worker, Job &job);
+        
+        void worker_loop(unsigned worker);
+    
+    public:
+        /**
+         * threads == 0 uses one thread per hardware core,
+         * minus the calling thread
+         */
+        explicit JobSystem(unsigned threads = 0);
+        ~JobSystem();
+        
+        JobSystem(const JobSystem &) = delete;
+        JobSystem & operator=(const JobSystem &) = delete;
+        
+        /**
+         * Number of queues, pool threads plus the driving thread
+         */
+        unsigned worker_count() const { return static_cast<unsigned>(queues.size()); }
+        
+        /**
+         * Index of the calling thread's queue
+         * Threads outside the pool share queue 0, one at a time
+         */
+        unsigned current_worker() const;
+        
+        /**
+         * Whether the calling thread is one of the pool's own
+         */
+        bool in_pool() const;
+        
+        /**
+         * Queue a job on the calling thread's deque
+         */
+        void submit(Job job);
+        
+        /**
+         * Run one pending job on the calling thread
+         * Returns false when there was nothing to run
+         */
+        bool run_one();
+        
+        /**
+         * Run function(begin, end, chunk) over [0, count) in chunks of grain
+         * Chunk boundaries only depend on count and grain so per chunk
+         * results line up the same on any number of threads
+         */
+        template<typename F>
+        void parallel_for(unsigned count, unsigned grain, F function);
+    };
+    
+    
+    
+    /**
+     * Fork / join over a JobSystem
+     * With no job system every job runs inline in run()
+     */
+    class TaskGroup {
+        JobSystem * jobs;
+        std::atomic<unsigned> pending{0};
+        
+        /*
+         * Opened outside the pool, holding its driver_lock
+         */
+        bool driving = false;
+        
+        /*
+         * First exception thrown by a job, rethrown from wait()
+         */
+        std::mutex error_lock;
+        std::exception_ptr error;
+        
+        /**
+         * Run queued work until pending reaches zero
+         */
+        void join();
+    
+    public:
+        /**
+         * Outside the pool this blocks while another outside thread
+         * is driving it
+         */
+        explicit TaskGroup(JobSystem * jobs);
+        
+        /**
+         * Waits like wait() but drops any exception, call wait() first
+         * to see it
+         */
+        ~TaskGroup();
+        
+        TaskGroup(const TaskGroup &) = delete;
+        TaskGroup & operator=(const TaskGroup &) = delete;
+        
+        void run(JobSystem::Job job);
+        
+        /**
+         * Blocks until every job from run() finished,
+         * helping with queued work in the meantime
+         * Rethrows the first exception any of them threw
+         */
+        void wait();
+    };
+    
+    
+    
+    template<typename F>
+    void JobSystem::parallel_for(unsigned count, unsigned grain, F function) {
+        if (count == 0) return;
+        if (grain == 0) grain = 1;
+        
+        // Opened first so even an inline chunk runs as the only driver
+        TaskGroup group(this);
+        
+        const unsigned chunks = (count + grain - 1) / grain;
+        if (chunks == 1) {
+            function(0u, count, 0u);
+            return;
+        }
+        
+        for (unsigned chunk = 0; chunk < chunks; ++chunk) {
+            const unsigned begin = chunk * grain;
+            const unsigned end = std::min(begin + grain, count);
+            group.run([&function, begin, end, chunk]() { function(begin, end, chunk); });
+        }
+        group.wait();
+    }
+    
+    /**
+     * JobSystem::parallel_for that runs the same chunks serially,
+     * in order, when jobs is null
+     */
+    template<typename F>
+    void parallel_for(JobSystem * jobs, unsigned count, unsigned grain, F function) {
+        if (jobs) {
+            jobs->parallel_for(count, grain, function);
+            return;
+        }
+        
+        if (grain == 0) grain = 1;
+        for (unsigned begin = 0, chunk = 0; begin < count; begin += grain, ++chunk) {
+            function(begin, std::min(begin + grain, count), chunk);
+        }
+    }
+    
+    /**
+     * Chunks parallel_for will split count items into
+     */
+    constexpr unsigned chunk_count(unsigned count, unsigned grain) {
+        return grain ? (count + grain - 1) / grain : count;
+    }
+}
+
+#endif /* defined(__MSIM495__jobs__) */
@@ -0,0 +1,211 @@
+//
+//  memstats.cpp
+//  MSIM495
+//
+
+#include "memstats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <atomic>
+
+namespace Physics {
+    // MemorySnapshot //
+    ////////////////////
+    
+    MemoryCounters MemorySnapshot::total() const {
+        MemoryCounters sum;
+        for (const MemoryCounters &c : tags) {
+            sum.allocations += c.allocations;
+            sum.frees += c.frees;
+            sum.allocated_bytes += c.allocated_bytes;
+            sum.freed_bytes += c.freed_bytes;
+            sum.peak_bytes += c.peak_bytes;
+            sum.window_peak_bytes += c.window_peak_bytes;
+        }
+        return sum;
+    }
+    
+    MemorySnapshot MemorySnapshot::operator-(const MemorySnapshot &earlier) const {
+        MemorySnapshot difference;
+        for (unsigned t = 0; t < MEMORY_TAG_COUNT; ++t) {
+            const MemoryCounters &now = tags[t];
+            const MemoryCounters &then = earlier.tags[t];
+            MemoryCounters &d = difference.tags[t];
+            d.allocations = now.allocations - then.allocations;
+            d.frees = now.frees - then.frees;
+            d.allocated_bytes = now.allocated_bytes - then.allocated_bytes;
+            d.freed_bytes = now.freed_bytes - then.freed_bytes;
+            d.peak_bytes = now.window_peak_bytes;
+            d.window_peak_bytes = now.window_peak_bytes;
+        }
+        return difference;
+    }
+    
+    
+    
+    // MemoryStats //
+    /////////////////
+    
+    const char * MemoryStats::tag_name(MemoryTag tag) {
+        static const char * const names[MEMORY_TAG_COUNT] = {
+            "general", "broadphase", "contacts", "registry", "render"
+        };
+        return tag < MEMORY_TAG_COUNT ? names[tag] : "unknown";
+    }
+    
+    void MemoryStats::print(const MemorySnapshot &snapshot, const char * title) {
+        printf("%s\n", title);
+        for (unsigned t = 0; t < MEMORY_TAG_COUNT; ++t) {
+            const MemoryCounters &c = snapshot.tags[t];
+            if (!c.allocations && !c.frees) continue;
+            printf(
+                "  %-10s %8lu allocs %8lu frees %10lu bytes in %10lu bytes out, peak %lu\n",
+                tag_name(static_cast<MemoryTag>(t)),
+                c.allocations, c.frees, c.allocated_bytes, c.freed_bytes, c.peak_bytes
+            );
+        }
+    }
+    
+#ifdef PHYSICS_MEMORY_STATS
+    /*
+     * Relaxed counters, each tag on its own cache line
+     */
+    struct alignas(64) TagCounters {
+        std::atomic<unsigned long> allocations{0};
+        std::atomic<unsigned long> frees{0};
+        std::atomic<unsigned long> allocated_bytes{0};
+        std::atomic<unsigned long> freed_bytes{0};
+        std::atomic<unsigned long> peak_bytes{0};
+        std::atomic<unsigned long> window_peak_bytes{0};
+    };
+    
+    static TagCounters counters[MEMORY_TAG_COUNT];
+    static thread_local MemoryTag current = MEMORY_GENERAL;
+    
+    void MemoryStats::record_allocate(MemoryTag tag, std::size_t bytes) {
+        TagCounters &c = counters[tag];
+        c.allocations.fetch_add(1, std::memory_order_relaxed);
+        const unsigned long allocated = c.allocated_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        const unsigned long live = allocated - c.freed_bytes.load(std::memory_order_relaxed);
+        
+        unsigned long peak = c.peak_bytes.load(std::memory_order_relaxed);
+        while (live > peak && !c.peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+        
+        unsigned long window_peak = c.window_peak_bytes.load(std::memory_order_relaxed);
+        while (live > window_peak && !c.window_peak_bytes.compare_exchange_weak(window_peak, live, std::memory_order_relaxed)) {}
+    }
+    
+    void MemoryStats::record_free(MemoryTag tag, std::size_t bytes) {
+        TagCounters &c = counters[tag];
+        c.frees.fetch_add(1, std::memory_order_relaxed);
+        c.freed_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    
+    MemorySnapshot MemoryStats::snapshot() {
+        MemorySnapshot s;
+        for (unsigned t = 0; t < MEMORY_TAG_COUNT; ++t) {
+            s.tags[t].allocations = counters[t].allocations.load(std::memory_order_relaxed);
+            s.tags[t].frees = counters[t].frees.load(std::memory_order_relaxed);
+            s.tags[t].allocated_bytes = counters[t].allocated_bytes.load(std::memory_order_relaxed);
+            s.tags[t].freed_bytes = counters[t].freed_bytes.load(std::memory_order_relaxed);
+            s.tags[t].peak_bytes = counters[t].peak_bytes.load(std::memory_order_relaxed);
+            
+            // The next window starts from what's live now
+            s.tags[t].window_peak_bytes = counters[t].window_peak_bytes.exchange(
+                s.tags[t].live_bytes(),
+                std::memory_order_relaxed
+            );
+        }
+        return s;
+    }
+    
+    MemoryTag MemoryStats::current_tag() {
+        return current;
+    }
+    
+    void MemoryStats::set_current_tag(MemoryTag tag) {
+        current = tag;
+    }
+    
+    /*
+     * Every block carries its size and tag just in front of it,
+     * offset is how far in from what malloc returned
+     */
+    struct AllocationHeader {
+        std::size_t size;
+        unsigned tag;
+        unsigned offset;
+    };
+    
+    static_assert(sizeof(AllocationHeader) == 16, "header keeps blocks 16 byte aligned");
+    
+    static void * counted_allocate(std::size_t size, std::size_t align) {
+        const std::size_t offset = align > sizeof(AllocationHeader) ? align : sizeof(AllocationHeader);
+        
+        void * base = nullptr;
+        if (align > sizeof(AllocationHeader)) {
+            if (posix_memalign(&base, align, offset + size) != 0) base = nullptr;
+        }
+        else {
+            base = malloc(offset + size);
+        }
+        if (!base) return nullptr;
+        
+        unsigned char * block = static_cast<unsigned char*>(base) + offset;
+        AllocationHeader * header = reinterpret_cast<AllocationHeader*>(block) - 1;
+        header->size = size;
+        header->tag = current;
+        header->offset = static_cast<unsigned>(offset);
+        
+        MemoryStats::record_allocate(current, size);
+        return block;
+    }
+    
+    static void counted_free(void * block) {
+        if (!block) return;
+        
+        const AllocationHeader * header = static_cast<AllocationHeader*>(block) - 1;
+        MemoryStats::record_free(static_cast<MemoryTag>(header->tag), header->size);
+        free(static_cast<unsigned char*>(block) - header->offset);
+    }
+    
+    static void * counted_new(std::size_t size, std::size_t align) {
+        void * block = counted_allocate(size ? size : 1, align);
+        if (!block) throw std::bad_alloc();
+        return block;
+    }
+#endif
+}
+
+#ifdef PHYSICS_MEMORY_STATS
+// Replacement global allocation functions, every form ends in the
+// counted pair above
+
+void * operator new(std::size_t size) { return Physics::counted_new(size, 0); }
+void * operator new[](std::size_t size) { return Physics::counted_new(size, 0); }
+void * operator new(std::size_t size, std::align_val_t align) { return Physics::counted_new(size, (std::size_t)align); }
+void * operator new[](std::size_t size, std::align_val_t align) { return Physics::counted_new(size, (std::size_t)align); }
+
+void * operator new(std::size_t size, const std::nothrow_t &) noexcept { return Physics::counted_allocate(size ? size : 1, 0); }
+void * operator new[](std::size_t size, const std::nothrow_t &) noexcept { return Physics::counted_allocate(size ? size : 1, 0); }
+void * operator new(std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept {
+    return Physics::counted_allocate(size ? size : 1, (std::size_t)align);
+}
+void * operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept {
+    return Physics::counted_allocate(size ? size : 1, (std::size_t)align);
+}
+
+void operator delete(void * p) noexcept { Physics::counted_free(p); }
+void operator delete[](void * p) noexcept { Physics::counted_free(p); }
+void operator delete(void * p, std::size_t) noexcept { Physics::counted_free(p); }
+void operator delete[](void * p, std::size_t) noexcept { Physics::counted_free(p); }
+void operator delete(void * p, std::align_val_t) noexcept { Physics::counted_free(p); }
+void operator delete[](void * p, std::align_val_t) noexcept { Physics::counted_free(p); }
+void operator delete(void * p, std::size_t, std::align_val_t) noexcept { Physics::counted_free(p); }
+void operator delete[](void * p, std::size_t, std::align_val_t) noexcept { Physics::counted_free(p); }
+void operator delete(void * p, const std::nothrow_t &) noexcept { Physics::counted_free(p); }
+void operator delete[](void * p, const std::nothrow_t &) noexcept { Physics::counted_free(p); }
+void operator delete(void * p, std::align_val_t, const std::nothrow_t &) noexcept { Physics::counted_free(p); }
+void operator delete[](void * p, std::align_val_t, const std::nothrow_t &) noexcept { Physics::counted_free(p); }
+#endif
@@ -0,0 +1,169 @@
+//
+//  memstats.h
+//  MSIM495
+//
+
+#ifndef __MSIM495__memstats__
+#define __MSIM495__memstats__
+
+#include <cstddef>
+#include <memory>
+
+/**
+ * Memory instrumentation, off unless built with -DPHYSICS_MEMORY_STATS
+ *
+ * When on, every heap allocation is counted against a subsystem tag:
+ * containers that declare a TaggedAllocator count against its tag and
+ * everything else, std::function captures included, against the tag of
+ * the innermost MemoryScope on the allocating thread. Frees count
+ * against the tag the block was allocated under, wherever they happen
+ *
+ * When off, TaggedAllocator is std::allocator, scopes are empty and
+ * snapshots are all zero, so instrumented code costs nothing
+ */
+
+namespace Physics {
+    enum MemoryTag {
+        MEMORY_GENERAL,
+        MEMORY_BROADPHASE,
+        MEMORY_CONTACTS,
+        MEMORY_REGISTRY,
+        MEMORY_RENDER,
+        MEMORY_TAG_COUNT
+    };
+    
+    struct MemoryCounters {
+        unsigned long allocations = 0;
+        unsigned long frees = 0;
+        unsigned long allocated_bytes = 0;
+        unsigned long freed_bytes = 0;
+        
+        /*
+         * Most bytes live at once: ever in a snapshot, between the two
+         * snapshots in a difference
+         */
+        unsigned long peak_bytes = 0;
+        
+        /*
+         * Most bytes live at once since the snapshot before this one,
+         * taken on any thread
+         */
+        unsigned long window_peak_bytes = 0;
+        
+        unsigned long live_bytes() const { return allocated_bytes - freed_bytes; }
+    };
+    
+    /**
+     * Counters of every tag at one point in time
+     * Subtracting two gives the traffic in between, and as peak the high
+     * water mark since the earlier one. Every snapshot starts a new
+     * window, so that's only exact with no snapshots taken in between
+     *
+     *     MemorySnapshot before = MemoryStats::snapshot();
+     *     world.run_physics(duration);
+     *     MemorySnapshot step = MemoryStats::snapshot() - before;
+     */
+    struct MemorySnapshot {
+        MemoryCounters tags[MEMORY_TAG_COUNT];
+        
+        const MemoryCounters & operator[](MemoryTag tag) const { return tags[tag]; }
+        
+        MemoryCounters total() const;
+        MemorySnapshot operator-(const MemorySnapshot &earlier) const;
+    };
+    
+    class MemoryStats {
+    public:
+#ifdef PHYSICS_MEMORY_STATS
+        static constexpr bool enabled = true;
+        
+        static void record_allocate(MemoryTag tag, std::size_t bytes);
+        static void record_free(MemoryTag tag, std::size_t bytes);
+        static MemorySnapshot snapshot();
+        
+        /**
+         * Tag new allocations on this thread are counted against
+         */
+        static MemoryTag current_tag();
+        static void set_current_tag(MemoryTag tag);
+#else
+        static constexpr bool enabled = false;
+        
+        static void record_allocate(MemoryTag, std::size_t) {}
+        static void record_free(MemoryTag, std::size_t) {}
+        static MemorySnapshot snapshot() { return MemorySnapshot(); }
+        static MemoryTag current_tag() { return MEMORY_GENERAL; }
+        static void set_current_tag(MemoryTag) {}
+#endif
+        
+        static const char * tag_name(MemoryTag tag);
+        
+        /**
+         * One line per tag with any traffic
+         */
+        static void print(const MemorySnapshot &snapshot, const char * title);
+    };
+    
+    /**
+     * Count this thread's untagged allocations against tag until the
+     * scope ends
+     */
+    class MemoryScope {
+#ifdef PHYSICS_MEMORY_STATS
+        MemoryTag previous;
+    
+    public:
+        explicit MemoryScope(MemoryTag tag) : previous(MemoryStats::current_tag()) {
+            MemoryStats::set_current_tag(tag);
+        }
+        ~MemoryScope() { MemoryStats::set_current_tag(previous); }
+#else
+    public:
+        explicit MemoryScope(MemoryTag) {}
+#endif
+        
+        MemoryScope(const MemoryScope &) = delete;
+        MemoryScope & operator=(const MemoryScope &) = delete;
+    };
+    
+    
+    
+#ifdef PHYSICS_MEMORY_STATS
+    /**
+     * Standard allocator counting against Tag, for containers that
+     * belong to one subsystem whatever thread grows them
+     */
+    template<typename T, MemoryTag Tag>
+    struct TaggedAllocator {
+        typedef T value_type;
+        
+        template<typename U>
+        struct rebind { typedef TaggedAllocator<U, Tag> other; };
+        
+        TaggedAllocator() {}
+        
+        template<typename U>
+        TaggedAllocator(const TaggedAllocator<U, Tag> &) {}
+        
+        T * allocate(std::size_t count) {
+            MemoryScope scope(Tag);
+            return std::allocator<T>().allocate(count);
+        }
+        
+        void deallocate(T * p, std::size_t count) {
+            std::allocator<T>().deallocate(p, count);
+        }
+        
+        template<typename U>
+        bool operator==(const TaggedAllocator<U, Tag> &) const { return true; }
+        
+        template<typename U>
+        bool operator!=(const TaggedAllocator<U, Tag> &) const { return false; }
+    };
+#else
+    template<typename T, MemoryTag Tag>
+    using TaggedAllocator = std::allocator<T>;
+#endif
+}
+
+#endif /* defined(__MSIM495__memstats__) */
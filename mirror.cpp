@@ -0,0 +1,523 @@
+//
+//  mirror.cpp
+//  MSIM495
+//
+
+#include "mirror.h"
+#include <string.h>
+#include <new>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace Physics {
+    static real Vector3::* const axes[3] = { &Vector3::x, &Vector3::y, &Vector3::z };
+    
+    static int32_t quantize(real v, double resolution) {
+        double q = nearbyint(v / resolution);
+        if (q > INT32_MAX) return INT32_MAX;
+        if (q < INT32_MIN) return INT32_MIN;
+        return static_cast<int32_t>(q);
+    }
+    
+    static int16_t quantize_unit(real v) {
+        if (v > 1) v = 1;
+        if (v < -1) v = -1;
+        return static_cast<int16_t>(nearbyint(v * INT16_MAX));
+    }
+    
+    /*
+     * Signed differences folded so small magnitudes of either sign
+     * become small unsigned numbers, 0 -1 1 -2 -> 0 1 2 3
+     */
+    static uint64_t zigzag(int64_t v) {
+        return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+    }
+    
+    static int64_t unzigzag(uint64_t v) {
+        return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+    }
+    
+    static unsigned bits_for(uint64_t v) {
+        unsigned bits = 0;
+        while (v) {
+            ++bits;
+            v >>= 1;
+        }
+        return bits;
+    }
+    
+    static const unsigned long ring_data_offset = (sizeof(SharedRing::Header) + 63) & ~63ul;
+    static const unsigned record_pad = ~0u;
+    
+    /*
+     * LSB first bit packing into a byte vector
+     */
+    struct BitWriter {
+        std::vector<unsigned char> &out;
+        uint64_t accumulator = 0;
+        unsigned count = 0;
+        
+        BitWriter(std::vector<unsigned char> &out) : out(out) {}
+        
+        void write(uint64_t value, unsigned bits) {
+            if (bits > 32) {
+                write(value & 0xffffffffu, 32);
+                write(value >> 32, bits - 32);
+                return;
+            }
+            if (!bits) return;
+            
+            accumulator |= (value & (~0ull >> (64 - bits))) << count;
+            count += bits;
+            while (count >= 8) {
+                out.push_back(static_cast<unsigned char>(accumulator));
+                accumulator >>= 8;
+                count -= 8;
+            }
+        }
+        
+        void flush() {
+            if (count) out.push_back(static_cast<unsigned char>(accumulator));
+            accumulator = 0;
+            count = 0;
+        }
+    };
+    
+    struct BitReader {
+        const unsigned char * bytes;
+        unsigned long size;
+        unsigned long position = 0;
+        uint64_t accumulator = 0;
+        unsigned count = 0;
+        bool overrun = false;
+        
+        BitReader(const unsigned char * bytes, unsigned long size) : bytes(bytes), size(size) {}
+        
+        uint64_t read(unsigned bits) {
+            if (bits > 32) {
+                uint64_t low = read(32);
+                return low | (read(bits - 32) << 32);
+            }
+            if (!bits) return 0;
+            
+            while (count < bits) {
+                if (position == size) {
+                    overrun = true;
+                    return 0;
+                }
+                accumulator |= static_cast<uint64_t>(bytes[position++]) << count;
+                count += 8;
+            }
+            
+            uint64_t value = accumulator & (~0ull >> (64 - bits));
+            accumulator >>= bits;
+            count -= bits;
+            return value;
+        }
+    };
+    
+    
+    
+    // SharedRing //
+    ////////////////
+    
+    bool SharedRing::map(int fd, unsigned long bytes) {
+        void * mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) return false;
+        
+        header = static_cast<Header*>(mapped);
+        data = static_cast<unsigned char*>(mapped) + ring_data_offset;
+        mapped_bytes = bytes;
+        return true;
+    }
+    
+    bool SharedRing::create(const char * ring_name, unsigned long capacity) {
+        close();
+        
+        // Whole records of 8 bytes, so a pad record always fits
+        capacity = (capacity + 7) & ~7ul;
+        if (capacity < 64) return false;
+        
+        shm_unlink(ring_name);
+        int fd = shm_open(ring_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) return false;
+        
+        const unsigned long bytes = ring_data_offset + capacity;
+        if (ftruncate(fd, bytes) != 0) {
+            ::close(fd);
+            shm_unlink(ring_name);
+            return false;
+        }
+        if (!map(fd, bytes)) {
+            shm_unlink(ring_name);
+            return false;
+        }
+        
+        new (header) Header();
+        header->capacity = capacity;
+        header->write.store(0, std::memory_order_relaxed);
+        header->read.store(0, std::memory_order_relaxed);
+        header->version = current_version;
+        
+        // Magic last, a consumer opening early sees an unfinished ring as missing
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = magic_value;
+        
+        owner = true;
+        strncpy(name, ring_name, sizeof(name) - 1);
+        return true;
+    }
+    
+    bool SharedRing::open(const char * ring_name) {
+        close();
+        
+        int fd = shm_open(ring_name, O_RDWR, 0);
+        if (fd < 0) return false;
+        
+        struct stat info;
+        if (fstat(fd, &info) != 0 || (unsigned long)info.st_size < ring_data_offset) {
+            ::close(fd);
+            return false;
+        }
+        if (!map(fd, info.st_size)) return false;
+        
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (
+            header->magic != magic_value
+            || header->version != current_version
+            || ring_data_offset + header->capacity > mapped_bytes
+        ) {
+            close();
+            return false;
+        }
+        
+        owner = false;
+        return true;
+    }
+    
+    void SharedRing::close() {
+        if (header) munmap(header, mapped_bytes);
+        if (owner) shm_unlink(name);
+        
+        header = nullptr;
+        data = nullptr;
+        mapped_bytes = 0;
+        owner = false;
+        name[0] = 0;
+    }
+    
+    bool SharedRing::push(const void * bytes, unsigned size) {
+        if (!header || size == record_pad) return false;
+        
+        const uint64_t capacity = header->capacity;
+        const uint64_t write = header->write.load(std::memory_order_relaxed);
+        const uint64_t read = header->read.load(std::memory_order_acquire);
+        
+        const uint64_t record = (sizeof(uint64_t) + size + 7) & ~7ull;
+        const uint64_t offset = write % capacity;
+        const uint64_t skip = (capacity - offset < record) ? capacity - offset : 0;
+        if (record > capacity || write + skip + record - read > capacity) return false;
+        
+        if (skip) {
+            memcpy(data + offset, &record_pad, sizeof(unsigned));
+        }
+        
+        unsigned char * at = data + (write + skip) % capacity;
+        memcpy(at, &size, sizeof(unsigned));
+        memcpy(at + sizeof(uint64_t), bytes, size);
+        
+        header->write.store(write + skip + record, std::memory_order_release);
+        return true;
+    }
+    
+    bool SharedRing::pop(std::vector<unsigned char> &out) {
+        if (!header) return false;
+        
+        const uint64_t capacity = header->capacity;
+        uint64_t read = header->read.load(std::memory_order_relaxed);
+        const uint64_t write = header->write.load(std::memory_order_acquire);
+        if (!capacity || ring_data_offset + capacity > mapped_bytes) return false;
+        
+        for (;;) {
+            if (read == write) return false;
+            
+            const uint64_t offset = read % capacity;
+            unsigned size;
+            memcpy(&size, data + offset, sizeof(unsigned));
+            
+            const uint64_t record = size == record_pad
+                ? capacity - offset
+                : (sizeof(uint64_t) + size + 7) & ~7ull;
+            
+            // The length word comes from the other process, a record that
+            // runs past the data or past what was written means the ring
+            // is corrupt, drop everything written so far
+            if (write - read > capacity || record > write - read || record > capacity - offset) {
+                header->read.store(write, std::memory_order_release);
+                ++corrupted;
+                return false;
+            }
+            
+            if (size == record_pad) {
+                read += record;
+                continue;
+            }
+            
+            out.resize(size);
+            memcpy(out.data(), data + offset + sizeof(uint64_t), size);
+            
+            header->read.store(read + record, std::memory_order_release);
+            return true;
+        }
+    }
+    
+    
+    
+    // DeltaEncoder //
+    //////////////////
+    
+    void DeltaEncoder::encode(const Snapshot &snapshot, std::vector<unsigned char> &out) {
+        const unsigned count = static_cast<unsigned>(snapshot.positions.size());
+        const bool with_orientations = orientations && snapshot.orientations.size() == count;
+        
+        const bool keyframe = !has_baseline
+            || sent_positions.size() != count * 3
+            || sent_orientations.size() != (with_orientations ? count * 4 : 0)
+            || since_keyframe >= keyframe_interval;
+        
+        // Quantize everything, an object changed when any of its values did
+        positions.resize(count * 3);
+        orientations_q.resize(with_orientations ? count * 4 : 0);
+        for (unsigned o = 0; o < count; ++o) {
+            for (unsigned c = 0; c < 3; ++c) {
+                positions[o * 3 + c] = quantize(snapshot.positions[o].*axes[c], resolution);
+            }
+        }
+        if (with_orientations) {
+            for (unsigned o = 0; o < count; ++o) {
+                for (unsigned c = 0; c < 4; ++c) {
+                    orientations_q[o * 4 + c] = quantize_unit(snapshot.orientations[o].data[c]);
+                }
+            }
+        }
+        
+        changed.clear();
+        for (unsigned o = 0; o < count; ++o) {
+            bool moved = keyframe;
+            for (unsigned c = 0; c < 3 && !moved; ++c) moved = positions[o * 3 + c] != sent_positions[o * 3 + c];
+            for (unsigned c = 0; c < 4 && !moved && with_orientations; ++c) {
+                moved = orientations_q[o * 4 + c] != sent_orientations[o * 4 + c];
+            }
+            if (moved) changed.push_back(o);
+        }
+        
+        // One width per frame for each kind of value, wide enough for the largest
+        uint64_t widest_position = 0;
+        uint64_t widest_orientation = 0;
+        for (unsigned o : changed) {
+            for (unsigned c = 0; c < 3; ++c) {
+                const int64_t base = keyframe ? 0 : sent_positions[o * 3 + c];
+                widest_position |= zigzag(positions[o * 3 + c] - base);
+            }
+            for (unsigned c = 0; c < 4 && with_orientations; ++c) {
+                const int64_t base = keyframe ? 0 : sent_orientations[o * 4 + c];
+                widest_orientation |= zigzag(orientations_q[o * 4 + c] - base);
+            }
+        }
+        
+        FrameHeader header;
+        header.step = snapshot.step;
+        header.resolution = resolution;
+        header.time = snapshot.time;
+        header.count = count;
+        header.changed = static_cast<unsigned>(changed.size());
+        header.position_bits = bits_for(widest_position);
+        header.orientation_bits = bits_for(widest_orientation);
+        header.index_bits = count > 1 ? bits_for(count - 1) : 0;
+        header.flags = (keyframe ? FrameHeader::KEYFRAME : 0) | (with_orientations ? FrameHeader::ORIENTATIONS : 0);
+        
+        const bool indexed = !keyframe && (unsigned long)header.changed * header.index_bits < count;
+        if (indexed) header.flags |= FrameHeader::INDEXED;
+        
+        out.resize(sizeof(FrameHeader));
+        memcpy(out.data(), &header, sizeof(FrameHeader));
+        
+        BitWriter bits(out);
+        if (indexed) {
+            for (unsigned o : changed) bits.write(o, header.index_bits);
+        }
+        else if (!keyframe) {
+            unsigned next = 0;
+            for (unsigned o = 0; o < count; ++o) {
+                const bool moved = next < changed.size() && changed[next] == o;
+                bits.write(moved, 1);
+                next += moved;
+            }
+        }
+        
+        for (unsigned o : changed) {
+            for (unsigned c = 0; c < 3; ++c) {
+                const int64_t base = keyframe ? 0 : sent_positions[o * 3 + c];
+                bits.write(zigzag(positions[o * 3 + c] - base), header.position_bits);
+            }
+            for (unsigned c = 0; c < 4 && with_orientations; ++c) {
+                const int64_t base = keyframe ? 0 : sent_orientations[o * 4 + c];
+                bits.write(zigzag(orientations_q[o * 4 + c] - base), header.orientation_bits);
+            }
+        }
+        bits.flush();
+        
+        pending_keyframe = keyframe;
+        pending_raw = count * (sizeof(real) * 3 + (with_orientations ? sizeof(real) * 4 : 0));
+        pending_encoded = out.size();
+    }
+    
+    void DeltaEncoder::commit() {
+        sent_positions.swap(positions);
+        sent_orientations.swap(orientations_q);
+        has_baseline = true;
+        since_keyframe = pending_keyframe ? 1 : since_keyframe + 1;
+        
+        raw_bytes += pending_raw;
+        encoded_bytes += pending_encoded;
+    }
+    
+    
+    
+    // DeltaDecoder //
+    //////////////////
+    
+    bool DeltaDecoder::decode(const unsigned char * frame, unsigned size, Snapshot &snapshot) {
+        FrameHeader header;
+        if (size < sizeof(FrameHeader)) return false;
+        memcpy(&header, frame, sizeof(FrameHeader));
+        
+        const unsigned count = header.count;
+        const bool keyframe = header.flags & FrameHeader::KEYFRAME;
+        const bool with_orientations = header.flags & FrameHeader::ORIENTATIONS;
+        const bool indexed = header.flags & FrameHeader::INDEXED;
+        
+        // The header comes from the other process, its counts have to fit
+        // the format and the bits that follow it
+        const uint64_t per_object = 3ull * header.position_bits + (with_orientations ? 4ull * header.orientation_bits : 0);
+        const uint64_t needed = keyframe ? count * per_object
+            : indexed ? header.changed * (header.index_bits + per_object)
+            : count + header.changed * per_object;
+        if (
+            count > FrameHeader::max_count
+            || header.changed > count
+            || needed > 8ull * (size - sizeof(FrameHeader))
+        ) {
+            synced = false;
+            return false;
+        }
+        
+        const std::size_t position_values = std::size_t(count) * 3;
+        const std::size_t orientation_values = with_orientations ? std::size_t(count) * 4 : 0;
+        
+        if (keyframe) {
+            positions.assign(position_values, 0);
+            orientations.assign(orientation_values, 0);
+            synced = true;
+        }
+        else if (
+            !synced
+            || positions.size() != position_values
+            || orientations.size() != orientation_values
+        ) {
+            return false;
+        }
+        
+        BitReader bits(frame + sizeof(FrameHeader), size - sizeof(FrameHeader));
+        
+        // Which objects follow, in order
+        changed.clear();
+        if (keyframe) {
+            for (unsigned o = 0; o < count; ++o) changed.push_back(o);
+        }
+        else if (indexed) {
+            for (unsigned n = 0; n < header.changed; ++n) changed.push_back(static_cast<unsigned>(bits.read(header.index_bits)));
+        }
+        else {
+            for (unsigned o = 0; o < count; ++o) {
+                if (bits.read(1)) changed.push_back(o);
+            }
+        }
+        
+        for (unsigned o : changed) {
+            if (o >= count) bits.overrun = true;
+            if (bits.overrun) break;
+            
+            for (unsigned c = 0; c < 3; ++c) {
+                positions[o * 3 + c] += static_cast<int32_t>(unzigzag(bits.read(header.position_bits)));
+            }
+            for (unsigned c = 0; c < 4 && with_orientations; ++c) {
+                orientations[o * 4 + c] += static_cast<int16_t>(unzigzag(bits.read(header.orientation_bits)));
+            }
+        }
+        
+        // A damaged frame leaves nothing to build on, wait for the next keyframe
+        if (bits.overrun) {
+            synced = false;
+            return false;
+        }
+        
+        snapshot.step = header.step;
+        snapshot.time = header.time;
+        snapshot.positions.resize(count);
+        for (unsigned o = 0; o < count; ++o) {
+            for (unsigned c = 0; c < 3; ++c) {
+                snapshot.positions[o].*axes[c] = static_cast<real>(positions[o * 3 + c] * header.resolution);
+            }
+        }
+        
+        snapshot.orientations.resize(with_orientations ? count : 0);
+        for (unsigned o = 0; o < snapshot.orientations.size(); ++o) {
+            for (unsigned c = 0; c < 4; ++c) {
+                snapshot.orientations[o].data[c] = static_cast<real>(orientations[o * 4 + c]) / INT16_MAX;
+            }
+            snapshot.orientations[o].normalize();
+        }
+        
+        return true;
+    }
+    
+    
+    
+    // MirrorPublisher //
+    /////////////////////
+    
+    bool MirrorPublisher::publish(const Snapshot &snapshot) {
+        if (!ring.is_open()) return false;
+        
+        encoder.encode(snapshot, buffer);
+        if (!ring.push(buffer.data(), static_cast<unsigned>(buffer.size()))) {
+            ++dropped;
+            return false;
+        }
+        
+        encoder.commit();
+        return true;
+    }
+    
+    
+    
+    // MirrorSubscriber //
+    //////////////////////
+    
+    unsigned MirrorSubscriber::poll(Snapshot &snapshot) {
+        unsigned applied = 0;
+        const unsigned long corrupted = ring.get_corrupted();
+        while (ring.pop(buffer)) {
+            if (decoder.decode(buffer.data(), static_cast<unsigned>(buffer.size()), snapshot)) ++applied;
+        }
+        
+        // Deltas after the dropped frames have no base until a keyframe
+        if (ring.get_corrupted() != corrupted) decoder.reset();
+        return applied;
+    }
+}
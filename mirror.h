@@ -0,0 +1,286 @@
+//
+//  mirror.h
+//  MSIM495
+//
+
+#ifndef __MSIM495__mirror__
+#define __MSIM495__mirror__
+
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+#include "simulation.h"
+
+namespace Physics {
+    /**
+     * Single producer, single consumer byte ring in POSIX shared memory
+     * for handing frames to another process on the same host
+     *
+     *     header | data (capacity bytes)
+     *
+     * Records are a length word and the payload, padded to 8 bytes, a
+     * record never wraps, a pad record skips the tail end of the data
+     * instead. Both sides only ever wait on nothing: a full ring refuses
+     * the push, an empty one returns nothing
+     */
+    class SharedRing {
+    public:
+        static constexpr unsigned magic_value = 0x474e5253; // "SRNG"
+        static constexpr unsigned current_version = 1;
+        
+        struct Header {
+            unsigned magic;
+            unsigned version;
+            uint64_t capacity;
+            
+            /*
+             * Running byte counts, never wrapped, on their own cache lines
+             */
+            alignas(64) std::atomic<uint64_t> write;
+            alignas(64) std::atomic<uint64_t> read;
+        };
+        
+        static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring counters are shared between processes");
+    
+    private:
+        Header * header = nullptr;
+        unsigned char * data = nullptr;
+        unsigned long mapped_bytes = 0;
+        bool owner = false;
+        char name[64] = {};
+        unsigned long corrupted = 0;
+        
+        bool map(int fd, unsigned long bytes);
+    
+    public:
+        SharedRing() {}
+        ~SharedRing() { close(); }
+        
+        SharedRing(const SharedRing &) = delete;
+        SharedRing & operator=(const SharedRing &) = delete;
+        
+        /**
+         * Producer side, a fresh ring of at least capacity bytes under
+         * name ("/something"), replacing any left behind
+         */
+        bool create(const char * name, unsigned long capacity);
+        
+        /**
+         * Consumer side, attach to a ring another process created
+         */
+        bool open(const char * name);
+        
+        /**
+         * Unmap, the producer also removes the name
+         */
+        void close();
+        
+        /**
+         * Copy a record in, false when it doesn't fit right now
+         */
+        bool push(const void * bytes, unsigned size);
+        
+        /**
+         * Take the oldest record, reusing out's storage
+         * A length word that doesn't fit the ring marks it corrupt,
+         * everything written so far is dropped
+         */
+        bool pop(std::vector<unsigned char> &out);
+        
+        bool is_open() const { return header != nullptr; }
+        unsigned long capacity() const { return header ? header->capacity : 0; }
+        unsigned long get_corrupted() const { return corrupted; }
+    };
+    
+    
+    
+    /**
+     * Frame layout written by DeltaEncoder
+     *
+     *     FrameHeader | bit stream
+     *
+     * The bit stream lists the objects that changed, as a bit mask or
+     * as indices whichever is shorter, then every changed object's
+     * zigzagged differences from the last frame: x y z in position_bits
+     * each and r i j k in orientation_bits each. A keyframe lists every
+     * object against zero, so a consumer can start from it
+     */
+    struct FrameHeader {
+        enum Flags {
+            KEYFRAME = 1,
+            ORIENTATIONS = 2,
+            INDEXED = 4
+        };
+        
+        /*
+         * Most objects a frame may carry, decoders reject anything above
+         */
+        static constexpr unsigned max_count = 1u << 24;
+        
+        uint64_t step;
+        double resolution;
+        real time;
+        unsigned count;
+        unsigned changed;
+        unsigned char flags;
+        unsigned char position_bits;
+        unsigned char orientation_bits;
+        unsigned char index_bits;
+    };
+    
+    
+    
+    /**
+     * Turns snapshots into frames holding only what moved
+     * Positions are fixed point multiples of resolution and orientation
+     * components are scaled to int16, an object only goes out when one
+     * of those changed. Frames are deltas from the last committed frame,
+     * so a frame that couldn't be delivered is simply not committed and
+     * the next one covers both
+     */
+    class DeltaEncoder {
+        double resolution;
+        bool orientations;
+        unsigned keyframe_interval;
+        
+        /*
+         * Quantized state the consumer has, and the state of the frame
+         * waiting on commit
+         */
+        std::vector<int32_t> sent_positions;
+        std::vector<int16_t> sent_orientations;
+        std::vector<int32_t> positions;
+        std::vector<int16_t> orientations_q;
+        std::vector<unsigned> changed;
+        
+        unsigned since_keyframe = 0;
+        bool has_baseline = false;
+        
+        /*
+         * Bytes committed frames would have taken raw and took encoded,
+         * and the same for the frame waiting on commit
+         */
+        unsigned long raw_bytes = 0;
+        unsigned long encoded_bytes = 0;
+        bool pending_keyframe = false;
+        unsigned long pending_raw = 0;
+        unsigned long pending_encoded = 0;
+    
+    public:
+        /**
+         * resolution in metres, 1/4096 keeps a range of +-500 km
+         * keyframe_interval frames between keyframes, for late consumers
+         */
+        DeltaEncoder(double resolution = 1.0 / 4096, bool orientations = false, unsigned keyframe_interval = 60)
+            : resolution(resolution), orientations(orientations), keyframe_interval(keyframe_interval) {}
+        
+        /**
+         * Encode snapshot against the committed state into out
+         * Up to FrameHeader::max_count objects, decoders drop bigger frames
+         */
+        void encode(const Snapshot &snapshot, std::vector<unsigned char> &out);
+        
+        /**
+         * The last encoded frame reached the consumer, make it the base
+         */
+        void commit();
+        
+        /**
+         * Make the next frame a keyframe
+         */
+        void request_keyframe() { has_baseline = false; }
+        
+        unsigned long get_raw_bytes() const { return raw_bytes; }
+        unsigned long get_encoded_bytes() const { return encoded_bytes; }
+    };
+    
+    
+    
+    /**
+     * Rebuilds snapshots from DeltaEncoder frames, in order
+     */
+    class DeltaDecoder {
+        std::vector<int32_t> positions;
+        std::vector<int16_t> orientations;
+        std::vector<unsigned> changed;
+        bool synced = false;
+    
+    public:
+        /**
+         * Apply frame and write the full state into snapshot
+         * Deltas before the first keyframe are skipped (false)
+         */
+        bool decode(const unsigned char * frame, unsigned size, Snapshot &snapshot);
+        
+        /**
+         * Frames went missing, wait for the next keyframe
+         */
+        void reset() { synced = false; }
+        
+        bool is_synced() const { return synced; }
+    };
+    
+    
+    
+    /**
+     * Encoder and ring together, the producer end of a mirror
+     *
+     *     MirrorPublisher mirror;
+     *     mirror.open("/msim495-world");
+     *     ...
+     *     capture_particles(particles, frame);
+     *     mirror.publish(frame);
+     */
+    class MirrorPublisher {
+        SharedRing ring;
+        DeltaEncoder encoder;
+        std::vector<unsigned char> buffer;
+        unsigned long dropped = 0;
+    
+    public:
+        MirrorPublisher(double resolution = 1.0 / 4096, bool orientations = false)
+            : encoder(resolution, orientations) {}
+        
+        /**
+         * A fresh ring has fresh consumers, the first frame is a keyframe
+         */
+        bool open(const char * name, unsigned long capacity = 4 << 20) {
+            encoder.request_keyframe();
+            return ring.create(name, capacity);
+        }
+        
+        void close() { ring.close(); }
+        bool is_open() const { return ring.is_open(); }
+        
+        /**
+         * False when the consumer is behind and the frame didn't fit,
+         * the next publish carries the changes anyway
+         */
+        bool publish(const Snapshot &snapshot);
+        
+        const DeltaEncoder & get_encoder() const { return encoder; }
+        unsigned long get_dropped() const { return dropped; }
+    };
+    
+    /**
+     * Consumer end of a mirror
+     */
+    class MirrorSubscriber {
+        SharedRing ring;
+        DeltaDecoder decoder;
+        std::vector<unsigned char> buffer;
+    
+    public:
+        bool open(const char * name) { return ring.open(name); }
+        void close() { ring.close(); }
+        bool is_open() const { return ring.is_open(); }
+        
+        /**
+         * Apply every frame waiting, snapshot ends up at the newest
+         * Returns the number of frames applied
+         */
+        unsigned poll(Snapshot &snapshot);
+    };
+}
+
+#endif /* defined(__MSIM495__mirror__) */
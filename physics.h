@@ -18,5 +18,15 @@
 #include "collision.h"
 #include "engine.h"
 #include "collisionengine.h"
+#include "jobs.h"
+#include "simulation.h"
+#include "commands.h"
+#include "checkpoint.h"
+#include "trajectory.h"
+#include "scene.h"
+#include "pool.h"
+#include "contactcache.h"
+#include "mirror.h"
+#include "memstats.h"
 
 #endif
@@ -15,6 +15,7 @@
 #include <vector>
 #include "core.h"
 #include "collisionengine.h"
+#include "memstats.h"
 
 #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
 
@@ -36,7 +37,7 @@
 
 // Pseudo-class to deal with C-API
 namespace Graphics {
-    std::vector<std::function<void(void)>> draw_pipeline;
+    std::vector<std::function<void(void)>, Physics::TaggedAllocator<std::function<void(void)>, Physics::MEMORY_RENDER>> draw_pipeline;
     // correspond with key_cache to programmatically register key callbacks
     std::function<void(void)> fire_callback[KEY_CACHE_SIZE];
     std::function<void(unsigned char, int, int)> ext_key_function;
@@ -93,6 +94,8 @@ namespace Graphics {
     }
     
     void push_draw_pipeline(std::function<void(void)> func) {
+        // The copy's captures count as render memory
+        Physics::MemoryScope scope(Physics::MEMORY_RENDER);
         draw_pipeline.push_back(func);
     }
     
@@ -453,6 +456,7 @@ namespace Graphics {
     }
 
     void display_loop() {
+        Physics::MemoryScope scope(Physics::MEMORY_RENDER);
         track_fps();
     
         glClearColor(COLOR_SKY);
@@ -465,7 +469,7 @@ namespace Graphics {
         std::for_each(
             draw_pipeline.begin(),
             draw_pipeline.end(),
-            [](std::function<void(void)> draw){ draw(); }
+            [](const std::function<void(void)> &draw){ draw(); }
         );
         
         glutSwapBuffers();
@@ -0,0 +1,198 @@
+//
+//  pool.h
+//  MSIM495
+//
+
+#ifndef __MSIM495__pool__
+#define __MSIM495__pool__
+
+#include <vector>
+#include <memory>
+#include <new>
+#include <utility>
+#include <functional>
+#include <assert.h>
+#include "core.h"
+
+namespace Physics {
+    /**
+     * 32 bit reference into a Pool, slot index in the low bits and the
+     * slot's generation in the high bits
+     * A handle goes stale when its object is destroyed, even after the
+     * slot has been reused by something else
+     */
+    struct Handle {
+        static constexpr unsigned index_bits = 20;
+        static constexpr unsigned index_mask = (1u << index_bits) - 1;
+        static constexpr unsigned generation_mask = ~0u >> index_bits;
+        
+        unsigned value = ~0u;
+        
+        Handle() {}
+        Handle(unsigned index, unsigned generation) : value((generation << index_bits) | index) {}
+        
+        unsigned index() const { return value & index_mask; }
+        unsigned generation() const { return value >> index_bits; }
+        bool is_null() const { return value == ~0u; }
+        
+        bool operator==(const Handle &o) const { return value == o.value; }
+        bool operator!=(const Handle &o) const { return value != o.value; }
+    };
+    
+    
+    
+    /**
+     * Slot map with stable addresses
+     * Objects live in fixed size chunks and never move, so pointers taken
+     * from a live handle stay good until that object is destroyed and
+     * code that works on pointers (registries, worlds) keeps working.
+     * Live slots are also kept in a packed list for dense iteration,
+     * freed slots are reused first so churn doesn't spread the pool
+     * 
+     * Despawning a particle a world steps is a REMOVE_PARTICLE command,
+     * then destroy() once the world hands the particle back through
+     * take_removed, never straight after queueing the command
+     */
+    template<typename T, unsigned ChunkSize = 256>
+    class Pool {
+        struct alignas(T) Storage {
+            unsigned char bytes[sizeof(T)];
+        };
+        
+        std::vector<std::unique_ptr<Storage[]>> chunks;
+        std::vector<unsigned> generations;
+        std::vector<unsigned> free_slots;
+        
+        /*
+         * Slots of the live objects packed together, and every live
+         * slot's position in that list
+         */
+        std::vector<unsigned> live;
+        std::vector<unsigned> live_position;
+        
+        T * slot(unsigned index) const {
+            return reinterpret_cast<T*>(chunks[index / ChunkSize][index % ChunkSize].bytes);
+        }
+    
+    public:
+        Pool() {}
+        ~Pool() { clear(); }
+        
+        Pool(const Pool &) = delete;
+        Pool & operator=(const Pool &) = delete;
+        
+        /**
+         * Construct an object in a free slot
+         */
+        template<typename... Args>
+        Handle create(Args &&... args) {
+            unsigned index;
+            if (!free_slots.empty()) {
+                index = free_slots.back();
+                free_slots.pop_back();
+            }
+            else {
+                index = static_cast<unsigned>(generations.size());
+                assert(index <= Handle::index_mask);
+                if (index % ChunkSize == 0) chunks.emplace_back(new Storage[ChunkSize]);
+                generations.push_back(0);
+                live_position.push_back(0);
+            }
+            
+            new (slot(index)) T(std::forward<Args>(args)...);
+            live_position[index] = static_cast<unsigned>(live.size());
+            live.push_back(index);
+            return Handle(index, generations[index]);
+        }
+        
+        /**
+         * Destroy the object, false when the handle was already stale
+         */
+        bool destroy(Handle h) {
+            if (!alive(h)) return false;
+            
+            const unsigned index = h.index();
+            slot(index)->~T();
+            
+            // Swap the last live slot into the hole, the same swap a world
+            // does on its particle list, so gather() still lines up with it
+            const unsigned position = live_position[index];
+            const unsigned moved = live.back();
+            live[position] = moved;
+            live_position[moved] = position;
+            live.pop_back();
+            
+            // A slot whose generation would wrap is retired, never reused,
+            // so an old handle can't come back to life
+            if (++generations[index] <= Handle::generation_mask) free_slots.push_back(index);
+            return true;
+        }
+        
+        bool alive(Handle h) const {
+            const unsigned index = h.index();
+            return !h.is_null()
+                && index < generations.size()
+                && generations[index] == h.generation()
+                && live_position[index] < live.size()
+                && live[live_position[index]] == index;
+        }
+        
+        /**
+         * Object of a live handle, nullptr for a stale one
+         */
+        T * get(Handle h) const { return alive(h) ? slot(h.index()) : nullptr; }
+        
+        /**
+         * Handle of a live object from its address, null handle for
+         * anything else
+         */
+        Handle handle_of(const T * object) const {
+            std::less<const T*> before;
+            for (unsigned c = 0; c < chunks.size(); ++c) {
+                const T * first = slot(c * ChunkSize);
+                if (before(object, first) || !before(object, first + ChunkSize)) continue;
+                
+                const unsigned index = c * ChunkSize + static_cast<unsigned>(object - first);
+                if (index >= generations.size()) return Handle();
+                
+                const Handle h(index, generations[index]);
+                return alive(h) ? h : Handle();
+            }
+            return Handle();
+        }
+        
+        /**
+         * Dense access to live objects, i in 0..size()
+         * Destroying an object moves the last one into its place
+         */
+        unsigned size() const { return static_cast<unsigned>(live.size()); }
+        T & live_object(unsigned i) const { return *slot(live[i]); }
+        Handle live_handle(unsigned i) const { return Handle(live[i], generations[live[i]]); }
+        
+        template<typename F>
+        void for_each(F f) const {
+            for (unsigned i = 0; i < live.size(); ++i) f(*slot(live[i]));
+        }
+        
+        /**
+         * Write the addresses of the live objects, in dense order
+         * e.g. the particle list a ParticleWorld steps
+         */
+        void gather(std::vector<T*> &out) const {
+            out.resize(live.size());
+            for (unsigned i = 0; i < live.size(); ++i) out[i] = slot(live[i]);
+        }
+        
+        /**
+         * Destroy everything, every handle handed out goes stale
+         */
+        void clear() {
+            while (!live.empty()) destroy(live_handle(size() - 1));
+        }
+    };
+    
+    typedef Pool<Particle> ParticlePool;
+    typedef Pool<RigidBody> BodyPool;
+}
+
+#endif /* defined(__MSIM495__pool__) */
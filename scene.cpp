@@ -0,0 +1,479 @@
+//
+//  scene.cpp
+//  MSIM495
+//
+
+#include "scene.h"
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace Physics {
+    static void grow_bounds(SceneRegion &r, const real * p) {
+        for (unsigned c = 0; c < 3; ++c) {
+            if (p[c] < r.min[c]) r.min[c] = p[c];
+            if (p[c] > r.max[c]) r.max[c] = p[c];
+        }
+    }
+    
+    static void make_empty(SceneRegion &r) {
+        for (unsigned c = 0; c < 3; ++c) {
+            r.min[c] = FLT_MAX;
+            r.max[c] = -FLT_MAX;
+        }
+    }
+    
+    /*
+     * Bounds of a fitted region, everything with a position in it
+     */
+    static SceneRegion fitted_bounds(const SceneDescription::Region &region) {
+        SceneRegion r = region.bounds;
+        if (region.explicit_bounds) return r;
+        
+        make_empty(r);
+        for (const SceneParticle &p : region.particles) grow_bounds(r, p.position);
+        for (const SceneBody &b : region.bodies) grow_bounds(r, b.position);
+        for (const ScenePlane &p : region.planes) grow_bounds(r, p.position);
+        
+        // A region without positions still has to load for any query
+        if (r.empty()) {
+            for (unsigned c = 0; c < 3; ++c) {
+                r.min[c] = -FLT_MAX;
+                r.max[c] = FLT_MAX;
+            }
+        }
+        return r;
+    }
+    
+    template<typename T>
+    static void append(std::vector<T> &list, const T * items, unsigned count) {
+        list.insert(list.end(), items, items + count);
+    }
+    
+    template<typename T>
+    static bool write_all(FILE * file, const std::vector<T> &list) {
+        return list.empty() || fwrite(list.data(), sizeof(T), list.size(), file) == list.size();
+    }
+    
+    
+    
+    // SceneDescription //
+    //////////////////////
+    
+    SceneDescription::Region & SceneDescription::current() {
+        if (regions.empty()) regions.push_back(Region());
+        return regions.back();
+    }
+    
+    void SceneDescription::begin_region(const SceneRegion &region) {
+        Region r;
+        r.bounds = region;
+        r.explicit_bounds = !region.empty();
+        regions.push_back(r);
+    }
+    
+    void SceneDescription::add_particles(const SceneParticle * particles, unsigned count) {
+        append(current().particles, particles, count);
+    }
+    
+    void SceneDescription::add_bodies(const SceneBody * bodies, unsigned count) {
+        append(current().bodies, bodies, count);
+    }
+    
+    void SceneDescription::add_planes(const ScenePlane * planes, unsigned count) {
+        append(current().planes, planes, count);
+    }
+    
+    void SceneDescription::add_forces(const SceneForce * forces, unsigned count) {
+        append(current().forces, forces, count);
+    }
+    
+    void SceneDescription::add_constraints(const SceneConstraint * constraints, unsigned count) {
+        append(current().constraints, constraints, count);
+    }
+    
+    bool SceneDescription::save(const char * path) const {
+        FILE * file = fopen(path, "wb");
+        if (!file) return false;
+        
+        SceneReader::Header header = {};
+        header.magic = SceneReader::magic;
+        header.version = SceneReader::version;
+        header.region_count = static_cast<unsigned>(regions.size());
+        
+        // Records start right after the table, regions back to back
+        std::vector<SceneRegion> table(regions.size());
+        unsigned long offset = sizeof(SceneReader::Header) + table.size() * sizeof(SceneRegion);
+        for (unsigned i = 0; i < regions.size(); ++i) {
+            const Region &region = regions[i];
+            SceneRegion &r = table[i];
+            r = fitted_bounds(region);
+            r.particles = static_cast<unsigned>(region.particles.size());
+            r.bodies = static_cast<unsigned>(region.bodies.size());
+            r.planes = static_cast<unsigned>(region.planes.size());
+            r.forces = static_cast<unsigned>(region.forces.size());
+            r.constraints = static_cast<unsigned>(region.constraints.size());
+            r.reserved = 0;
+            r.offset = offset;
+            offset += r.bytes();
+        }
+        
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && write_all(file, table);
+        for (unsigned i = 0; ok && i < regions.size(); ++i) {
+            const Region &region = regions[i];
+            ok = write_all(file, region.particles)
+                && write_all(file, region.bodies)
+                && write_all(file, region.planes)
+                && write_all(file, region.forces)
+                && write_all(file, region.constraints);
+        }
+        
+        return fclose(file) == 0 && ok;
+    }
+    
+    bool SceneDescription::save_text(const char * path) const {
+        FILE * file = fopen(path, "w");
+        if (!file) return false;
+        
+        for (const Region &region : regions) {
+            const SceneRegion &b = region.bounds;
+            if (region.explicit_bounds) {
+                fprintf(file, "region %g %g %g %g %g %g\n", b.min[0], b.min[1], b.min[2], b.max[0], b.max[1], b.max[2]);
+            }
+            else fprintf(file, "region\n");
+            
+            for (const SceneParticle &p : region.particles) {
+                fprintf(
+                    file, "particle %g %g %g %g %g %g %g %g\n",
+                    p.position[0], p.position[1], p.position[2],
+                    p.velocity[0], p.velocity[1], p.velocity[2],
+                    p.mass, p.damping
+                );
+            }
+            for (const SceneBody &b : region.bodies) {
+                fprintf(
+                    file, "body %g %g %g %g %g %g %g %g %g %g %g %g %g %g %g %g\n",
+                    b.position[0], b.position[1], b.position[2],
+                    b.velocity[0], b.velocity[1], b.velocity[2],
+                    b.orientation[0], b.orientation[1], b.orientation[2], b.orientation[3],
+                    b.inertia[0], b.inertia[1], b.inertia[2],
+                    b.mass, b.linear_damping, b.angular_damping
+                );
+            }
+            for (const ScenePlane &p : region.planes) {
+                fprintf(
+                    file, "plane %g %g %g %g %g %g\n",
+                    p.position[0], p.position[1], p.position[2],
+                    p.direction[0], p.direction[1], p.direction[2]
+                );
+            }
+            for (const SceneForce &f : region.forces) {
+                fprintf(file, "force %u %u\n", f.particle, f.generator);
+            }
+            for (const SceneConstraint &c : region.constraints) {
+                if (c.type == SceneConstraint::ROD) fprintf(file, "rod %u %u %g\n", c.left, c.right, c.length);
+                else fprintf(file, "cable %u %u %g %g\n", c.left, c.right, c.length, c.restitution);
+            }
+        }
+        
+        return fclose(file) == 0;
+    }
+    
+    
+    
+    // Text Loader //
+    /////////////////
+    
+    /*
+     * Parse one record line into sink, false if it's malformed
+     */
+    static bool parse_record(const char * line, SceneSink &sink) {
+        char kind[16];
+        int used = 0;
+        if (sscanf(line, "%15s%n", kind, &used) != 1) return true;
+        if (kind[0] == '#') return true;
+        const char * args = line + used;
+        
+        if (!strcmp(kind, "region")) {
+            SceneRegion r = {};
+            int n = sscanf(args, "%f %f %f %f %f %f", &r.min[0], &r.min[1], &r.min[2], &r.max[0], &r.max[1], &r.max[2]);
+            if (n <= 0) make_empty(r);
+            else if (n != 6) return false;
+            sink.begin_region(r);
+        }
+        else if (!strcmp(kind, "particle")) {
+            SceneParticle p = {};
+            p.damping = DampingTable::default_damping;
+            int n = sscanf(
+                args, "%f %f %f %f %f %f %f %f",
+                &p.position[0], &p.position[1], &p.position[2],
+                &p.velocity[0], &p.velocity[1], &p.velocity[2],
+                &p.mass, &p.damping
+            );
+            if (n != 3 && n < 6) return false;
+            sink.add_particles(&p, 1);
+        }
+        else if (!strcmp(kind, "body")) {
+            SceneBody b = {};
+            int n = sscanf(
+                args, "%f %f %f %f %f %f %f %f %f %f %f %f %f %f %f %f",
+                &b.position[0], &b.position[1], &b.position[2],
+                &b.velocity[0], &b.velocity[1], &b.velocity[2],
+                &b.orientation[0], &b.orientation[1], &b.orientation[2], &b.orientation[3],
+                &b.inertia[0], &b.inertia[1], &b.inertia[2],
+                &b.mass, &b.linear_damping, &b.angular_damping
+            );
+            if (n != 16) return false;
+            sink.add_bodies(&b, 1);
+        }
+        else if (!strcmp(kind, "plane")) {
+            ScenePlane p;
+            int n = sscanf(
+                args, "%f %f %f %f %f %f",
+                &p.position[0], &p.position[1], &p.position[2],
+                &p.direction[0], &p.direction[1], &p.direction[2]
+            );
+            if (n != 6) return false;
+            sink.add_planes(&p, 1);
+        }
+        else if (!strcmp(kind, "force")) {
+            SceneForce f;
+            if (sscanf(args, "%u %u", &f.particle, &f.generator) != 2) return false;
+            sink.add_forces(&f, 1);
+        }
+        else if (!strcmp(kind, "rod")) {
+            SceneConstraint c = {};
+            c.type = SceneConstraint::ROD;
+            if (sscanf(args, "%u %u %f", &c.left, &c.right, &c.length) != 3) return false;
+            sink.add_constraints(&c, 1);
+        }
+        else if (!strcmp(kind, "cable")) {
+            SceneConstraint c = {};
+            c.type = SceneConstraint::CABLE;
+            if (sscanf(args, "%u %u %f %f", &c.left, &c.right, &c.length, &c.restitution) != 4) return false;
+            sink.add_constraints(&c, 1);
+        }
+        else return false;
+        
+        return true;
+    }
+    
+    bool load_scene_text(const char * path, SceneSink &sink) {
+        FILE * file = fopen(path, "r");
+        if (!file) return false;
+        
+        char line[512];
+        unsigned number = 0;
+        bool ok = true;
+        while (ok && fgets(line, sizeof(line), file)) {
+            ++number;
+            ok = parse_record(line, sink);
+            if (!ok) fprintf(stderr, "%s:%u: bad scene record\n", path, number);
+        }
+        
+        fclose(file);
+        return ok;
+    }
+    
+    
+    
+    // SceneReader //
+    /////////////////
+    
+    bool SceneReader::open(const char * path) {
+        close();
+        
+        fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+        
+        Header header;
+        struct stat info;
+        if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+            || header.magic != magic
+            || header.version != version
+            || fstat(fd, &info) != 0
+        ) {
+            close();
+            return false;
+        }
+        
+        // The region table and every region's records have to be in the file
+        const unsigned long size = info.st_size;
+        if (header.region_count > (size - sizeof(header)) / sizeof(SceneRegion)) {
+            close();
+            return false;
+        }
+        
+        regions.resize(header.region_count);
+        ssize_t table_bytes = regions.size() * sizeof(SceneRegion);
+        if (table_bytes && pread(fd, regions.data(), table_bytes, sizeof(header)) != table_bytes) {
+            close();
+            return false;
+        }
+        
+        for (const SceneRegion &r : regions) {
+            if (r.offset > size || r.bytes() > size - r.offset) {
+                close();
+                return false;
+            }
+        }
+        
+        loaded.assign(regions.size(), false);
+        return true;
+    }
+    
+    void SceneReader::close() {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+        regions.clear();
+        loaded.clear();
+    }
+    
+    bool SceneReader::load_region(unsigned index, SceneSink &sink) {
+        if (fd < 0 || index >= regions.size()) return false;
+        if (loaded[index]) return true;
+        
+        const SceneRegion &r = regions[index];
+        const ssize_t bytes = r.bytes();
+        buffer.resize(bytes);
+        if (bytes && pread(fd, buffer.data(), bytes, r.offset) != bytes) return false;
+        
+        // Records are 4 byte fields, the buffer is at least that aligned
+        const unsigned char * at = buffer.data();
+        sink.begin_region(r);
+        sink.add_particles(reinterpret_cast<const SceneParticle*>(at), r.particles);
+        at += r.particles * sizeof(SceneParticle);
+        sink.add_bodies(reinterpret_cast<const SceneBody*>(at), r.bodies);
+        at += r.bodies * sizeof(SceneBody);
+        sink.add_planes(reinterpret_cast<const ScenePlane*>(at), r.planes);
+        at += r.planes * sizeof(ScenePlane);
+        sink.add_forces(reinterpret_cast<const SceneForce*>(at), r.forces);
+        at += r.forces * sizeof(SceneForce);
+        sink.add_constraints(reinterpret_cast<const SceneConstraint*>(at), r.constraints);
+        
+        loaded[index] = true;
+        return true;
+    }
+    
+    unsigned SceneReader::load_within(const Vector3 &lo, const Vector3 &hi, SceneSink &sink) {
+        unsigned count = 0;
+        for (unsigned i = 0; i < regions.size(); ++i) {
+            if (loaded[i] || !regions[i].overlaps(lo, hi)) continue;
+            if (load_region(i, sink)) ++count;
+        }
+        return count;
+    }
+    
+    bool SceneReader::load_all(SceneSink &sink) {
+        for (unsigned i = 0; i < regions.size(); ++i) {
+            if (!load_region(i, sink)) return false;
+        }
+        return true;
+    }
+    
+    
+    
+    // SceneStore //
+    ////////////////
+    
+    void SceneStore::attach(ParticleWorld * w, const GeneratorTable * g) {
+        world = w;
+        generators = g;
+        
+        world->pass_particles(&pointers);
+        world->contact_generators.push_back(&rods);
+        world->contact_generators.push_back(&cables);
+        register_links();
+    }
+    
+    void SceneStore::register_links() {
+        if (!world || !generators) return;
+        
+        for (const SceneForce &f : links) {
+            if (f.generator < generators->forces.size()) {
+                world->registry.add(pointers[f.particle], generators->forces[f.generator]);
+            }
+        }
+        links.clear();
+    }
+    
+    void SceneStore::begin_region(const SceneRegion &) {
+        region_base = static_cast<unsigned>(pointers.size());
+    }
+    
+    void SceneStore::add_particles(const SceneParticle * records, unsigned count) {
+        for (unsigned i = 0; i < count; ++i) {
+            const SceneParticle &r = records[i];
+            particles.emplace_back(r.position[0], r.position[1], r.position[2]);
+            
+            Particle &p = particles.back();
+            p.set_velocity(Vector3(r.velocity[0], r.velocity[1], r.velocity[2]));
+            p.set_mass(r.mass);
+            p.set_damping(r.damping);
+            pointers.push_back(&p);
+        }
+    }
+    
+    void SceneStore::add_bodies(const SceneBody * records, unsigned count) {
+        bodies.reserve(bodies.size() + count);
+        for (unsigned i = 0; i < count; ++i) {
+            const SceneBody &r = records[i];
+            bodies.emplace_back();
+            
+            RigidBody &b = bodies.back();
+            b.set_awake(true);
+            b.set_can_sleep(false);
+            b.set_position(Vector3(r.position[0], r.position[1], r.position[2]));
+            b.set_velocity(Vector3(r.velocity[0], r.velocity[1], r.velocity[2]));
+            b.set_acceleration(Vector3());
+            b.set_rotation(Vector3());
+            b.set_orientation(Quaternion(r.orientation[0], r.orientation[1], r.orientation[2], r.orientation[3]));
+            b.set_inertia_tensor(Matrix3(
+                r.inertia[0], 0, 0,
+                0, r.inertia[1], 0,
+                0, 0, r.inertia[2]
+            ));
+            b.set_mass(r.mass);
+            b.set_damping(r.linear_damping, r.angular_damping);
+            b.clear_accumulator();
+            b.calculate_derived_data();
+        }
+    }
+    
+    void SceneStore::add_planes(const ScenePlane * records, unsigned count) {
+        planes.reserve(planes.size() + count);
+        for (unsigned i = 0; i < count; ++i) {
+            const ScenePlane &r = records[i];
+            planes.push_back(Plane(
+                Vector3(r.position[0], r.position[1], r.position[2]),
+                Vector3(r.direction[0], r.direction[1], r.direction[2])
+            ));
+        }
+    }
+    
+    void SceneStore::add_forces(const SceneForce * records, unsigned count) {
+        // Local indices are checked before the add, a bad one could wrap
+        const unsigned region_size = static_cast<unsigned>(pointers.size()) - region_base;
+        for (unsigned i = 0; i < count; ++i) {
+            if (records[i].particle >= region_size) continue;
+            links.push_back(SceneForce{region_base + records[i].particle, records[i].generator});
+        }
+        register_links();
+    }
+    
+    void SceneStore::add_constraints(const SceneConstraint * records, unsigned count) {
+        const unsigned region_size = static_cast<unsigned>(pointers.size()) - region_base;
+        for (unsigned i = 0; i < count; ++i) {
+            const SceneConstraint &r = records[i];
+            if (r.left >= region_size || r.right >= region_size) continue;
+            
+            const unsigned left = region_base + r.left;
+            const unsigned right = region_base + r.right;
+            if (r.type == SceneConstraint::ROD) rods.add(left, right, r.length);
+            else cables.add(left, right, r.length, r.restitution);
+        }
+    }
+}
@@ -0,0 +1,291 @@
+//
+//  scene.h
+//  MSIM495
+//
+
+#ifndef __MSIM495__scene__
+#define __MSIM495__scene__
+
+#include <vector>
+#include <deque>
+#include "core.h"
+#include "collision.h"
+#include "collisionengine.h"
+#include "engine.h"
+#include "checkpoint.h"
+
+namespace Physics {
+    /**
+     * Scene records, plain 32 bit fields so the binary format is
+     * exactly these structs back to back
+     */
+    struct SceneParticle {
+        real position[3];
+        real velocity[3];
+        real mass;
+        real damping;
+    };
+    
+    struct SceneBody {
+        real position[3];
+        real velocity[3];
+        real orientation[4];
+        real inertia[3];
+        real mass;
+        real linear_damping;
+        real angular_damping;
+    };
+    
+    struct ScenePlane {
+        real position[3];
+        real direction[3];
+    };
+    
+    /**
+     * Force link, generator is an ID into the loader's GeneratorTable
+     */
+    struct SceneForce {
+        unsigned particle;
+        unsigned generator;
+    };
+    
+    struct SceneConstraint {
+        enum Type { ROD, CABLE };
+        
+        unsigned type;
+        unsigned left;
+        unsigned right;
+        real length;
+        real restitution;
+    };
+    
+    /**
+     * Part of a scene that loads as a unit
+     * Particle indices in forces and constraints are local to the region
+     */
+    struct SceneRegion {
+        real min[3];
+        real max[3];
+        
+        unsigned particles;
+        unsigned bodies;
+        unsigned planes;
+        unsigned forces;
+        unsigned constraints;
+        unsigned reserved;
+        
+        /*
+         * Byte offset of the region's records in the binary file
+         */
+        unsigned long offset;
+        
+        unsigned long bytes() const {
+            return particles * sizeof(SceneParticle)
+                + bodies * sizeof(SceneBody)
+                + planes * sizeof(ScenePlane)
+                + forces * sizeof(SceneForce)
+                + constraints * sizeof(SceneConstraint);
+        }
+        
+        bool empty() const { return min[0] > max[0] || min[1] > max[1] || min[2] > max[2]; }
+        
+        bool overlaps(const Vector3 &lo, const Vector3 &hi) const {
+            return min[0] <= hi.x && max[0] >= lo.x
+                && min[1] <= hi.y && max[1] >= lo.y
+                && min[2] <= hi.z && max[2] >= lo.z;
+        }
+    };
+    
+    
+    
+    /**
+     * Receives a scene as it's read, a region at a time, records in
+     * the order particles, bodies, planes, forces, constraints
+     */
+    class SceneSink {
+    public:
+        virtual ~SceneSink() {}
+        
+        virtual void begin_region(const SceneRegion &) {}
+        virtual void add_particles(const SceneParticle *, unsigned) {}
+        virtual void add_bodies(const SceneBody *, unsigned) {}
+        virtual void add_planes(const ScenePlane *, unsigned) {}
+        virtual void add_forces(const SceneForce *, unsigned) {}
+        virtual void add_constraints(const SceneConstraint *, unsigned) {}
+    };
+    
+    
+    
+    /**
+     * Whole scene in memory, for authoring and converting between the
+     * text and binary forms
+     */
+    class SceneDescription : public SceneSink {
+    public:
+        struct Region {
+            SceneRegion bounds = {};
+            
+            /*
+             * Off when the bounds should be fitted to the contents on write
+             */
+            bool explicit_bounds = false;
+            
+            std::vector<SceneParticle> particles;
+            std::vector<SceneBody> bodies;
+            std::vector<ScenePlane> planes;
+            std::vector<SceneForce> forces;
+            std::vector<SceneConstraint> constraints;
+        };
+        
+        std::vector<Region> regions;
+        
+        /**
+         * Region records get appended to, records before any begin_region
+         * start a fitted one
+         */
+        Region & current();
+        
+        /**
+         * An empty box (min above max) asks for fitted bounds
+         */
+        virtual void begin_region(const SceneRegion &region);
+        virtual void add_particles(const SceneParticle * particles, unsigned count);
+        virtual void add_bodies(const SceneBody * bodies, unsigned count);
+        virtual void add_planes(const ScenePlane * planes, unsigned count);
+        virtual void add_forces(const SceneForce * forces, unsigned count);
+        virtual void add_constraints(const SceneConstraint * constraints, unsigned count);
+        
+        /**
+         * Binary file, header | region table | region records
+         */
+        bool save(const char * path) const;
+        
+        /**
+         * Text twin, one record per line
+         *
+         *     region min_x min_y min_z max_x max_y max_z
+         *     particle x y z [vx vy vz [mass [damping]]]
+         *     body x y z vx vy vz r i j k ix iy iz mass linear_damping angular_damping
+         *     plane x y z nx ny nz
+         *     force particle generator
+         *     rod left right length
+         *     cable left right max_length restitution
+         *
+         * '#' starts a comment, a bare "region" starts a region whose
+         * bounds are fitted to what it holds
+         */
+        bool save_text(const char * path) const;
+    };
+    
+    /**
+     * Stream a text scene into sink line by line
+     * Returns false on a missing file or a malformed line
+     */
+    bool load_scene_text(const char * path, SceneSink &sink);
+    
+    
+    
+    /**
+     * Binary scene with random access to regions
+     * Opening reads the header and region table only, every region
+     * loads with a single read straight into a reused buffer
+     */
+    class SceneReader {
+        int fd = -1;
+        std::vector<SceneRegion> regions;
+        std::vector<bool> loaded;
+        std::vector<unsigned char> buffer;
+    
+    public:
+        static constexpr unsigned magic = 0x4e435353; // "SSCN"
+        static constexpr unsigned version = 1;
+        
+        struct Header {
+            unsigned magic;
+            unsigned version;
+            unsigned region_count;
+            unsigned reserved;
+        };
+        
+        SceneReader() {}
+        ~SceneReader() { close(); }
+        
+        SceneReader(const SceneReader &) = delete;
+        SceneReader & operator=(const SceneReader &) = delete;
+        
+        bool open(const char * path);
+        void close();
+        
+        /**
+         * Feed a region to sink, once, returns false on a read error
+         */
+        bool load_region(unsigned index, SceneSink &sink);
+        
+        /**
+         * Load every region not loaded yet that overlaps lo..hi,
+         * returns how many were loaded
+         */
+        unsigned load_within(const Vector3 &lo, const Vector3 &hi, SceneSink &sink);
+        
+        bool load_all(SceneSink &sink);
+        
+        unsigned size() const { return static_cast<unsigned>(regions.size()); }
+        const SceneRegion & region(unsigned index) const { return regions[index]; }
+        bool is_loaded(unsigned index) const { return loaded[index]; }
+    };
+    
+    
+    
+    /**
+     * Builds a loaded scene into live objects
+     * Particles sit in a deque so every pointer handed to a world or
+     * link set stays valid as more regions stream in
+     */
+    class SceneStore : public SceneSink {
+        ParticleWorld * world = nullptr;
+        const GeneratorTable * generators = nullptr;
+        
+        /*
+         * Index in pointers of the current region's first particle
+         */
+        unsigned region_base = 0;
+        
+        /*
+         * Force links loaded before attach, particle as an index in pointers
+         * Registered and dropped once there is a world, the world's removals
+         * would shift those indices afterwards
+         */
+        std::vector<SceneForce> links;
+        
+        void register_links();
+    
+    public:
+        std::deque<Particle> particles;
+        std::vector<Particle*> pointers;
+        std::vector<RigidBody> bodies;
+        BSPPlanes planes;
+        RodSet rods;
+        CableSet cables;
+        
+        SceneStore() : rods(&pointers), cables(&pointers) {}
+        
+        SceneStore(const SceneStore &) = delete;
+        SceneStore & operator=(const SceneStore &) = delete;
+        
+        /**
+         * Simulate the store's particles in world, rods and cables join
+         * its contact generators and force links go into its registry,
+         * generator IDs resolved through generators
+         */
+        void attach(ParticleWorld * world, const GeneratorTable * generators);
+        
+        virtual void begin_region(const SceneRegion &region);
+        virtual void add_particles(const SceneParticle * particles, unsigned count);
+        virtual void add_bodies(const SceneBody * bodies, unsigned count);
+        virtual void add_planes(const ScenePlane * planes, unsigned count);
+        virtual void add_forces(const SceneForce * forces, unsigned count);
+        virtual void add_constraints(const SceneConstraint * constraints, unsigned count);
+    };
+}
+
+#endif /* defined(__MSIM495__scene__) */
@@ -0,0 +1,127 @@
+//
+//  simd.h
+//  MSIM495
+//
+
+#ifndef __MSIM495__simd__
+#define __MSIM495__simd__
+
+/**
+ * 4 lane helpers for the math kernels
+ * Vector3 is padded to 4 floats so it loads straight into one register
+ * Everything falls back to scalar code when SSE2 isn't available
+ */
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PHYSICS_SIMD 1
+#include <emmintrin.h>
+#endif
+
+#ifdef PHYSICS_SIMD
+namespace Physics {
+    namespace SIMD {
+        /**
+         * Lane mask keeping x, y, z and clearing the padding lane
+         */
+        inline __m128 mask3() {
+            const __m128i bits = _mm_set_epi32(0, -1, -1, -1);
+            return _mm_castsi128_ps(bits);
+        }
+        
+        /**
+         * Load a padded vector, padding lane zeroed
+         */
+        inline __m128 load3(const float * v) {
+            return _mm_and_ps(_mm_loadu_ps(v), mask3());
+        }
+        
+        /**
+         * Load a padded vector as a point, padding lane set to 1
+         */
+        inline __m128 load_point(const float * v) {
+            return _mm_or_ps(load3(v), _mm_set_ps(1, 0, 0, 0));
+        }
+        
+        /**
+         * Write back x, y, z only
+         */
+        inline void store3(float * v, __m128 m) {
+            float t[4];
+            _mm_storeu_ps(t, m);
+            v[0] = t[0];
+            v[1] = t[1];
+            v[2] = t[2];
+        }
+        
+        /**
+         * a*x + b*y + c*z, lane wise
+         */
+        inline __m128 combine(__m128 a, __m128 b, __m128 c, __m128 v) {
+            __m128 x = _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0));
+            __m128 y = _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1));
+            __m128 z = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2));
+            return _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(a, x), _mm_mul_ps(b, y)),
+                _mm_mul_ps(c, z)
+            );
+        }
+        
+        /**
+         * Sum of all four lanes of a*b, broadcast to every lane
+         */
+        inline __m128 dot4(__m128 a, __m128 b) {
+            __m128 m = _mm_mul_ps(a, b);
+            __m128 t = _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+            return _mm_add_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 0, 3, 2)));
+        }
+        
+        /**
+         * 1/sqrt(d) from the hardware estimate plus one Newton step
+         * y' = y * (1.5 - 0.5 * d * y * y)
+         */
+        inline __m128 rsqrt(__m128 d) {
+            __m128 y = _mm_rsqrt_ps(d);
+            __m128 half_dyy = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), d), _mm_mul_ps(y, y));
+            return _mm_mul_ps(y, _mm_sub_ps(_mm_set1_ps(1.5f), half_dyy));
+        }
+        
+        /**
+         * Select a where mask is set, b elsewhere
+         */
+        inline __m128 select(__m128 mask, __m128 a, __m128 b) {
+            return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+        }
+        
+        /**
+         * Hamilton product p * m of quaternions stored as (r, i, j, k)
+         */
+        inline __m128 quaternion_product(__m128 p, __m128 m) {
+            __m128 pr = _mm_shuffle_ps(p, p, _MM_SHUFFLE(0, 0, 0, 0));
+            __m128 pi = _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1));
+            __m128 pj = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2));
+            __m128 pk = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3));
+            
+            // (-i, r, -k, j), (-j, k, r, -i), (-k, -j, i, r)
+            __m128 mi = _mm_mul_ps(
+                _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)),
+                _mm_set_ps(1, -1, 1, -1)
+            );
+            __m128 mj = _mm_mul_ps(
+                _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)),
+                _mm_set_ps(-1, 1, 1, -1)
+            );
+            __m128 mk = _mm_mul_ps(
+                _mm_shuffle_ps(m, m, _MM_SHUFFLE(0, 1, 2, 3)),
+                _mm_set_ps(1, 1, -1, -1)
+            );
+            
+            return _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(pr, m), _mm_mul_ps(pi, mi)),
+                _mm_add_ps(_mm_mul_ps(pj, mj), _mm_mul_ps(pk, mk))
+            );
+        }
+    }
+}
+#endif
+
+#endif /* defined(__MSIM495__simd__) */
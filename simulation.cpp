@@ -0,0 +1,99 @@
+//
+//  simulation.cpp
+//  MSIM495
+//
+
+#include "simulation.h"
+#include <chrono>
+
+namespace Physics {
+    // Snapshot //
+    //////////////
+    
+    void capture_particles(const std::vector<Particle*> &particles, Snapshot &snapshot) {
+        snapshot.positions.resize(particles.size());
+        snapshot.orientations.clear();
+        
+        for (unsigned i = 0; i < particles.size(); ++i) {
+            snapshot.positions[i] = particles[i]->get_position();
+        }
+    }
+    
+    void capture_bodies(const std::vector<RigidBody> &bodies, Snapshot &snapshot) {
+        snapshot.positions.resize(bodies.size());
+        snapshot.orientations.resize(bodies.size());
+        
+        for (unsigned i = 0; i < bodies.size(); ++i) {
+            snapshot.positions[i] = bodies[i].get_position();
+            snapshot.orientations[i] = bodies[i].get_orientation();
+        }
+    }
+    
+    
+    
+    // SimulationThread //
+    //////////////////////
+    
+    SimulationThread::SimulationThread(
+        StepFunction step,
+        CaptureFunction capture,
+        real timestep
+    ) : step(step),
+        capture(capture),
+        timestep(timestep)
+    {}
+    
+    SimulationThread::~SimulationThread() {
+        stop();
+    }
+    
+    void SimulationThread::start() {
+        if (running) return;
+        
+        // Renderer gets the starting state before the first step
+        publish();
+        
+        running = true;
+        thread = std::thread([this]() { loop(); });
+    }
+    
+    void SimulationThread::stop() {
+        running = false;
+        if (thread.joinable()) thread.join();
+    }
+    
+    void SimulationThread::publish() {
+        Snapshot &snapshot = snapshots.write_buffer();
+        capture(snapshot);
+        snapshot.step = steps;
+        snapshot.time = steps * timestep;
+        snapshots.publish();
+    }
+    
+    void SimulationThread::loop() {
+        typedef std::chrono::steady_clock Clock;
+        const Clock::duration tick = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<real>(timestep)
+        );
+        
+        Clock::time_point next = Clock::now();
+        while (running) {
+            if (!paused) {
+                step(timestep);
+                ++steps;
+                publish();
+            }
+            
+            // Fixed rate, but don't try to catch up after a long stall
+            next += tick;
+            Clock::time_point now = Clock::now();
+            if (now - next > tick * 4) next = now;
+            std::this_thread::sleep_until(next);
+        }
+    }
+    
+    const Snapshot & SimulationThread::latest() {
+        snapshots.update();
+        return snapshots.read_buffer();
+    }
+}
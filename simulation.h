@@ -0,0 +1,136 @@
+//
+//  simulation.h
+//  MSIM495
+//
+
+#ifndef __MSIM495__simulation__
+#define __MSIM495__simulation__
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include "core.h"
+
+namespace Physics {
+    /**
+     * State the renderer needs from one simulation step
+     */
+    struct Snapshot {
+        std::vector<Vector3> positions;
+        std::vector<Quaternion> orientations;
+        unsigned long step = 0;
+        real time = 0;
+    };
+    
+    /**
+     * Fill a snapshot from a particle list / rigid bodies, reusing its storage
+     */
+    void capture_particles(const std::vector<Particle*> &particles, Snapshot &snapshot);
+    void capture_bodies(const std::vector<RigidBody> &bodies, Snapshot &snapshot);
+    
+    
+    
+    /**
+     * Single writer, single reader triple buffer
+     * The writer fills its back slot and swaps it with the shared slot,
+     * the reader swaps its front slot with the shared one only when
+     * something new was published. Neither side ever waits on the other
+     */
+    template<typename T>
+    class TripleBuffer {
+        static constexpr unsigned index_mask = 3;
+        static constexpr unsigned fresh_bit = 4;
+        
+        T slots[3];
+        
+        /*
+         * Index of the shared slot, fresh_bit set when the reader
+         * hasn't taken it yet
+         */
+        std::atomic<unsigned> shared{1};
+        unsigned back = 0;
+        unsigned front = 2;
+    
+    public:
+        /**
+         * Writer side
+         */
+        T & write_buffer() { return slots[back]; }
+        
+        void publish() {
+            back = shared.exchange(back | fresh_bit, std::memory_order_acq_rel) & index_mask;
+        }
+        
+        /**
+         * Reader side, returns true when read_buffer changed
+         */
+        bool update() {
+            if (!(shared.load(std::memory_order_acquire) & fresh_bit)) return false;
+            front = shared.exchange(front, std::memory_order_acq_rel) & index_mask;
+            return true;
+        }
+        
+        const T & read_buffer() const { return slots[front]; }
+    };
+    
+    
+    
+    /**
+     * Runs a step function at a fixed timestep on its own thread and
+     * publishes a snapshot after every step, so drawing frame N
+     * overlaps simulating step N + 1
+     * The render thread only reads snapshots, anything that changes
+     * simulation state has to happen on the simulation thread
+     */
+    class SimulationThread {
+    public:
+        typedef std::function<void(real)> StepFunction;
+        typedef std::function<void(Snapshot &)> CaptureFunction;
+    
+    private:
+        StepFunction step;
+        CaptureFunction capture;
+        real timestep;
+        
+        TripleBuffer<Snapshot> snapshots;
+        unsigned long steps = 0;
+        
+        std::thread thread;
+        std::atomic<bool> running{false};
+        std::atomic<bool> paused{false};
+        
+        void publish();
+        void loop();
+    
+    public:
+        SimulationThread(
+            StepFunction step,
+            CaptureFunction capture,
+            real timestep = 1.f / 60.f
+        );
+        
+        ~SimulationThread();
+        
+        SimulationThread(const SimulationThread &) = delete;
+        SimulationThread & operator=(const SimulationThread &) = delete;
+        
+        void start();
+        void stop();
+        
+        /**
+         * Paused threads keep their last snapshot and don't step
+         */
+        void set_paused(bool p) { paused = p; }
+        bool is_paused() const { return paused; }
+        
+        real get_timestep() const { return timestep; }
+        
+        /**
+         * Newest published snapshot, render thread only
+         */
+        const Snapshot & latest();
+    };
+}
+
+#endif /* defined(__MSIM495__simulation__) */
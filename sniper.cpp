@@ -13,18 +13,15 @@
 #include <GLUT/glut.h>
 #include "playground.h"
 #include "physics.h"
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
+#include "assets.h"
 
 #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
 
 namespace Sniper {
     struct Image {
-        int width;
-        int height;
-        int bpp;
+        Graphics::ImageRef image;
         unsigned int texture_buffer;
-        unsigned char * data;
+        bool reported;
     };
     
     Physics::Vector3 wind_direction;
@@ -107,14 +104,18 @@ namespace Sniper {
         generate_wind();
     }
     
-    void load_texture(Image * i) {
-        glEnable(GL_TEXTURE_2D);
-        glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-        
-        if (i->texture_buffer != 0) {
-            glBindTexture(GL_TEXTURE_2D, i->texture_buffer);
-        }
-        else {
+    /**
+     * Bind i's texture, uploading it the first time its image is ready
+     * False while it's still decoding or when it failed to load
+     */
+    bool load_texture(Image * i) {
+        if (i->texture_buffer == 0) {
+            if (i->image->is_failed() && !i->reported) {
+                std::cerr << "sniper: " << i->image->path << ": " << i->image->error << std::endl;
+                i->reported = true;
+            }
+            if (!i->image->is_ready()) return false;
+            
             glGenTextures(1, &i->texture_buffer);
             glBindTexture(GL_TEXTURE_2D, i->texture_buffer);
             
@@ -127,15 +128,20 @@ namespace Sniper {
                 GL_TEXTURE_2D,
                 0,
                 GL_RGBA,
-                (GLsizei) i->width,
-                (GLsizei) i->height,
+                (GLsizei) i->image->width,
+                (GLsizei) i->image->height,
                 0,
                 GL_RGBA,
                 GL_UNSIGNED_BYTE,
-                i->data
+                i->image->pixels
             );
         }
-    };
+        
+        glEnable(GL_TEXTURE_2D);
+        glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+        glBindTexture(GL_TEXTURE_2D, i->texture_buffer);
+        return true;
+    }
     
     void scaled_texture_box(float scale) {
         glBegin(GL_POLYGON);
@@ -152,7 +158,10 @@ namespace Sniper {
         unsigned int window_height = glutGet(GLUT_WINDOW_HEIGHT);
         unsigned int window_width = glutGet(GLUT_WINDOW_WIDTH);
         float scale = 500;
-        load_texture(&scope);
+        if (!load_texture(&scope)) {
+            glPopMatrix();
+            return;
+        }
         glColor4f(1.f, 1.f, 1.f, 1.f);
         glTranslatef(window_width/2, window_height/2, 1);
         scaled_texture_box(scale);
@@ -166,27 +175,27 @@ namespace Sniper {
         
         unsigned int window_height = glutGet(GLUT_WINDOW_HEIGHT);
         float scale = 50;
-        load_texture(&wind_arrow);
-        glColor4f(1.f, 1.f, 1.f, 1.f);
-        glTranslatef(100, window_height-60, 1);
-        Physics::Vector3 camera_direction = Graphics::get_camera_direction();
-        camera_direction.normalize();
-        Physics::real angle = wind_direction
-            .angle_2d(Physics::Vector3(camera_direction.x, 0, camera_direction.z));
-        
-        glRotatef(
-            (angle/Physics::pi*180),
-            0, 0, -1
-        );
-        scaled_texture_box(scale);
-        glDisable(GL_TEXTURE_2D);
+        if (load_texture(&wind_arrow)) {
+            glColor4f(1.f, 1.f, 1.f, 1.f);
+            glTranslatef(100, window_height-60, 1);
+            Physics::Vector3 camera_direction = Graphics::get_camera_direction();
+            camera_direction.normalize();
+            Physics::real angle = wind_direction
+                .angle_2d(Physics::Vector3(camera_direction.x, 0, camera_direction.z));
+            
+            glRotatef(
+                (angle/Physics::pi*180),
+                0, 0, -1
+            );
+            scaled_texture_box(scale);
+            glDisable(GL_TEXTURE_2D);
+        }
     
         glPopMatrix();
         
-        char * wp = (char*)malloc(255);
-        sprintf(wp, "Wind Power: %d m/s", wind_power);
-        render_text((const char *)wp, Physics::Vector3(50, window_height - 140, 0));
-        free((void*)wp);
+        char wp[64];
+        snprintf(wp, sizeof(wp), "Wind Power: %d m/s", wind_power);
+        render_text(wp, Physics::Vector3(50, window_height - 140, 0));
     }
 
     void render_bullets() {
@@ -205,7 +214,7 @@ namespace Sniper {
                     targets.end(),
                     [&current_bullet, &index](Physics::Particle t){
                     // Branch if register a hit
-                    if (current_bullet.get_position().distance(t.get_position()) < 1.f) {
+                    if (current_bullet.get_position().within(t.get_position(), 1.f)) {
                         // Kill target
                         targets.erase(targets.begin() + index);
                         // Mark score as distance of shot
@@ -229,10 +238,9 @@ namespace Sniper {
     }
     
     void render_score(unsigned int window_height) {
-        char * score_text = (char *)malloc(255);
-        sprintf(score_text, "Score: %d", (int)score);
-        render_text((const char *)score_text, Physics::Vector3(50, window_height - 160, 0));
-        free((void*)score_text);
+        char score_text[64];
+        snprintf(score_text, sizeof(score_text), "Score: %d", (int)score);
+        render_text(score_text, Physics::Vector3(50, window_height - 160, 0));
     }
     
     void orthographic_stage() {
@@ -293,27 +301,48 @@ namespace Sniper {
         }
     }
 
+    /**
+     * Takes the particles of a scene file as targets
+     */
+    class TargetLoader : public Physics::SceneSink {
+    public:
+        virtual void add_particles(const Physics::SceneParticle * particles, unsigned count) {
+            for (unsigned i = 0; i < count; ++i) {
+                const Physics::real * p = particles[i].position;
+                targets.push_back(Physics::Particle(p[0], p[1], p[2]));
+            }
+        }
+    };
+    
+    /**
+     * Targets come from targets.scene, or its text twin, and fall
+     * back to the built in grid when neither is around
+     */
+    void load_targets() {
+        TargetLoader loader;
+        Physics::SceneReader reader;
+        if (reader.open("targets.scene") && reader.load_all(loader)) return;
+        
+        targets.clear();
+        if (Physics::load_scene_text("targets.scene.txt", loader)) return;
+        
+        targets.clear();
+        generate_targets();
+    }
+    
     int main(int argc, char ** argv) {
         srand((unsigned)time(NULL));
         generate_wind();
         
         Graphics::Graphics(1280, 800, argc, argv);
         
-        scope.data = stbi_load(
-            "scope1.png",
-            &scope.width,
-            &scope.height,
-            &scope.bpp, 4
-        );
+        // PNGs decode in the background while the window comes up,
+        // sniper.assets keeps them decoded between runs
+        Graphics::AssetCache assets("sniper.assets");
+        scope.image = assets.request("scope1.png");
+        wind_arrow.image = assets.request("arrow1.png");
         
-        wind_arrow.data = stbi_load(
-            "arrow1.png",
-            &wind_arrow.width,
-            &wind_arrow.height,
-            &wind_arrow.bpp, 4
-        );
-        
-        generate_targets();
+        load_targets();
         
         Graphics::push_draw_pipeline(zoom_projection);
         Graphics::push_draw_pipeline(Graphics::draw_ground);
@@ -324,8 +353,8 @@ namespace Sniper {
         
         Graphics::start();
         
-        stbi_image_free(scope.data);
-        stbi_image_free(wind_arrow.data);
+        scope.image.reset();
+        wind_arrow.image.reset();
         
         return 0;
     }
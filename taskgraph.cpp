@@ -0,0 +1,150 @@
+//
+//  taskgraph.cpp
+//  MSIM495
+//
+
+#include "taskgraph.h"
+#include <stdio.h>
+#include <assert.h>
+#include <algorithm>
+
+namespace Physics {
+    // TaskGraph //
+    ///////////////
+    
+    unsigned TaskGraph::add_stage(
+        const char * name,
+        ComponentSet reads,
+        ComponentSet writes,
+        Work work
+    ) {
+        Stage stage;
+        stage.name = name;
+        stage.reads = reads;
+        stage.writes = writes;
+        stage.work = work;
+        stages.push_back(stage);
+        
+        dirty = true;
+        return size() - 1;
+    }
+    
+    void TaskGraph::add_dependency(unsigned before, unsigned after) {
+        // Edges only point forward so declaration order stays a valid schedule
+        assert(before < after);
+        stages[after].predecessors.push_back(before);
+        dirty = true;
+    }
+    
+    void TaskGraph::compile() {
+        const unsigned count = size();
+        
+        for (unsigned b = 0; b < count; ++b) {
+            Stage &later = stages[b];
+            for (unsigned a = 0; a < b; ++a) {
+                const Stage &earlier = stages[a];
+                bool conflict = (earlier.writes & (later.reads | later.writes))
+                    || (earlier.reads & later.writes);
+                if (conflict) later.predecessors.push_back(a);
+            }
+            
+            // Explicit and derived edges may overlap
+            std::sort(later.predecessors.begin(), later.predecessors.end());
+            later.predecessors.erase(
+                std::unique(later.predecessors.begin(), later.predecessors.end()),
+                later.predecessors.end()
+            );
+        }
+        
+        for (Stage &s : stages) s.successors.clear();
+        for (unsigned b = 0; b < count; ++b) {
+            for (unsigned a : stages[b].predecessors) stages[a].successors.push_back(b);
+        }
+        
+        remaining.reset(new std::atomic<unsigned>[count]);
+        profile.assign(count, StageProfile());
+        dirty = false;
+    }
+    
+    void TaskGraph::execute(unsigned stage) {
+        typedef std::chrono::duration<double> Seconds;
+        
+        profile[stage].start = Seconds(std::chrono::steady_clock::now() - run_start).count();
+        stages[stage].work();
+        profile[stage].end = Seconds(std::chrono::steady_clock::now() - run_start).count();
+    }
+    
+    void TaskGraph::schedule(TaskGroup &group, unsigned stage) {
+        group.run([this, &group, stage]() {
+            execute(stage);
+            
+            // Last predecessor to finish releases the successor
+            for (unsigned next : stages[stage].successors) {
+                if (--remaining[next] == 0) schedule(group, next);
+            }
+        });
+    }
+    
+    void TaskGraph::run(JobSystem * jobs) {
+        if (dirty) compile();
+        run_start = std::chrono::steady_clock::now();
+        
+        if (!jobs) {
+            for (unsigned i = 0; i < size(); ++i) execute(i);
+        }
+        else {
+            for (unsigned i = 0; i < size(); ++i) {
+                remaining[i] = static_cast<unsigned>(stages[i].predecessors.size());
+            }
+            
+            TaskGroup group(jobs);
+            for (unsigned i = 0; i < size(); ++i) {
+                if (stages[i].predecessors.empty()) schedule(group, i);
+            }
+            group.wait();
+        }
+        
+        wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - run_start).count();
+        find_critical_path();
+    }
+    
+    void TaskGraph::find_critical_path() {
+        const unsigned count = size();
+        if (!count) {
+            critical_time = 0;
+            return;
+        }
+        
+        // Longest chain by stage durations, declaration order is topological
+        std::vector<double> finish(count);
+        std::vector<int> via(count, -1);
+        for (unsigned i = 0; i < count; ++i) {
+            double longest = 0;
+            for (unsigned p : stages[i].predecessors) {
+                if (finish[p] > longest) {
+                    longest = finish[p];
+                    via[i] = p;
+                }
+            }
+            finish[i] = longest + profile[i].duration();
+            profile[i].critical = false;
+        }
+        
+        int last = static_cast<int>(std::max_element(finish.begin(), finish.end()) - finish.begin());
+        critical_time = finish[last];
+        for (int i = last; i >= 0; i = via[i]) profile[i].critical = true;
+    }
+    
+    void TaskGraph::print_profile() const {
+        printf("-- %u stages, wall %.3f ms, critical path %.3f ms --\n",
+            size(), wall_time * 1000, critical_time * 1000);
+        for (unsigned i = 0; i < size(); ++i) {
+            const StageProfile &p = profile[i];
+            printf(
+                "%c %-16s %8.3f -> %8.3f ms (%.3f)\n",
+                p.critical ? '*' : ' ', stages[i].name.c_str(),
+                p.start * 1000, p.end * 1000, p.duration() * 1000
+            );
+        }
+    }
+}
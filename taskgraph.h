@@ -0,0 +1,111 @@
+//
+//  taskgraph.h
+//  MSIM495
+//
+
+#ifndef __MSIM495__taskgraph__
+#define __MSIM495__taskgraph__
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include "jobs.h"
+
+namespace Physics {
+    /**
+     * Dependency graph of frame stages
+     * Stages declare which world components they read and write, a stage
+     * runs after every earlier declared stage it conflicts with (write vs
+     * read or write) and in parallel with everything else
+     * Every run records when each stage ran and which chain of stages
+     * bounded the frame
+     */
+    class TaskGraph {
+    public:
+        /**
+         * One bit per world component, component(n) gives bit n
+         */
+        typedef unsigned long long ComponentSet;
+        static constexpr ComponentSet component(unsigned n) { return 1ull << n; }
+        
+        typedef std::function<void()> Work;
+        
+        /**
+         * Timing of a stage in the last run, seconds from the start of the run
+         */
+        struct StageProfile {
+            double start = 0;
+            double end = 0;
+            double duration() const { return end - start; }
+            bool critical = false;
+        };
+    
+    private:
+        struct Stage {
+            std::string name;
+            ComponentSet reads;
+            ComponentSet writes;
+            Work work;
+            
+            std::vector<unsigned> predecessors;
+            std::vector<unsigned> successors;
+        };
+        
+        std::vector<Stage> stages;
+        std::vector<StageProfile> profile;
+        std::unique_ptr<std::atomic<unsigned>[]> remaining;
+        bool dirty = true;
+        
+        double wall_time = 0;
+        double critical_time = 0;
+        
+        /*
+         * Start of the current run
+         */
+        std::chrono::steady_clock::time_point run_start;
+        
+        void compile();
+        void execute(unsigned stage);
+        void schedule(TaskGroup &group, unsigned stage);
+        void find_critical_path();
+    
+    public:
+        /**
+         * Append a stage, returns its index
+         */
+        unsigned add_stage(
+            const char * name,
+            ComponentSet reads,
+            ComponentSet writes,
+            Work work
+        );
+        
+        /**
+         * Force before to finish before after starts,
+         * on top of the component conflicts, before < after
+         */
+        void add_dependency(unsigned before, unsigned after);
+        
+        /**
+         * Run every stage once, on jobs when given one
+         * otherwise serially in declaration order
+         */
+        void run(JobSystem * jobs);
+        
+        unsigned size() const { return static_cast<unsigned>(stages.size()); }
+        const std::string & get_name(unsigned stage) const { return stages[stage].name; }
+        
+        /*
+         * Profile of the last run
+         */
+        const StageProfile & get_profile(unsigned stage) const { return profile[stage]; }
+        double get_wall_time() const { return wall_time; }
+        double get_critical_path_time() const { return critical_time; }
+        void print_profile() const;
+    };
+}
+
+#endif /* defined(__MSIM495__taskgraph__) */
@@ -0,0 +1,303 @@
+//
+//  trajectory.cpp
+//  MSIM495
+//
+
+#include "trajectory.h"
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+
+namespace Physics {
+    /*
+     * Byte offsets of the columns inside a chunk
+     */
+    struct ChunkLayout {
+        unsigned long steps, times, position[3], orientation[4], size;
+        
+        ChunkLayout(unsigned frames, unsigned bodies, bool orientations) {
+            unsigned long values = (unsigned long)frames * bodies;
+            steps = 0;
+            times = steps + frames * sizeof(uint64_t);
+            position[0] = times + frames * sizeof(real);
+            // Keep the int32 columns 4 byte aligned whatever real is
+            position[0] = (position[0] + 3) & ~3ul;
+            for (unsigned c = 1; c < 3; ++c) position[c] = position[c - 1] + values * sizeof(int32_t);
+            orientation[0] = position[2] + values * sizeof(int32_t);
+            for (unsigned c = 1; c < 4; ++c) {
+                orientation[c] = orientation[c - 1] + (orientations ? values * sizeof(int16_t) : 0);
+            }
+            size = orientation[3] + (orientations ? values * sizeof(int16_t) : 0);
+        }
+    };
+    
+    static real Vector3::* const axes[3] = { &Vector3::x, &Vector3::y, &Vector3::z };
+    
+    static unsigned long page_size() {
+        static const unsigned long size = sysconf(_SC_PAGESIZE);
+        return size;
+    }
+    
+    static unsigned long round_to_page(unsigned long bytes) {
+        return (bytes + page_size() - 1) / page_size() * page_size();
+    }
+    
+    static int32_t quantize(real v, double resolution) {
+        double q = nearbyint(v / resolution);
+        if (q > INT32_MAX) return INT32_MAX;
+        if (q < INT32_MIN) return INT32_MIN;
+        return static_cast<int32_t>(q);
+    }
+    
+    static int16_t quantize_unit(real v) {
+        if (v > 1) v = 1;
+        if (v < -1) v = -1;
+        return static_cast<int16_t>(nearbyint(v * INT16_MAX));
+    }
+    
+    
+    
+    // TrajectoryWriter //
+    //////////////////////
+    
+    bool TrajectoryWriter::open(
+        const char * path,
+        unsigned body_count,
+        bool orientations,
+        double resolution,
+        unsigned frames_per_chunk
+    ) {
+        close();
+        
+        // The header keeps the chunk size in 32 bits
+        const unsigned long chunk_bytes = round_to_page(ChunkLayout(frames_per_chunk, body_count, orientations).size);
+        if (!frames_per_chunk || chunk_bytes > UINT32_MAX) return false;
+        
+        fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        
+        if (ftruncate(fd, page_size()) != 0) {
+            close();
+            return false;
+        }
+        
+        void * mapped = mmap(nullptr, page_size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close();
+            return false;
+        }
+        
+        header = static_cast<TrajectoryHeader*>(mapped);
+        header->magic = TrajectoryHeader::magic_value;
+        header->version = TrajectoryHeader::current_version;
+        header->body_count = body_count;
+        header->frames_per_chunk = frames_per_chunk;
+        header->has_orientations = orientations;
+        header->chunk_bytes = static_cast<unsigned>(chunk_bytes);
+        header->resolution = resolution;
+        header->frame_count = 0;
+        
+        return map_chunk(0);
+    }
+    
+    bool TrajectoryWriter::map_chunk(unsigned long index) {
+        const unsigned long bytes = header->chunk_bytes;
+        if (chunk) munmap(chunk, bytes);
+        chunk = nullptr;
+        
+        off_t offset = page_size() + index * bytes;
+        if (ftruncate(fd, offset + bytes) != 0) return false;
+        
+        void * mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+        if (mapped == MAP_FAILED) return false;
+        
+        chunk = static_cast<unsigned char*>(mapped);
+        chunk_index = index;
+        return true;
+    }
+    
+    bool TrajectoryWriter::append(const Snapshot &snapshot) {
+        if (!header) return false;
+        
+        const unsigned bodies = header->body_count;
+        const unsigned frames = header->frames_per_chunk;
+        if (snapshot.positions.size() != bodies) return false;
+        if (header->has_orientations && snapshot.orientations.size() != bodies) return false;
+        
+        unsigned long frame = header->frame_count;
+        if (frame / frames != chunk_index && !map_chunk(frame / frames)) return false;
+        if (!chunk) return false;
+        
+        const ChunkLayout layout(frames, bodies, header->has_orientations);
+        const unsigned row = frame % frames;
+        
+        uint64_t step = snapshot.step;
+        memcpy(chunk + layout.steps + row * sizeof(uint64_t), &step, sizeof(uint64_t));
+        memcpy(chunk + layout.times + row * sizeof(real), &snapshot.time, sizeof(real));
+        
+        for (unsigned c = 0; c < 3; ++c) {
+            int32_t * column = reinterpret_cast<int32_t*>(chunk + layout.position[c]) + row * bodies;
+            for (unsigned b = 0; b < bodies; ++b) {
+                column[b] = quantize(snapshot.positions[b].*axes[c], header->resolution);
+            }
+        }
+        
+        if (header->has_orientations) {
+            for (unsigned c = 0; c < 4; ++c) {
+                int16_t * column = reinterpret_cast<int16_t*>(chunk + layout.orientation[c]) + row * bodies;
+                for (unsigned b = 0; b < bodies; ++b) {
+                    column[b] = quantize_unit(snapshot.orientations[b].data[c]);
+                }
+            }
+        }
+        
+        // Readers sharing the mapping see the frame once the count covers it
+        __atomic_store_n(&header->frame_count, frame + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+    
+    void TrajectoryWriter::close() {
+        if (chunk) munmap(chunk, header->chunk_bytes);
+        if (header) munmap(header, page_size());
+        if (fd >= 0) ::close(fd);
+        
+        chunk = nullptr;
+        header = nullptr;
+        fd = -1;
+        chunk_index = 0;
+    }
+    
+    
+    
+    // TrajectoryReader //
+    //////////////////////
+    
+    bool TrajectoryReader::open(const char * path) {
+        close();
+        
+        fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+        
+        if (!refresh()) {
+            close();
+            return false;
+        }
+        
+        // Chunk size has to be what the writer would have made of the
+        // header, reads trust it to stay inside the mapping
+        if (
+            header->magic != TrajectoryHeader::magic_value
+            || header->version != TrajectoryHeader::current_version
+            || !header->frames_per_chunk
+            || header->chunk_bytes != round_to_page(ChunkLayout(
+                header->frames_per_chunk,
+                header->body_count,
+                header->has_orientations
+            ).size)
+        ) {
+            close();
+            return false;
+        }
+        return true;
+    }
+    
+    bool TrajectoryReader::refresh() {
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0) return false;
+        if ((unsigned long)info.st_size < page_size()) return false;
+        if (file && (unsigned long)info.st_size == file_size) return true;
+        
+        if (file) munmap(const_cast<unsigned char*>(file), file_size);
+        file = nullptr;
+        header = nullptr;
+        
+        void * mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) return false;
+        
+        // Scrubbing jumps around, don't let the kernel read ahead whole chunks
+        madvise(mapped, info.st_size, MADV_RANDOM);
+        
+        file = static_cast<const unsigned char*>(mapped);
+        file_size = info.st_size;
+        header = reinterpret_cast<const TrajectoryHeader*>(file);
+        return true;
+    }
+    
+    void TrajectoryReader::close() {
+        if (file) munmap(const_cast<unsigned char*>(file), file_size);
+        if (fd >= 0) ::close(fd);
+        
+        file = nullptr;
+        header = nullptr;
+        file_size = 0;
+        fd = -1;
+    }
+    
+    unsigned long TrajectoryReader::frames() const {
+        if (!header) return 0;
+        
+        // A live writer may count frames in chunks this mapping doesn't cover yet
+        unsigned long written = __atomic_load_n(&header->frame_count, __ATOMIC_ACQUIRE);
+        unsigned long mapped = (file_size - page_size()) / header->chunk_bytes * header->frames_per_chunk;
+        return written < mapped ? written : mapped;
+    }
+    
+    bool TrajectoryReader::read(unsigned long frame, Snapshot &snapshot) const {
+        if (frame >= frames()) return false;
+        
+        const unsigned bodies = header->body_count;
+        const unsigned frames_per_chunk = header->frames_per_chunk;
+        const ChunkLayout layout(frames_per_chunk, bodies, header->has_orientations);
+        const unsigned char * chunk = file + page_size() + (frame / frames_per_chunk) * header->chunk_bytes;
+        const unsigned row = frame % frames_per_chunk;
+        
+        uint64_t step;
+        memcpy(&step, chunk + layout.steps + row * sizeof(uint64_t), sizeof(uint64_t));
+        snapshot.step = step;
+        memcpy(&snapshot.time, chunk + layout.times + row * sizeof(real), sizeof(real));
+        
+        snapshot.positions.resize(bodies);
+        for (unsigned c = 0; c < 3; ++c) {
+            const int32_t * column = reinterpret_cast<const int32_t*>(chunk + layout.position[c]) + row * bodies;
+            for (unsigned b = 0; b < bodies; ++b) {
+                snapshot.positions[b].*axes[c] = static_cast<real>(column[b] * header->resolution);
+            }
+        }
+        
+        if (!header->has_orientations) {
+            snapshot.orientations.clear();
+            return true;
+        }
+        
+        snapshot.orientations.resize(bodies);
+        for (unsigned c = 0; c < 4; ++c) {
+            const int16_t * column = reinterpret_cast<const int16_t*>(chunk + layout.orientation[c]) + row * bodies;
+            for (unsigned b = 0; b < bodies; ++b) {
+                snapshot.orientations[b].data[c] = static_cast<real>(column[b]) / INT16_MAX;
+            }
+        }
+        for (Quaternion &q : snapshot.orientations) q.normalize();
+        return true;
+    }
+    
+    Vector3 TrajectoryReader::position(unsigned long frame, unsigned body) const {
+        if (frame >= frames() || body >= header->body_count) return Vector3();
+        
+        const unsigned bodies = header->body_count;
+        const unsigned frames_per_chunk = header->frames_per_chunk;
+        const ChunkLayout layout(frames_per_chunk, bodies, header->has_orientations);
+        const unsigned char * chunk = file + page_size() + (frame / frames_per_chunk) * header->chunk_bytes;
+        const unsigned long index = (frame % frames_per_chunk) * bodies + body;
+        
+        Vector3 p;
+        for (unsigned c = 0; c < 3; ++c) {
+            const int32_t * column = reinterpret_cast<const int32_t*>(chunk + layout.position[c]);
+            p.*axes[c] = static_cast<real>(column[index] * header->resolution);
+        }
+        return p;
+    }
+}
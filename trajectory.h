@@ -0,0 +1,138 @@
+//
+//  trajectory.h
+//  MSIM495
+//
+
+#ifndef __MSIM495__trajectory__
+#define __MSIM495__trajectory__
+
+#include "simulation.h"
+
+namespace Physics {
+    /**
+     * On disk layout of a trajectory file
+     *
+     *     header page | chunk 0 | chunk 1 | ...
+     *
+     * Every chunk holds frames_per_chunk frames as columns, each column
+     * frames_per_chunk * body_count values wide:
+     *
+     *     steps (u64) | times (real) | x | y | z (int32) | r | i | j | k (int16)
+     *
+     * Positions are fixed point multiples of resolution, orientation
+     * components are scaled to the int16 range. Chunks are page sized so
+     * both sides map exactly the chunks they touch
+     */
+    struct TrajectoryHeader {
+        static constexpr unsigned magic_value = 0x4a54534d; // "MSTJ"
+        static constexpr unsigned current_version = 1;
+        
+        unsigned magic;
+        unsigned version;
+        unsigned body_count;
+        unsigned frames_per_chunk;
+        unsigned has_orientations;
+        unsigned chunk_bytes;
+        double resolution;
+        
+        /*
+         * Frames fully written, bumped after each append so a reader
+         * mapping the same file can follow a recording as it grows
+         */
+        unsigned long frame_count;
+    };
+    
+    
+    
+    /**
+     * Appends snapshots to a trajectory file through a writable mapping
+     * of the chunk being filled, the file grows one chunk at a time
+     */
+    class TrajectoryWriter {
+        int fd = -1;
+        TrajectoryHeader * header = nullptr;
+        unsigned char * chunk = nullptr;
+        unsigned long chunk_index = 0;
+        
+        bool map_chunk(unsigned long index);
+    
+    public:
+        TrajectoryWriter() {}
+        ~TrajectoryWriter() { close(); }
+        
+        TrajectoryWriter(const TrajectoryWriter &) = delete;
+        TrajectoryWriter & operator=(const TrajectoryWriter &) = delete;
+        
+        /**
+         * Start a new file, positions are stored to the nearest resolution
+         * metres, 1/4096 keeps a range of +-500 km
+         */
+        bool open(
+            const char * path,
+            unsigned body_count,
+            bool orientations,
+            double resolution = 1.0 / 4096,
+            unsigned frames_per_chunk = 256
+        );
+        
+        /**
+         * Record one frame, snapshot has to hold body_count positions
+         * (and orientations if the file has them)
+         */
+        bool append(const Snapshot &snapshot);
+        
+        void close();
+        
+        bool is_open() const { return header != nullptr; }
+        unsigned long frames() const { return header ? header->frame_count : 0; }
+    };
+    
+    
+    
+    /**
+     * Random access over a trajectory file
+     * The file is mapped once and paged in on demand, reading frame n
+     * touches only the pages of n's chunk that hold its rows
+     */
+    class TrajectoryReader {
+        int fd = -1;
+        const unsigned char * file = nullptr;
+        unsigned long file_size = 0;
+        const TrajectoryHeader * header = nullptr;
+    
+    public:
+        TrajectoryReader() {}
+        ~TrajectoryReader() { close(); }
+        
+        TrajectoryReader(const TrajectoryReader &) = delete;
+        TrajectoryReader & operator=(const TrajectoryReader &) = delete;
+        
+        bool open(const char * path);
+        void close();
+        
+        /**
+         * Remap to pick up frames a writer appended since open
+         */
+        bool refresh();
+        
+        /**
+         * Decode frame into snapshot, reusing its storage
+         */
+        bool read(unsigned long frame, Snapshot &snapshot) const;
+        
+        /**
+         * Decode a single body of a frame
+         */
+        Vector3 position(unsigned long frame, unsigned body) const;
+        
+        /**
+         * Frames readable through the current mapping
+         */
+        unsigned long frames() const;
+        
+        unsigned bodies() const { return header ? header->body_count : 0; }
+        bool has_orientations() const { return header && header->has_orientations; }
+    };
+}
+
+#endif /* defined(__MSIM495__trajectory__) */
@@ -6,6 +6,10 @@
 #include "trebuchet.h"
 #include "playground.h"
 #include "physics.h"
+#include "batch.h"
+#include "behavior.h"
+#include "checkpoint.h"
+#include "trajectory.h"
 #include <stdlib.h>
 
 #define CONTACT_OBJECTS 10
@@ -20,20 +24,57 @@ namespace Trebuchet {
     std::vector<Physics::Particle*> particles;
     bool physics_enabled = false;
     bool projectile_released = false;
-    Physics::ParticleRod rod;
-    Physics::ParticleRod rod2;
-    Physics::ParticleCable arm;
-    Physics::ParticleRod strength;
+    bool release_requested = false;
+    Physics::RodSet rods(&particles);
+    Physics::CableSet arm(&particles);
     Physics::real height_offset = 2.f;
     Physics::real counterweight = 1000;
     Physics::real score = 0.f;
     Physics::ParticleGravity gravity(Physics::Vector3(0,-10,0));
     Physics::ParticleGravity inverse(Physics::Vector3(0, 10,0));
     
-    Physics::Particle * anchor = new Physics::Particle();
-    Physics::Particle * pendulum = new Physics::Particle();
-    Physics::Particle * hook = new Physics::Particle();
-    Physics::Particle * projectile = new Physics::Particle();
+    /**
+     * Every trebuchet particle lives in the pool, pointers into it stay
+     * put for as long as the particle does
+     */
+    Physics::ParticlePool pool;
+    Physics::Particle * anchor = pool.get(pool.create());
+    Physics::Particle * pendulum = pool.get(pool.create());
+    Physics::Particle * hook = pool.get(pool.create());
+    Physics::Particle * projectile = pool.get(pool.create());
+    
+    /**
+     * Everything reset rolls back, taken at the end of initialize
+     */
+    Physics::GeneratorTable generators = { {&gravity}, {&rods, &arm} };
+    Physics::Checkpoint start;
+    
+    /**
+     * Warm starts the rods and the sling, they stay taut step after step
+     */
+    Physics::ContactCache contact_cache;
+    
+    void release_projectile();
+    
+    /**
+     * Queue a change for the next step, the world steps on this thread
+     * so a full queue is applied here rather than dropping the change
+     */
+    void submit(const Physics::WorldCommand &command) {
+        if (world.commands.push(command)) return;
+        
+        world.apply_commands();
+        world.commands.push(command);
+    }
+    
+    /**
+     * Lets go of the sling at the start of the step after 'r',
+     * never half way through contact generation
+     */
+    Physics::Behavior sling_release() {
+        co_await Physics::wait_until([]() { return release_requested; });
+        release_projectile();
+    }
     
     void initialize() {
         world.pass_particles(&particles);
@@ -65,28 +106,22 @@ namespace Trebuchet {
         // - Will aggregate mass with two end rods
         // connecting to the anchor and one rod
         // connecting each end of the bar
-        rod.left = anchor;
-        rod.right = pendulum;
-        rod.max_length = 2;
+        // - Indices follow the particles list above
+        rods.clear();
+        rods.add(0, 1, 2);
+        rods.add(0, 2, 2);
+        rods.add(2, 1, 4);
         
-        rod2.left = anchor;
-        rod2.right = hook;
-        rod2.max_length = 2;
-        
-        strength.left = hook;
-        strength.right = pendulum;
-        strength.max_length = 4;
-        
-        arm.left = hook;
-        arm.right = projectile;
-        arm.max_length = 1;
-        arm.restitution = 0.5;
+        arm.clear();
+        arm.add(2, 3, 1, 0.5);
         
         // Push collision constructs
-        world.contact_generators.push_back(&rod);
-        world.contact_generators.push_back(&rod2);
-        world.contact_generators.push_back(&strength);
+        world.contact_generators.push_back(&rods);
         world.contact_generators.push_back(&arm);
+        world.set_contact_cache(&contact_cache);
+        
+        world.behaviors->spawn(sling_release());
+        start.capture(&world, nullptr, generators);
     }
     
     void release_projectile() {
@@ -134,63 +169,276 @@ namespace Trebuchet {
         if (proj_pos.x > 0 && proj_pos.y > 0) score += 1;
     
         Graphics::orthographic_render([](unsigned window_width, unsigned window_height){
-            char * score_text = (char *)malloc(255);
-            char * counterweight_text = (char*)malloc(255);
-            sprintf(score_text, "Score: %d", (int)score);
-            sprintf(counterweight_text, "Counterweight: %d g", (int)counterweight);
-            Graphics::render_text((const char *)score_text, Physics::Vector3(50, window_height - 60, 0));
-            Graphics::render_text((const char *)counterweight_text, Physics::Vector3(50, window_height-80, 0));
+            char score_text[64];
+            char counterweight_text[64];
+            snprintf(score_text, sizeof(score_text), "Score: %d", (int)score);
+            snprintf(counterweight_text, sizeof(counterweight_text), "Counterweight: %d g", (int)counterweight);
+            Graphics::render_text(score_text, Physics::Vector3(50, window_height - 60, 0));
+            Graphics::render_text(counterweight_text, Physics::Vector3(50, window_height-80, 0));
             Graphics::render_text("Press Enter to Start", Physics::Vector3(50, window_height-100, 0));
             Graphics::render_text("'r': Release 'e': Reset", Physics::Vector3(50, window_height-120, 0));
             Graphics::render_text("'i': Increase Weight", Physics::Vector3(50, window_height-140, 0));
             Graphics::render_text("'u': Decrease Weight", Physics::Vector3(50, window_height-160, 0));
-            free((void*)score_text);
-            free((void*)counterweight_text);
+            Graphics::render_text("'o': Optimize Weight", Physics::Vector3(50, window_height-180, 0));
+            Graphics::render_text("'t': Record 'p': Replay", Physics::Vector3(50, window_height-200, 0));
+            Graphics::render_text("'m': Mirror", Physics::Vector3(50, window_height-220, 0));
         });
     }
     
+    /**
+     * 't' records every step to trajectory_path, 'p' plays the
+     * recording back in place of the simulation
+     */
+    const char * trajectory_path = "trebuchet.traj";
+    Physics::TrajectoryWriter recorder;
+    Physics::TrajectoryReader player;
+    Physics::Snapshot frame;
+    unsigned long replay_frame = 0;
+    unsigned long world_steps = 0;
+    
+    void toggle_recording() {
+        if (recorder.is_open()) recorder.close();
+        else recorder.open(trajectory_path, (unsigned)particles.size(), false);
+    }
+    
+    /**
+     * 'm' mirrors every step to mirror_name, any process on the host
+     * can follow along with a Physics::MirrorSubscriber
+     */
+    const char * mirror_name = "/msim495-trebuchet";
+    Physics::MirrorPublisher mirror;
+    
+    void toggle_mirror() {
+        if (mirror.is_open()) mirror.close();
+        else mirror.open(mirror_name);
+    }
+    
+    void toggle_replay() {
+        if (player.frames()) {
+            player.close();
+            return;
+        }
+        
+        recorder.close();
+        physics_enabled = false;
+        replay_frame = 0;
+        player.open(trajectory_path);
+    }
+    
     void calculate_physics() {
+        if (player.frames()) {
+            if (!player.read(replay_frame, frame)) return;
+            for (unsigned i = 0; i < particles.size() && i < frame.positions.size(); ++i) {
+                particles[i]->set_position(frame.positions[i]);
+            }
+            if (replay_frame + 1 < player.frames()) ++replay_frame;
+            return;
+        }
+        
         Physics::real duration = Graphics::get_seconds_per_frame();
-        if (physics_enabled) world.run_physics(duration);
+        if (!physics_enabled) return;
+        world.run_physics(duration);
+        
+        if (recorder.is_open()) {
+            Physics::capture_particles(particles, frame);
+            frame.step = recorder.frames();
+            frame.time = frame.step * duration;
+            recorder.append(frame);
+        }
+        
+        if (mirror.is_open()) {
+            Physics::capture_particles(particles, frame);
+            frame.step = world_steps;
+            frame.time = world_steps * duration;
+            mirror.publish(frame);
+        }
+        ++world_steps;
     }
     
     void reset() {
         physics_enabled = false;
         projectile_released = false;
-        particles.clear();
-        world.registry.clear();
-        world.contact_generators.clear();
+        release_requested = false;
         score = 0.f;
-        Util::map(particles, [](Physics::Particle * particle){
-            particle->clear();
-        });
-        initialize();
+        
+        // Back to the state initialize left, the sling included
+        world.behaviors->clear();
+        start.restore(&world, nullptr, generators);
+        contact_cache.clear();
+        submit(Physics::WorldCommand::set_mass(pendulum, counterweight));
+        world.behaviors->spawn(sling_release());
     }
     
     void debug() {
     }
     
+    /**
+     * Private copy of the trebuchet for batch runs
+     */
+    class SweepScene {
+        enum { ANCHOR, PENDULUM, HOOK, PROJECTILE, COUNT };
+        
+        Physics::Particle bodies[COUNT];
+        std::vector<Physics::Particle*> scene_particles;
+        Physics::ParticleWorld scene_world;
+        Physics::RodSet scene_rods;
+        Physics::CableSet scene_sling;
+        Physics::ParticleGravity scene_gravity;
+        
+        Physics::real release_time;
+        Physics::real time = 0;
+        bool released = false;
+        SweepResult result;
+    
+    public:
+        SweepScene(const SweepParameters &p) :
+            scene_world(CONTACT_OBJECTS),
+            scene_rods(&scene_particles),
+            scene_sling(&scene_particles),
+            scene_gravity(Physics::Vector3(0, -10, 0)),
+            release_time(p.release_time)
+        {
+            bodies[ANCHOR].set_position(Physics::Vector3(0, 2, 0));
+            bodies[PENDULUM].set_position(Physics::Vector3(p.short_arm, 2, 0));
+            bodies[HOOK].set_position(Physics::Vector3(-p.long_arm, 2, 0));
+            bodies[PROJECTILE].set_position(Physics::Vector3(-p.long_arm, 2 - p.sling, 0));
+            
+            bodies[ANCHOR].set_mass(0);
+            bodies[PENDULUM].set_mass(p.counterweight);
+            bodies[HOOK].set_mass(1);
+            bodies[PROJECTILE].set_mass(1);
+            
+            for (unsigned i = 0; i < COUNT; ++i) scene_particles.push_back(&bodies[i]);
+            scene_world.pass_particles(&scene_particles);
+            
+            scene_world.registry.add(&bodies[PENDULUM], &scene_gravity);
+            scene_world.registry.add(&bodies[HOOK], &scene_gravity);
+            scene_world.registry.add(&bodies[PROJECTILE], &scene_gravity);
+            
+            scene_rods.add(ANCHOR, PENDULUM, p.short_arm);
+            scene_rods.add(ANCHOR, HOOK, p.long_arm);
+            scene_rods.add(HOOK, PENDULUM, p.short_arm + p.long_arm);
+            scene_sling.add(HOOK, PROJECTILE, p.sling, 0.5);
+            
+            scene_world.contact_generators.push_back(&scene_rods);
+            scene_world.contact_generators.push_back(&scene_sling);
+        }
+        
+        void step(Physics::real duration) {
+            const Physics::Vector3 before = bodies[PROJECTILE].get_position();
+            
+            scene_world.run_physics(duration);
+            time += duration;
+            
+            const Physics::Vector3 &after = bodies[PROJECTILE].get_position();
+            if (after.y > result.peak_height) result.peak_height = after.y;
+            
+            if (!released) {
+                if (time >= release_time) {
+                    scene_world.contact_generators.pop_back();
+                    released = true;
+                }
+                return;
+            }
+            
+            result.flight_time += duration;
+            
+            // Interpolate where this step crossed the ground
+            if (after.y <= 0 && before.y > 0) {
+                Physics::real t = before.y / (before.y - after.y);
+                result.range = before.x + (after.x - before.x) * t;
+                result.landed = true;
+            }
+        }
+        
+        bool finished() const { return result.landed; }
+        SweepResult metrics() const { return result; }
+    };
+    
+    std::vector<SweepResult> sweep(
+        const std::vector<SweepParameters> &designs,
+        Physics::JobSystem * jobs,
+        Physics::real duration,
+        unsigned max_steps
+    ) {
+        std::vector<SweepResult> results(designs.size());
+        Physics::run_batch<SweepScene>(
+            jobs,
+            designs.data(),
+            results.data(),
+            static_cast<unsigned>(designs.size()),
+            duration,
+            max_steps
+        );
+        return results;
+    }
+    
+    /**
+     * Sweep counterweight against release time for the current arm
+     * and keep the counterweight of the longest throw
+     */
+    void optimize_counterweight() {
+        static Physics::JobSystem jobs;
+        
+        std::vector<SweepParameters> designs;
+        for (int weight = 10; weight <= 3000; weight += 10) {
+            for (int release = 1; release <= 20; ++release) {
+                SweepParameters p;
+                p.counterweight = weight;
+                p.release_time = release * 0.05f;
+                designs.push_back(p);
+            }
+        }
+        
+        std::vector<SweepResult> results = sweep(designs, &jobs);
+        
+        // Only designs whose projectile came down have a range to compare
+        const unsigned none = static_cast<unsigned>(results.size());
+        unsigned best = none;
+        for (unsigned i = 0; i < results.size(); ++i) {
+            if (!results[i].landed) continue;
+            if (best == none || results[i].range > results[best].range) best = i;
+        }
+        
+        if (best == none) {
+            printf("sweep: none of %u designs landed, counterweight left at %.0f\n", (unsigned)designs.size(), counterweight);
+            return;
+        }
+        
+        printf(
+            "sweep: %u designs, best range %.1f at counterweight %.0f, release %.2fs\n",
+            (unsigned)designs.size(), results[best].range,
+            designs[best].counterweight, designs[best].release_time
+        );
+        
+        counterweight = designs[best].counterweight;
+        submit(Physics::WorldCommand::set_mass(pendulum, counterweight));
+    }
+    
     void destruct() {
-        Util::map(particles, [](Physics::Particle * particle){
-            delete particle;
-        });
+        particles.clear();
+        pool.clear();
     }
 
     int main(int argc, char ** argv) {
         Graphics::Graphics(800, 600, argc, argv);
         
         Graphics::register_fire($(physics_enabled = !physics_enabled;), ENTER_KEY);
-        Graphics::register_fire(release_projectile, 'r');
+        Graphics::register_fire($(release_requested = true;), 'r');
         Graphics::register_fire(reset, 'e');
         Graphics::register_fire($(
             counterweight += 10;
-            pendulum->set_mass(counterweight);
+            submit(Physics::WorldCommand::set_mass(pendulum, counterweight));
         ), 'i');
         Graphics::register_fire($(
             if (counterweight - 10 == 0) return;
             counterweight -= 10;
-            pendulum->set_mass(counterweight);
+            submit(Physics::WorldCommand::set_mass(pendulum, counterweight));
         ), 'u');
+        Graphics::register_fire(optimize_counterweight, 'o');
+        Graphics::register_fire(toggle_recording, 't');
+        Graphics::register_fire(toggle_mirror, 'm');
+        Graphics::register_fire(toggle_replay, 'p');
         
         initialize();
         
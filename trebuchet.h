@@ -10,8 +10,43 @@
 #define __MSIM495__trebuchet__
 
 #include <stdio.h>
+#include <vector>
+#include "core.h"
+
+namespace Physics { class JobSystem; }
 
 namespace Trebuchet {
+    /**
+     * One design to try, same layout as the interactive trebuchet
+     * with the anchor at (0, 2, 0)
+     */
+    struct SweepParameters {
+        Physics::real counterweight = 1000;
+        Physics::real short_arm = 2;
+        Physics::real long_arm = 2;
+        Physics::real sling = 1;
+        // Seconds after start before the sling lets go
+        Physics::real release_time = 0.5;
+    };
+    
+    struct SweepResult {
+        // x where the projectile comes back down through y = 0
+        Physics::real range = 0;
+        Physics::real peak_height = 0;
+        Physics::real flight_time = 0;
+        bool landed = false;
+    };
+    
+    /**
+     * Simulate every design in its own world, spread over jobs
+     */
+    std::vector<SweepResult> sweep(
+        const std::vector<SweepParameters> &designs,
+        Physics::JobSystem * jobs,
+        Physics::real duration = 1.f / 60.f,
+        unsigned max_steps = 600
+    );
+    
     int main(int argc, char ** argv);
 }
 